@@ -0,0 +1,29 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-26
+ * @copyleft Apache 2.0
+ */
+#include "arena.h"
+#include <cstddef>
+#include <new>
+#include <assert.h>
+
+void* PoolResource::do_allocate(size_t bytes, size_t alignment) {
+    assert(alignment <= alignof(std::max_align_t));
+    size_t capacity = 0;
+    return BufferPool::Alloc(bytes, &capacity);
+}
+
+void PoolResource::do_deallocate(void* p, size_t bytes, size_t alignment) {
+    BufferPool::Free(static_cast<char*>(p), BufferPool::ChunkSize(bytes));
+}
+
+bool PoolResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
+
+Arena::Arena(size_t initSize) : mono_(initSize, &upstream_) {}
+
+void Arena::Reset() {
+    mono_.release();
+}
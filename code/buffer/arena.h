@@ -0,0 +1,34 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-26
+ * @copyleft Apache 2.0
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+#include <memory_resource>
+#include "bufferpool.h"
+
+/* 以BufferPool为上游的内存资源，块大小按BufferPool的级别取整 */
+class PoolResource : public std::pmr::memory_resource {
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+};
+
+/* 单调递增（bump）分配器：一个请求内的短生命周期字符串都从这里分配，
+   请求结束时 Reset 一次性归还给内存池，单个对象的释放不做任何事 */
+class Arena {
+public:
+    explicit Arena(size_t initSize = 4096);
+
+    std::pmr::memory_resource* Resource() { return &mono_; }
+    void Reset();       // 调用前必须保证没有对象再引用arena中的内存
+
+private:
+    PoolResource upstream_;
+    std::pmr::monotonic_buffer_resource mono_;
+};
+
+#endif //ARENA_H
@@ -5,7 +5,15 @@
  */ 
 #include "buffer.h"
 
-Buffer::Buffer(int initBuffSize) : buffer_(initBuffSize), readPos_(0), writePos_(0) {}
+Buffer::Buffer(int initBuffSize) : buffer_(nullptr), capacity_(0), readPos_(0), writePos_(0) {
+    if(initBuffSize > 0) {
+        buffer_ = BufferPool::Alloc(initBuffSize, &capacity_);
+    }
+}
+
+Buffer::~Buffer() {
+    BufferPool::Free(buffer_, capacity_);
+}
 
 // 获取可读字节数
 size_t Buffer::ReadableBytes() const {
@@ -14,7 +22,7 @@ size_t Buffer::ReadableBytes() const {
 
 // 获取可写字节数
 size_t Buffer::WritableBytes() const {
-    return buffer_.size() - writePos_;
+    return capacity_ - writePos_;
 }
 
 // 获取已读字节数
@@ -39,9 +47,18 @@ void Buffer::RetrieveUntil(const char* end) {
     Retrieve(end - Peek());
 }
 
-// 缓冲区清零
+// 清空缓冲区（只重置读写位置，不再逐字节清零）
 void Buffer::RetrieveAll() {
-    bzero(&buffer_[0], buffer_.size());     
+    readPos_ = 0;
+    writePos_ = 0;
+}
+
+// 连接空闲时归还内存块，下次写入时再按需申请
+void Buffer::Release() {
+    if(ReadableBytes() > 0 || !buffer_) { return; }
+    BufferPool::Free(buffer_, capacity_);
+    buffer_ = nullptr;
+    capacity_ = 0;
     readPos_ = 0;
     writePos_ = 0;
 }
@@ -142,7 +159,7 @@ ssize_t Buffer::ReadFd(int fd, int* saveErrno) {
     }
     else 
     {
-        writePos_ = buffer_.size();
+        writePos_ = capacity_;
         Append(buff, len - writable);
     }
     return len;
@@ -163,21 +180,31 @@ ssize_t Buffer::WriteFd(int fd, int* saveErrno) {
 
 // 获取缓存的首地址
 char* Buffer::BeginPtr_() {
-    return &*buffer_.begin();
+    return buffer_;
 }
 
 // 获取缓存的首地址
 const char* Buffer::BeginPtr_() const {
-    return &*buffer_.begin();
+    return buffer_;
 }
 
 
 // 更新缓存大小
 void Buffer::MakeSpace_(size_t len) {
-    // 01:可写字节数+已读字节数<写入字节数（扩容）
+    // 01:可写字节数+已读字节数<写入字节数（换一个更大的内存块，顺便把未读数据移到开头）
     if(WritableBytes() + PrependableBytes() < len) 
     {
-        buffer_.resize(writePos_ + len + 1);
+        size_t readable = ReadableBytes();
+        size_t newCapacity = 0;
+        char* newBuffer = BufferPool::Alloc(readable + len + 1, &newCapacity);
+        if(readable) {
+            std::copy(BeginPtr_() + readPos_, BeginPtr_() + writePos_, newBuffer);
+        }
+        BufferPool::Free(buffer_, capacity_);
+        buffer_ = newBuffer;
+        capacity_ = newCapacity;
+        readPos_ = 0;
+        writePos_ = readable;
     }
     // 02:可写字节数+已读字节数>=写入字节数（移动，类似于循环数组）
     else 
@@ -13,10 +13,12 @@
 #include <vector>       //readv
 #include <atomic>
 #include <assert.h>
+#include "bufferpool.h"
+
 class Buffer {
 public:
     Buffer(int initBuffSize = 1024);
-    ~Buffer() = default;
+    ~Buffer();
 
     size_t WritableBytes() const;   // 可写的字节数     
     size_t ReadableBytes() const ;  // 可读的字节数
@@ -31,6 +33,8 @@ public:
 
     void RetrieveAll() ;
     std::string RetrieveAllToStr();
+    void Release();                 // 无数据时把内存块还给内存池
+    size_t Capacity() const { return capacity_; }
 
     const char* BeginWriteConst() const;
     char* BeginWrite();
@@ -48,7 +52,8 @@ private:
     const char* BeginPtr_() const;
     void MakeSpace_(size_t len);    // 创建新的空间
 
-    std::vector<char> buffer_;      // 具体装数据的容器
+    char* buffer_;                  // 具体装数据的内存块（来自BufferPool）
+    size_t capacity_;               // 内存块大小
     std::atomic<std::size_t> readPos_;  // 读的位置
     std::atomic<std::size_t> writePos_; // 写的位置
 };
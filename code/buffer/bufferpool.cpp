@@ -0,0 +1,85 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-26
+ * @copyleft Apache 2.0
+ */
+#include "bufferpool.h"
+#include <cstdlib>
+#include <assert.h>
+
+// 线程的内存池是否已析构（静态对象析构时仍可能归还内存块）
+static thread_local bool poolDestroyed = false;
+
+// 每个线程独享一个内存池
+BufferPool* BufferPool::Instance_() {
+    if(poolDestroyed) { return nullptr; }
+    static thread_local BufferPool pool;
+    return &pool;
+}
+
+// 线程退出时释放所有缓存的内存块
+BufferPool::~BufferPool() {
+    for(int i = 0; i < CLASS_NUM; i++) {
+        for(char* chunk : freeList_[i]) {
+            free(chunk);
+        }
+        freeList_[i].clear();
+    }
+    cachedBytes_ = 0;
+    poolDestroyed = true;
+}
+
+// 向上取整到所在级别的块大小
+size_t BufferPool::ChunkSize(size_t size) {
+    size_t chunk = MIN_CHUNK;
+    while(chunk < size) {
+        chunk <<= 1;
+    }
+    return chunk;
+}
+
+// 块大小对应的级别，不属于任何级别返回 -1
+int BufferPool::ClassIndex_(size_t capacity) {
+    size_t chunk = MIN_CHUNK;
+    for(int i = 0; i < CLASS_NUM; i++, chunk <<= 1) {
+        if(chunk == capacity) { return i; }
+    }
+    return -1;
+}
+
+char* BufferPool::Alloc(size_t size, size_t* capacity) {
+    assert(capacity);
+    size_t chunk = ChunkSize(size);
+    int idx = ClassIndex_(chunk);
+    *capacity = chunk;
+    // 01：优先复用空闲块
+    BufferPool* pool = Instance_();
+    if(pool && idx >= 0 && !pool->freeList_[idx].empty()) {
+        char* p = pool->freeList_[idx].back();
+        pool->freeList_[idx].pop_back();
+        pool->cachedBytes_ -= chunk;
+        return p;
+    }
+    // 02：向系统申请
+    char* p = static_cast<char*>(malloc(chunk));
+    assert(p);
+    return p;
+}
+
+void BufferPool::Free(char* chunk, size_t capacity) {
+    if(!chunk) { return; }
+    int idx = ClassIndex_(capacity);
+    BufferPool* pool = Instance_();
+    // 大块或缓存已满，直接还给系统
+    if(!pool || idx < 0 || pool->cachedBytes_ + capacity > MAX_CACHED) {
+        free(chunk);
+        return;
+    }
+    pool->freeList_[idx].push_back(chunk);
+    pool->cachedBytes_ += capacity;
+}
+
+size_t BufferPool::CachedBytes() {
+    BufferPool* pool = Instance_();
+    return pool ? pool->cachedBytes_ : 0;
+}
@@ -0,0 +1,36 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-26
+ * @copyleft Apache 2.0
+ */
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+#include <cstddef>
+#include <vector>
+
+/* 按尺寸分级的内存块池，每个线程一个实例，无需加锁
+   1K, 2K, 4K ... 64K 共 7 级，超过 64K 的大块直接向系统申请 */
+class BufferPool {
+public:
+    static char* Alloc(size_t size, size_t* capacity);  // 申请不小于size的内存块，capacity返回实际容量
+    static void Free(char* chunk, size_t capacity);     // 归还内存块到当前线程的池
+
+    static size_t ChunkSize(size_t size);       // size 所在级别的块大小
+    static size_t CachedBytes();                // 当前线程缓存的空闲字节数
+
+private:
+    BufferPool() : cachedBytes_(0) {}
+    ~BufferPool();
+    static BufferPool* Instance_();             // 当前线程的内存池，线程退出后返回nullptr
+    static int ClassIndex_(size_t capacity);
+
+    static const size_t MIN_CHUNK = 1024;       // 最小块 1K
+    static const int CLASS_NUM = 7;             // 最大块 64K
+    static const size_t MAX_CACHED = 4 << 20;   // 每个线程最多缓存 4M 空闲块
+
+    std::vector<char*> freeList_[CLASS_NUM];    // 各级空闲块
+    size_t cachedBytes_;                        // 空闲块总字节数
+};
+
+#endif //BUFFER_POOL_H
@@ -0,0 +1,193 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-26
+ * @copyleft Apache 2.0
+ */
+#include "chainbuffer.h"
+#include <cstring>
+#include <errno.h>
+#include <algorithm>
+
+ChainBuffer::ChainBuffer(size_t blockSize) : blockSize_(blockSize), readable_(0) {
+    assert(blockSize > 0);
+}
+
+ChainBuffer::~ChainBuffer() {
+    readable_ = 0;
+    while(!blocks_.empty()) {
+        PopBlock_();
+    }
+}
+
+// 在链尾追加一个空块
+void ChainBuffer::PushBlock_() {
+    Block b;
+    b.data = BufferPool::Alloc(blockSize_, &b.capacity);
+    b.readPos = b.writePos = 0;
+    blocks_.push_back(b);
+}
+
+// 移除链头的块
+void ChainBuffer::PopBlock_() {
+    BufferPool::Free(blocks_.front().data, blocks_.front().capacity);
+    blocks_.pop_front();
+}
+
+std::string_view ChainBuffer::Front() const {
+    if(blocks_.empty()) { return std::string_view(); }
+    const Block& b = blocks_.front();
+    return std::string_view(b.data + b.readPos, b.writePos - b.readPos);
+}
+
+size_t ChainBuffer::Slices(std::string_view* out, size_t n) const {
+    size_t cnt = 0;
+    for(const Block& b : blocks_) {
+        if(cnt >= n) { break; }
+        if(b.writePos > b.readPos) {
+            out[cnt++] = std::string_view(b.data + b.readPos, b.writePos - b.readPos);
+        }
+    }
+    return cnt;
+}
+
+// 查找"\r\n"，'\r'和'\n'可能分别位于相邻两块
+size_t ChainBuffer::FindCRLF() const {
+    size_t offset = 0;
+    bool lastCR = false;
+    for(const Block& b : blocks_) {
+        const char* begin = b.data + b.readPos;
+        size_t len = b.writePos - b.readPos;
+        if(len == 0) { continue; }
+        if(lastCR && begin[0] == '\n') { return offset - 1; }
+        const char* p = begin;
+        while((p = static_cast<const char*>(memchr(p, '\r', begin + len - p)))) {
+            if(p + 1 < begin + len && p[1] == '\n') {
+                return offset + (p - begin);
+            }
+            p++;
+        }
+        lastCR = (begin[len - 1] == '\r');
+        offset += len;
+    }
+    return npos;
+}
+
+// 行落在同一块内时直接返回块内指针，只有跨块的行才拷贝
+std::string_view ChainBuffer::View(size_t len, std::string* scratch) const {
+    assert(len <= readable_);
+    std::string_view front = Front();
+    if(len <= front.size()) {
+        return front.substr(0, len);
+    }
+    assert(scratch);
+    scratch->clear();
+    for(const Block& b : blocks_) {
+        size_t n = std::min(len - scratch->size(), b.writePos - b.readPos);
+        scratch->append(b.data + b.readPos, n);
+        if(scratch->size() == len) { break; }
+    }
+    return std::string_view(*scratch);
+}
+
+void ChainBuffer::Retrieve(size_t len) {
+    assert(len <= readable_);
+    readable_ -= len;
+    while(len > 0) {
+        Block& b = blocks_.front();
+        size_t n = std::min(len, b.writePos - b.readPos);
+        b.readPos += n;
+        len -= n;
+        if(b.readPos == b.writePos && (blocks_.size() > 1 || b.writePos == b.capacity)) {
+            PopBlock_();
+        }
+    }
+    // 只剩一个读完的块时复用它
+    if(readable_ == 0 && !blocks_.empty()) {
+        blocks_.front().readPos = blocks_.front().writePos = 0;
+    }
+}
+
+void ChainBuffer::RetrieveAll() {
+    Retrieve(readable_);
+}
+
+std::string ChainBuffer::RetrieveAllToStr() {
+    std::string str;
+    str.reserve(readable_);
+    for(const Block& b : blocks_) {
+        str.append(b.data + b.readPos, b.writePos - b.readPos);
+    }
+    RetrieveAll();
+    return str;
+}
+
+void ChainBuffer::Release() {
+    RetrieveAll();
+    while(!blocks_.empty()) {
+        PopBlock_();
+    }
+}
+
+void ChainBuffer::Append(const std::string& str) {
+    Append(str.data(), str.length());
+}
+
+// 写满当前块后接着写新块，已有数据不动
+void ChainBuffer::Append(const char* str, size_t len) {
+    assert(str || len == 0);
+    while(len > 0) {
+        if(blocks_.empty() || blocks_.back().writePos == blocks_.back().capacity) {
+            PushBlock_();
+        }
+        Block& b = blocks_.back();
+        size_t n = std::min(len, b.capacity - b.writePos);
+        memcpy(b.data + b.writePos, str, n);
+        b.writePos += n;
+        readable_ += n;
+        str += n;
+        len -= n;
+    }
+}
+
+// 先读进尾块的剩余空间；只有尾块被读满（socket里可能还有数据）时才申请新块，分散读进去
+ssize_t ChainBuffer::ReadFd(int fd, int* saveErrno) {
+    // 01：尾块没有空间时换一个新块
+    if(blocks_.empty() || blocks_.back().writePos == blocks_.back().capacity) {
+        PushBlock_();
+    }
+    Block& tail = blocks_.back();
+    const size_t room = tail.capacity - tail.writePos;
+    const ssize_t len = read(fd, tail.data + tail.writePos, room);
+    if(len < 0) {
+        *saveErrno = errno;
+        return len;
+    }
+    tail.writePos += len;
+    readable_ += len;
+    if(static_cast<size_t>(len) < room) {
+        return len;
+    }
+
+    // 02：尾块读满了：申请若干新块，一次readv读入
+    size_t oldCount = blocks_.size();
+    struct iovec iov[READ_BLOCKS];
+    for(int i = 0; i < READ_BLOCKS; i++) {
+        PushBlock_();
+        iov[i].iov_base = blocks_.back().data;
+        iov[i].iov_len = blocks_.back().capacity;
+    }
+    const ssize_t more = readv(fd, iov, READ_BLOCKS);
+    size_t left = more > 0 ? static_cast<size_t>(more) : 0;
+    readable_ += left;
+    for(size_t i = oldCount; i < blocks_.size() && left > 0; i++) {
+        size_t n = std::min(left, blocks_[i].capacity);
+        blocks_[i].writePos = n;
+        left -= n;
+    }
+    // 03：归还没用上的块；这次已经读到数据，readv的EAGAIN等留给下一次调用处理
+    while(blocks_.size() > oldCount && blocks_.back().writePos == 0) {
+        BufferPool::Free(blocks_.back().data, blocks_.back().capacity);
+        blocks_.pop_back();
+    }
+    return len + (more > 0 ? more : 0);
+}
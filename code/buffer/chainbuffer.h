@@ -0,0 +1,61 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-26
+ * @copyleft Apache 2.0
+ */
+
+#ifndef CHAIN_BUFFER_H
+#define CHAIN_BUFFER_H
+#include <string>
+#include <string_view>
+#include <deque>
+#include <unistd.h>     // read
+#include <sys/uio.h>    // readv
+#include <assert.h>
+#include "bufferpool.h"
+
+/* 链式缓冲区：由若干内存块（来自BufferPool）串成，只用作读缓冲区
+   ReadFd 用 readv 直接读进内存块，扩容时不搬移已有数据；响应仍写在连续的Buffer里 */
+class ChainBuffer {
+public:
+    explicit ChainBuffer(size_t blockSize = 16384);
+    ~ChainBuffer();
+
+    size_t ReadableBytes() const { return readable_; }
+    size_t BlockCount() const { return blocks_.size(); }
+
+    std::string_view Front() const;                     // 第一块中的可读数据
+    size_t Slices(std::string_view* out, size_t n) const;  // 依次取出所有可读分片
+
+    static const size_t npos = static_cast<size_t>(-1);
+    size_t FindCRLF() const;                            // 第一个"\r\n"相对可读数据开头的偏移
+    std::string_view View(size_t len, std::string* scratch) const;  // 前len字节，跨块时才拷贝到scratch
+
+    void Retrieve(size_t len);
+    void RetrieveAll();
+    std::string RetrieveAllToStr();
+    void Release();                                     // 内存块全部还给内存池
+
+    void Append(const std::string& str);
+    void Append(const char* str, size_t len);
+
+    ssize_t ReadFd(int fd, int* Errno);
+
+private:
+    struct Block {
+        char* data;         // 内存块
+        size_t capacity;    // 块大小
+        size_t readPos;     // 读的位置
+        size_t writePos;    // 写的位置
+    };
+    void PushBlock_();
+    void PopBlock_();
+
+    static const int READ_BLOCKS = 4;       // 尾块读满后一次readv最多读入的新块数
+
+    std::deque<Block> blocks_;              // 内存块链
+    size_t blockSize_;                      // 每块大小
+    size_t readable_;                       // 可读字节总数
+};
+
+#endif //CHAIN_BUFFER_H
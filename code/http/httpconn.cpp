@@ -3,17 +3,35 @@
  * @Date         : 2020-06-15
  * @copyleft Apache 2.0
  */ 
+#define LOG_MODULE Log::MODULE_HTTP
 #include "httpconn.h"
 using namespace std;
 
 const char* HttpConn::srcDir;
 std::atomic<int> HttpConn::userCount;
 bool HttpConn::isET;
+bool HttpConn::isChain;
+bool HttpConn::accessLog;
 
-HttpConn::HttpConn() { 
+static int64_t NowUs() {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+HttpConn::HttpConn() : request_(arena_.Resource()), response_(arena_.Resource()) { 
     fd_ = -1;
     addr_ = { 0 };
     isClose_ = true;
+    iovCnt_ = 0;
+    iov_[0] = iov_[1] = { nullptr, 0 };
+    reqStart_ = 0;
+    respBytes_ = 0;
+    requests_ = 0;
+    state_ = -1;
+    pendingUs_ = 0;
+    busy_ = 0;
+    partial_ = false;
 };
 
 HttpConn::~HttpConn() { 
@@ -27,7 +45,14 @@ void HttpConn::init(int fd, const sockaddr_in& addr) {
     fd_ = fd;
     writeBuff_.RetrieveAll();
     readBuff_.RetrieveAll();
+    readChain_.RetrieveAll();
+    reqStart_ = 0;
+    respBytes_ = 0;
+    requests_ = 0;
+    pendingUs_ = 0;
+    partial_ = false;
     isClose_ = false;
+    SetState(Metrics::CONN_READING);
     LOG_INFO("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
 }
 
@@ -36,11 +61,20 @@ void HttpConn::Close() {
     if(isClose_ == false){
         isClose_ = true; 
         userCount--;
+        if(state_ >= 0) { Metrics::Adjust(state_, -1); }
+        state_ = -1;
         close(fd_);
         LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
     }
 }
 
+void HttpConn::SetState(int state) {
+    if(isClose_ || state == state_) { return; }
+    if(state_ >= 0) { Metrics::Adjust(state_, -1); }
+    Metrics::Adjust(state, 1);
+    state_ = state;
+}
+
 int HttpConn::GetFd() const {
     return fd_;
 };
@@ -61,10 +95,12 @@ ssize_t HttpConn::read(int* saveErrno)
 {
     ssize_t len = -1;
     do {
-        len = readBuff_.ReadFd(fd_, saveErrno);
+        len = isChain ? readChain_.ReadFd(fd_, saveErrno) : readBuff_.ReadFd(fd_, saveErrno);
         if (len <= 0) {
             break;
         }
+        Metrics::Add(Metrics::BYTES_IN, len);
+        if(reqStart_ == 0) { reqStart_ = NowUs(); }
     } while (isET);     // ET模式，一次性读完所有数据
     return len;
 }
@@ -77,6 +113,7 @@ ssize_t HttpConn::write(int* saveErrno) {
             *saveErrno = errno;
             break;
         }
+        Metrics::Add(Metrics::BYTES_OUT, len);
         if(iov_[0].iov_len + iov_[1].iov_len  == 0) { break; } /* 传输结束 */
         else if(static_cast<size_t>(len) > iov_[0].iov_len) {
             iov_[1].iov_base = (uint8_t*) iov_[1].iov_base + (len - iov_[0].iov_len);
@@ -92,31 +129,116 @@ ssize_t HttpConn::write(int* saveErrno) {
             writeBuff_.Retrieve(len);
         }
     } while(isET || ToWriteBytes() > 10240);
+    if(ToWriteBytes() == 0 && reqStart_ != 0) {
+        FinishRequest_();
+    }
     return len;
 }
 
+void HttpConn::FinishRequest_() {
+    int64_t latency = NowUs() - reqStart_;
+    int code = response_.Code();
+    Metrics::Add(Metrics::REQUESTS);
+    if(code >= 200 && code < 600) {
+        Metrics::Add(Metrics::STATUS_2XX + code / 100 - 2);
+    }
+    Metrics::Record(Metrics::HIST_REQUEST, latency);
+
+    AccessLog* log = AccessLog::Instance();
+    if(accessLog && log->IsOpen() && log->Sample()) {
+        AccessLog::Entry entry;
+        entry.ip = GetIP();
+        entry.method = request_.method();
+        entry.path = request_.path();
+        entry.version = request_.version();
+        entry.referer = request_.GetHeader("Referer");
+        entry.userAgent = request_.GetHeader("User-Agent");
+        entry.status = code;
+        entry.bytes = respBytes_;
+        entry.latencyUs = latency;
+        entry.reuse = requests_ - 1;
+        log->Write(entry);
+    }
+    reqStart_ = 0;
+}
+
 // 处理业务逻辑
 bool HttpConn::process() {
-    // 初始化request  
-    request_.Init();
-    if(readBuff_.ReadableBytes() <= 0) 
+    // 初始化request，上一个请求在arena中的内存整体归还
+    // 上次只收到半个请求时不初始化：已解析的部分在arena中，收到剩下的数据后继续解析
+    if(!partial_) {
+        request_.Init();
+        arena_.Reset();
+    }
+    size_t readable = isChain ? readChain_.ReadableBytes() : readBuff_.ReadableBytes();
+    if(readable <= 0) 
     {
+        // 连接空闲（keep-alive等待下一个请求），把缓冲区内存还给内存池
+        readBuff_.Release();
+        readChain_.Release();
+        writeBuff_.Release();
         return false;
     }
-    else if(request_.parse(readBuff_))  // 解析请求报文
+    if(reqStart_ == 0) { reqStart_ = NowUs(); }     // 流水线请求：数据在上次读取时已到达
+    int64_t start = NowUs();
+    bool parsed = isChain ? request_.parse(readChain_) : request_.parse(readBuff_);     // 解析请求报文
+    Metrics::Record(Metrics::HIST_PARSE, NowUs() - start);
+    partial_ = parsed && !request_.IsFinished();
+    if(partial_) { return false; }      // 等待剩下的数据
+    if(parsed && request_.NeedVerify())
+    {
+        // 登录/注册需要查询数据库：挂起连接，由调用者交给数据库线程组，结果返回后调用Resume()
+        pendingUs_ = NowUs();
+        return false;
+    }
+    MakeResponse_(parsed);
+    return true;
+}
+
+// 数据库线程组中执行：查询数据库，再生成响应
+void HttpConn::Resume() {
+    assert(IsPending());
+    request_.Verify();
+    Metrics::Record(Metrics::HIST_VERIFY, NowUs() - pendingUs_);
+    pendingUs_ = 0;
+    MakeResponse_(true);
+}
+
+// 生成响应报文，准备好聚集写的两块内存
+void HttpConn::MakeResponse_(bool parsed) {
+    int64_t start = NowUs();
+    // 注册了处理函数的路由（如/metrics）：响应体由函数生成，不对应文件
+    const Router::Route* route = parsed ? request_.route() : nullptr;
+    bool handled = route && route->action == Router::ACTION_HANDLER;
+    Router::Reply reply;
+    if(handled) { route->handler(request_, &reply); }
+    if(parsed)
     {
         LOG_DEBUG("%s", request_.path().c_str());
-        response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
+        response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), handled ? reply.code : 200);
+        if(!request_.session().empty()) {
+            response_.SetCookie(request_.session(), SessionStore::Instance()->TtlSec());
+        }
     } 
     else 
     {
-        response_.Init(srcDir, request_.path(), false, 400);
+        response_.Init(srcDir, request_.path(), false, request_.ErrorCode());
     }
 
-    response_.MakeResponse(writeBuff_); // 创建响应报文
+    if(handled)
+    {
+        response_.MakeTextResponse(writeBuff_, reply.body, reply.type);
+    }
+    else
+    {
+        response_.MakeResponse(writeBuff_); // 创建响应报文
+    }
+    Metrics::Record(Metrics::HIST_FILE, NowUs() - start);
+    requests_++;
     /* 响应头 */
     iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
     iov_[0].iov_len = writeBuff_.ReadableBytes();
+    iov_[1].iov_len = 0;
     iovCnt_ = 1;
 
     /* 文件 */
@@ -125,6 +247,6 @@ bool HttpConn::process() {
         iov_[1].iov_len = response_.FileLen();
         iovCnt_ = 2;
     }
+    respBytes_ = ToWriteBytes();
     LOG_DEBUG("filesize:%d, %d  to %d", response_.FileLen() , iovCnt_, ToWriteBytes());
-    return true;
 }
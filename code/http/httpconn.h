@@ -16,6 +16,10 @@
 #include "../log/log.h"
 #include "../pool/sqlconnRAII.h"
 #include "../buffer/buffer.h"
+#include "../buffer/chainbuffer.h"
+#include "../buffer/arena.h"
+#include "../log/accesslog.h"
+#include "../metrics/metrics.h"
 #include "httprequest.h"
 #include "httpresponse.h"
 
@@ -33,6 +37,8 @@ public:
     ssize_t write(int* saveErrno);
     // 关闭
     void Close();
+    // 连接状态（Metrics::LEVEL），用于统计各状态的连接数
+    void SetState(int state);
     // 获取与客户端进行通信的套接字
     int GetFd() const;
     // 获取通信端口
@@ -42,7 +48,17 @@ public:
     // 获取客户端地址信息
     sockaddr_in GetAddr() const;
     
+    // 解析请求并生成响应，返回false时没有要发送的数据（请求不完整，或IsPending()）
     bool process();
+    // 请求需要查询数据库，连接已挂起，等待Resume()
+    bool IsPending() const { return pendingUs_ != 0; }
+    // 交给工作线程/数据库线程期间计数（主线程加，处理完注册好下一个事件后减）
+    // 计数不为0时连接正在被其他线程使用，超时回调只能顺延，不能关闭fd
+    void Hold() { busy_++; }
+    void Release() { busy_--; }
+    bool IsBusy() const { return busy_ > 0; }
+    // 查询数据库并生成响应（阻塞，只在数据库线程组中调用）
+    void Resume();
 
     int ToWriteBytes() { 
         return iov_[0].iov_len + iov_[1].iov_len; 
@@ -53,6 +69,8 @@ public:
     }
 
     static bool isET;
+    static bool isChain;                    // 读缓冲区使用链式缓冲区
+    static bool accessLog;                  // 记录访问日志
     static const char* srcDir;              // 资源目录
     static std::atomic<int> userCount;      // 总共客户端的连接数
     
@@ -67,8 +85,21 @@ private:
     struct iovec iov_[2];                   // 缓冲区，用于分散读和聚集写
     
     Buffer readBuff_;                       // 读缓冲区，保存请求数据的内容
+    ChainBuffer readChain_;                 // 链式读缓冲区（isChain时代替readBuff_）
     Buffer writeBuff_;                      // 写缓冲区，保存响应数据的内容
 
+    void MakeResponse_(bool parsed);        // 生成响应报文
+    void FinishRequest_();                  // 响应发送完毕：统计并写访问日志
+
+    int64_t reqStart_;                      // 当前请求开始时间（微秒），0表示没有进行中的请求
+    size_t respBytes_;                      // 当前响应的字节数
+    int requests_;                          // 本连接已处理的请求数
+    int state_;                             // Metrics::LEVEL，关闭后为-1
+    bool partial_;                          // 当前请求只收到一部分
+    int64_t pendingUs_;                     // 挂起等待数据库的开始时间（微秒），0表示没有挂起
+    std::atomic<int> busy_;                 // 见Hold()；不在init中清零，关闭前的Release仍要配对
+
+    Arena arena_;                           // 请求内存，每个请求结束后整体释放
     HttpRequest request_;                   // 接收报文
     HttpResponse response_;                 // 响应报文
 };
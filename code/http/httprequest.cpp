@@ -3,23 +3,34 @@
  * @Date         : 2020-06-26
  * @copyleft Apache 2.0
  */ 
+#define LOG_MODULE Log::MODULE_HTTP
 #include "httprequest.h"
 using namespace std;
 
-const unordered_set<string> HttpRequest::DEFAULT_HTML{
-            "/index", "/register", "/login",
-             "/welcome", "/video", "/picture", };
-
-const unordered_map<string, int> HttpRequest::DEFAULT_HTML_TAG {
-            {"/register.html", 0}, {"/login.html", 1},  };
-
+HttpRequest::HttpRequest(pmr::memory_resource* arena)
+    : arena_(arena), method_(arena), path_(arena), version_(arena), body_(arena),
+      user_(arena), session_(arena), header_(arena), post_(arena) {
+    Init();
+}
 
 // 初始化
 void HttpRequest::Init() {
-    method_ = path_ = version_ = body_ = "";
+    // 用新的空对象替换旧对象，之后arena才能安全地整体释放
+    // 字符串用swap：从短字符串移动赋值时会保留原来的堆内存（仍指向arena），下一个请求再写入就会越界
+    pmr::string(arena_).swap(method_);
+    pmr::string(arena_).swap(path_);
+    pmr::string(arena_).swap(version_);
+    pmr::string(arena_).swap(body_);
+    pmr::string(arena_).swap(user_);
+    pmr::string(arena_).swap(session_);
     state_ = REQUEST_LINE;
-    header_.clear();
-    post_.clear();
+    contentLen_ = 0;
+    headerBytes_ = 0;
+    errCode_ = 400;
+    verifyTag_ = -1;
+    route_ = nullptr;
+    header_ = StrMap(arena_);
+    post_ = StrMap(arena_);
 }
 
 // 保活机制
@@ -30,6 +41,12 @@ bool HttpRequest::IsKeepAlive() const {
     return false;
 }
 
+std::string_view HttpRequest::GetHeader(const char* key) const {
+    auto it = header_.find(key);
+    if(it == header_.end()) { return {}; }
+    return it->second;
+}
+
 // 解析接收报文
 bool HttpRequest::parse(Buffer& buff) {
     const char CRLF[] = "\r\n";    // HTTP中数据的界限符
@@ -40,64 +57,174 @@ bool HttpRequest::parse(Buffer& buff) {
     }
 
     while(buff.ReadableBytes() && state_ != FINISH) {
-        // 获取一行数据，根据'\r\n'
+        // 请求体按Content-Length取，没收全时等下一次读
+        if(state_ == BODY) {
+            if(buff.ReadableBytes() < contentLen_) { break; }
+            ParseBody_(string_view(buff.Peek(), contentLen_));
+            buff.Retrieve(contentLen_);
+            break;
+        }
+        // 获取一行数据，根据'\r\n'；没有完整的一行时（流水线请求被读到一半）留在缓冲区
         const char* lineEnd = search(buff.Peek(), buff.BeginWriteConst(), CRLF, CRLF + 2);
-        std::string line(buff.Peek(), lineEnd);
-
-        switch(state_)
-        {
-        case REQUEST_LINE:      // 解析请求行
-            if(!ParseRequestLine_(line)) {
-                return false;
-            }
-            ParsePath_();
-            break;    
-        case HEADERS:           // 解析请求头
-            ParseHeader_(line);
-            if(buff.ReadableBytes() <= 2) {
-                state_ = FINISH;
-            }
+        if(lineEnd == buff.BeginWriteConst()) {
+            if(!HeaderLimit_(buff.ReadableBytes())) { return false; }
             break;
-        case BODY:
-            ParseBody_(line);
+        }
+        size_t lineLen = lineEnd - buff.Peek();
+        if(!HeaderLimit_(lineLen + 2) || !ParseLine_(string_view(buff.Peek(), lineLen))) {
+            return false;
+        }
+        headerBytes_ += lineLen + 2;
+        buff.RetrieveUntil(lineEnd + 2);    // 右移两个位置跳过'\r\n'
+    }
+    LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(), version_.c_str());
+    return true;
+}
+
+// 解析链式缓冲区中的报文：行在块内时直接引用块内数据
+bool HttpRequest::parse(ChainBuffer& buff) {
+    if(buff.ReadableBytes() <= 0) {
+        return false;
+    }
+
+    string scratch;     // 只有跨块的行才会用到
+    while(buff.ReadableBytes() && state_ != FINISH) {
+        if(state_ == BODY) {
+            if(buff.ReadableBytes() < contentLen_) { break; }
+            ParseBody_(buff.View(contentLen_, &scratch));
+            buff.Retrieve(contentLen_);
             break;
-        default:
+        }
+        size_t lineLen = buff.FindCRLF();
+        if(lineLen == ChainBuffer::npos) {
+            if(!HeaderLimit_(buff.ReadableBytes())) { return false; }
             break;
         }
-
-        if(lineEnd == buff.BeginWrite()) { break; }     // 读到最后退出while循环        
-        buff.RetrieveUntil(lineEnd + 2);    // 右移两个位置跳过'\r\n'
+        if(!HeaderLimit_(lineLen + 2) || !ParseLine_(buff.View(lineLen, &scratch))) {
+            return false;
+        }
+        headerBytes_ += lineLen + 2;
+        buff.Retrieve(lineLen + 2);
     }
     LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(), version_.c_str());
     return true;
 }
 
-// 拼接请求路径
-void HttpRequest::ParsePath_() {
-    if(path_ == "/") 
-    {
-        path_ = "/index.html"; 
+// 请求行和首部的长度限制：没收到完整的一行时按已收到的字节检查，不让缓冲区无限增长
+bool HttpRequest::HeaderLimit_(size_t lineLen) {
+    if(lineLen > MAX_LINE || headerBytes_ + lineLen > MAX_HEADER) {
+        LOG_WARN("Request header too large");
+        errCode_ = 400;
+        return false;
     }
-    else 
+    return true;
+}
+
+// 按当前状态处理一行（不含\r\n），请求体不在这里处理
+bool HttpRequest::ParseLine_(string_view line) {
+    switch(state_)
     {
-        for(auto &item: DEFAULT_HTML) {
-            if(item == path_) {
-                path_ += ".html";
-                break;
-            }
+    case REQUEST_LINE:      // 解析请求行
+        if(!ParseRequestLine_(line)) {
+            return false;
+        }
+        ParsePath_();
+        break;    
+    case HEADERS:           // 解析请求头
+        return ParseHeader_(line);
+    default:
+        break;
+    }
+    return true;
+}
+
+// 按路由表确定请求的处理方式，文件路由按target改写路径
+void HttpRequest::ParsePath_() {
+    Router* router = Router::Instance();
+    route_ = router->Match(method_, path_);
+    if(!route_ || route_->action != Router::ACTION_FILE || route_->target.empty()) { return; }
+    if(route_->prefixLen == 0) {
+        // 页面别名（如/login -> /login.html）：改写后再匹配一次，确定最终的路由（表单、需要登录等）
+        path_.assign(route_->target);
+        route_ = router->Match(method_, path_);
+    }
+    else {
+        path_.replace(0, route_->prefixLen, route_->target);
+    }
+}
+
+static int HexValue(char ch) {
+    if(ch >= '0' && ch <= '9') return ch - '0';
+    if(ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    if(ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    return -1;
+}
+
+// 规范化路径：百分号解码，合并重复的/，处理.和..（不能超出根目录）
+// 路由（包括需要登录的页面）和文件查找都用规范化后的路径，//welcome.html、/./welcome.html不会绕过登录
+// 查询串（?之后）原样保留；路径不以/开头或解码出\0时返回false
+bool HttpRequest::NormalizePath_() {
+    size_t query = path_.find('?');
+    size_t len = query == pmr::string::npos ? path_.size() : query;
+    if(len == 0 || path_[0] != '/') { return false; }
+
+    // 01：百分号解码，不合法的%XX原样保留
+    pmr::string decoded(arena_);
+    decoded.reserve(len);
+    for(size_t i = 0; i < len; i++) {
+        char ch = path_[i];
+        int hi, lo;
+        if(ch == '%' && i + 2 < len &&
+           (hi = HexValue(path_[i + 1])) >= 0 && (lo = HexValue(path_[i + 2])) >= 0) {
+            ch = (char)(hi * 16 + lo);
+            if(ch == '\0') { return false; }
+            i += 2;
+        }
+        decoded.push_back(ch);
+    }
+
+    // 02：按/切分，跳过空段和.，..删除上一段
+    pmr::string out(arena_);
+    out.reserve(path_.size());
+    size_t pos = 0;
+    bool dir = false;       // 以/结尾（包括以.或..结尾），保留结尾的/
+    while(pos <= decoded.size()) {
+        size_t end = decoded.find('/', pos);
+        if(end == pmr::string::npos) { end = decoded.size(); }
+        string_view seg(decoded.data() + pos, end - pos);
+        dir = seg.empty() || seg == "." || seg == "..";
+        if(seg == "..") {
+            size_t slash = out.rfind('/');
+            out.resize(slash == pmr::string::npos ? 0 : slash);
         }
+        else if(!dir) {
+            out.push_back('/');
+            out.append(seg.data(), seg.size());
+        }
+        pos = end + 1;
     }
+    if(out.empty() || dir) { out.push_back('/'); }
+    if(query != pmr::string::npos) { out.append(path_, query, pmr::string::npos); }
+    path_.swap(out);
+    return true;
 }
 
+// 匹配结果数组也从arena分配
+typedef match_results<const char*, pmr::polymorphic_allocator<csub_match>> PmrCMatch;
+
 // 解析请求首行
-bool HttpRequest::ParseRequestLine_(const string& line) {
+bool HttpRequest::ParseRequestLine_(string_view line) {
     // GET / HTTP/1.1
-    regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");     // 正则
-    smatch subMatch;    // 匹配结果数组
-    if(regex_match(line, subMatch, patten)) {   
-        method_ = subMatch[1];
-        path_ = subMatch[2];
-        version_ = subMatch[3];
+    static const regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");     // 正则只编译一次
+    PmrCMatch subMatch(arena_);    // 匹配结果数组
+    if(regex_match(line.data(), line.data() + line.size(), subMatch, patten)) {   
+        method_.assign(subMatch[1].first, subMatch[1].second);
+        path_.assign(subMatch[2].first, subMatch[2].second);
+        version_.assign(subMatch[3].first, subMatch[3].second);
+        if(!NormalizePath_()) {
+            LOG_ERROR("Bad path");
+            return false;
+        }
         state_ = HEADERS;       // 状态的改变
         return true;
     }
@@ -106,29 +233,75 @@ bool HttpRequest::ParseRequestLine_(const string& line) {
 }
 
 // 解析请求头
-void HttpRequest::ParseHeader_(const string& line) {
+bool HttpRequest::ParseHeader_(string_view line) {
     /*
     Accept-Encoding: gzip, deflate, br
     Connection: keep-alive
     */
-    regex patten("^([^:]*): ?(.*)$");   
-    smatch subMatch;
-    if(regex_match(line, subMatch, patten)) 
+    static const regex patten("^([^:]*): ?(.*)$");   
+    PmrCMatch subMatch(arena_);
+    if(regex_match(line.data(), line.data() + line.size(), subMatch, patten)) 
+    {
+        pmr::string key(subMatch[1].first, subMatch[1].second, arena_);
+        bool cookie = (key == "Cookie");
+        pmr::string& value = header_[std::move(key)];
+        value.assign(subMatch[2].first, subMatch[2].second);
+        if(cookie) {
+            // 带会话Cookie：查会话表得到用户名，不访问数据库
+            string user;
+            if(SessionStore::Instance()->Find(SessionStore::ParseCookie(value), &user)) {
+                user_.assign(user);
+            }
+        }
+    }
+    else if(line.empty())
     {
-        header_[subMatch[1]] = subMatch[2];
+        // 首部结束：Cookie已经处理过，检查需要登录的页面
+        if(user_.empty() && route_ && route_->auth) {
+            path_ = "/login.html";
+            route_ = Router::Instance()->Match(method_, path_);
+        }
+        // 没有请求体时请求完整，缓冲区中剩下的是流水线上的下一个请求
+        if(!ParseContentLength_()) { return false; }
+        state_ = contentLen_ > 0 ? BODY : FINISH;
     }
     else 
     {
         state_ = BODY;
     }
+    return true;
+}
+
+// Content-Length只接受十进制数字；超过MAX_BODY时在缓冲请求体之前返回413
+bool HttpRequest::ParseContentLength_() {
+    contentLen_ = 0;
+    string_view value = GetHeader("Content-Length");
+    while(!value.empty() && (value.back() == ' ' || value.back() == '\t')) { value.remove_suffix(1); }
+    if(value.empty()) { return true; }
+    string digits(value);
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long len = strtoull(digits.c_str(), &end, 10);
+    if(digits[0] < '0' || digits[0] > '9' || *end != '\0' || errno == ERANGE) {
+        LOG_WARN("Bad Content-Length: %s", digits.c_str());
+        errCode_ = 400;
+        return false;
+    }
+    if(len > MAX_BODY) {
+        LOG_WARN("Request body too large: %llu", len);
+        errCode_ = 413;
+        return false;
+    }
+    contentLen_ = len;
+    return true;
 }
 
 // 解析请求体
-void HttpRequest::ParseBody_(const string& line) {
-    body_ = line;
+void HttpRequest::ParseBody_(string_view line) {
+    body_.assign(line.data(), line.size());
     ParsePost_();       // 对于POST格式的报文特殊处理
     state_ = FINISH;
-    LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
+    LOG_DEBUG("Body:%.*s, len:%d", (int)line.size(), line.data(), line.size());
 }
 
 int HttpRequest::ConverHex(char ch) {
@@ -142,28 +315,62 @@ void HttpRequest::ParsePost_() {
     if(method_ == "POST" && header_["Content-Type"] == "application/x-www-form-urlencoded") {
         // 02：解析POST报文的请求体（username：password）
         ParseFromUrlencoded_();   
-        if(DEFAULT_HTML_TAG.count(path_)) {
+        if(route_ && (route_->action == Router::ACTION_LOGIN || route_->action == Router::ACTION_REGISTER)) {
             // 03：POST报文的具体类型（登录/注册）
-            int tag = DEFAULT_HTML_TAG.find(path_)->second;
+            int tag = route_->action == Router::ACTION_LOGIN ? 1 : 0;
             LOG_DEBUG("Tag:%d", tag);
-            if(tag == 0 || tag == 1) {
-                bool isLogin = (tag == 1);
-                if(UserVerify(post_["username"], post_["password"], isLogin)) {
-                    path_ = "/welcome.html";
-                } 
-                else {
+            if(tag == 1 && !user_.empty() && user_ == post_["username"]) {
+                // 04：已用同一用户登录（会话有效），不需要再验证
+                path_ = "/welcome.html";
+            }
+            else if(tag == 0 || tag == 1) {
+                // 05：先查缓存，确定不了时才需要查询数据库
+                // 不在解析线程里查，由调用者交给数据库线程组执行Verify()
+                int cached = CredCache::Instance()->Check(post_["username"], post_["password"], tag == 1);
+                if(cached > 0) {
+                    Login_();
+                }
+                else if(cached == 0) {
                     path_ = "/error.html";
                 }
+                else {
+                    verifyTag_ = tag;
+                }
             }
         }
     }   
 }
 
+// 登录/注册：查询数据库并把路径改为结果页面，在数据库线程组中调用
+void HttpRequest::Verify() {
+    assert(NeedVerify());
+    bool isLogin = (verifyTag_ == 1);
+    verifyTag_ = -1;
+    if(UserVerify(post_["username"], post_["password"], isLogin)) {
+        Login_();
+    } 
+    else {
+        path_ = "/error.html";
+    }
+}
+
+// 登录/注册成功：发放新的会话
+void HttpRequest::Login_() {
+    path_ = "/welcome.html";
+    SessionStore* store = SessionStore::Instance();
+    char id[SessionStore::ID_LEN];
+    const pmr::string& name = post_["username"];
+    if(store->IsOpen() && store->Create(name, id)) {
+        session_.assign(id, sizeof(id));
+        user_.assign(name);
+    }
+}
+
 // 解析POST报文的请求体
 void HttpRequest::ParseFromUrlencoded_() {
     if(body_.size() == 0) { return; }
 
-    string key, value;
+    pmr::string key(arena_), value(arena_);
     int num = 0;
     int n = body_.size();
     int i = 0, j = 0;
@@ -172,7 +379,7 @@ void HttpRequest::ParseFromUrlencoded_() {
         char ch = body_[i];
         switch (ch) {
         case '=':
-            key = body_.substr(j, i - j);
+            key.assign(body_, j, i - j);
             j = i + 1;
             break;
         case '+':
@@ -185,7 +392,7 @@ void HttpRequest::ParseFromUrlencoded_() {
             i += 2;
             break;
         case '&':
-            value = body_.substr(j, i - j);
+            value.assign(body_, j, i - j);
             j = i + 1;
             post_[key] = value;
             LOG_DEBUG("%s = %s", key.c_str(), value.c_str());
@@ -196,107 +403,76 @@ void HttpRequest::ParseFromUrlencoded_() {
     }
     assert(j <= i);
     if(post_.count(key) == 0 && j < i) {
-        value = body_.substr(j, i - j);
+        value.assign(body_, j, i - j);
         post_[key] = value;
     }
 }
 
 
-bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin) {
-    if(name == "" || pwd == "") { return false; }
-    LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
-    // 01：获取连接数据库的描述符
-    MYSQL* sql;
-    SqlConnRAII(&sql,  SqlConnPool::Instance());
-    assert(sql);
-    
-    bool flag = false;
-    unsigned int j = 0;
-    char order[256] = { 0 };
-    MYSQL_FIELD *fields = nullptr;
-    MYSQL_RES *res = nullptr;
-    
-    // 02：判断登录/注册
-    if(!isLogin) { flag = true; }
-
-    // 03：sql语句
-    /* 查询用户及密码 */
-    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%s' LIMIT 1", name.c_str());
-    LOG_DEBUG("%s", order);
-
-    // 04：查询
-    if(mysql_query(sql, order)) { 
-        mysql_free_result(res);
-        return false; 
+bool HttpRequest::UserVerify(string_view name, string_view pwd, bool isLogin) {
+    if(name.empty() || pwd.empty()) { return false; }
+    LOG_INFO("Verify name:%.*s", (int)name.size(), name.data());
+    // 01：查询用户的密码（MySQL或本地用户表，见AuthBackend）
+    AuthBackend* backend = AuthBackend::Instance();
+    string password;
+    int found = backend->Lookup(name, &password, !isLogin);
+    if(found < 0) { return false; }
+    CredCache* cache = CredCache::Instance();
+    string_view stored(password);
+    cache->Put(name, found == 1 ? &stored : nullptr);
+
+    if(isLogin) {
+        /* 02：登录：用户存在且密码一致 */
+        bool match = found == 1 && pwd == stored;
+        if(!match) { LOG_DEBUG("pwd error!"); }
+        return match;
     }
-    res = mysql_store_result(sql);
-    j = mysql_num_fields(res);
-    fields = mysql_fetch_fields(res);
-
-    
-    while(MYSQL_ROW row = mysql_fetch_row(res)) {
-        LOG_DEBUG("MYSQL ROW: %s %s", row[0], row[1]);
-        string password(row[1]);
-        /* 注册行为 且用户名未被使用*/
-        if(isLogin) 
-        {
-            if(pwd == password) { flag = true; }
-            else {
-                flag = false;
-                LOG_DEBUG("pwd error!");
-            }
-        } 
-        else 
-        { 
-            flag = false; 
-            LOG_DEBUG("user used!");
-        }
+    /* 03：注册：用户名未被使用时插入 */
+    if(found == 1) {
+        LOG_DEBUG("user used!");
+        return false;
     }
-
-    
-    mysql_free_result(res);
-    /* 注册行为    且用户名未被使用*/
-    if(!isLogin && flag == true) {
-        LOG_DEBUG("regirster!");
-        bzero(order, 256);
-        snprintf(order, 256,"INSERT INTO user(username, password) VALUES('%s','%s')", name.c_str(), pwd.c_str());
-        LOG_DEBUG( "%s", order);
-        if(mysql_query(sql, order)) { 
-            LOG_DEBUG( "Insert error!");
-            flag = false; 
-        }
-        flag = true;
+    LOG_DEBUG("regirster!");
+    cache->Invalidate(name);
+    if(backend->Insert(name, pwd) != 1) {
+        LOG_DEBUG("Insert error!");
+        return false;
     }
-    SqlConnPool::Instance()->FreeConn(sql);
-    LOG_DEBUG( "UserVerify success!!");
-    return flag;
+    cache->Put(name, &pwd);
+    LOG_DEBUG("UserVerify success!!");
+    return true;
 }
 
 
-std::string HttpRequest::path() const{
+const std::pmr::string& HttpRequest::path() const{
     return path_;
 }
-std::string& HttpRequest::path(){
+std::pmr::string& HttpRequest::path(){
     return path_;
 }
-std::string HttpRequest::method() const {
+const std::pmr::string& HttpRequest::method() const {
     return method_;
 }
-std::string HttpRequest::version() const {
+const std::pmr::string& HttpRequest::version() const {
     return version_;
 }
 
+const std::pmr::string& HttpRequest::user() const {
+    return user_;
+}
+const std::pmr::string& HttpRequest::session() const {
+    return session_;
+}
+
 std::string HttpRequest::GetPost(const std::string& key) const {
     assert(key != "");
-    if(post_.count(key) == 1) {
-        return post_.find(key)->second;
-    }
-    return "";
+    return GetPost(key.c_str());
 }
 std::string HttpRequest::GetPost(const char* key) const {
     assert(key != nullptr);
-    if(post_.count(key) == 1) {
-        return post_.find(key)->second;
+    auto it = post_.find(pmr::string(key, arena_));
+    if(it != post_.end()) {
+        return std::string(it->second);
     }
     return "";
 }
\ No newline at end of file
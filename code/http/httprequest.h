@@ -9,14 +9,21 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <string>
+#include <string_view>
+#include <memory_resource>
 #include <regex>
 #include <errno.h>     
 #include <mysql/mysql.h>  //mysql
 
 #include "../buffer/buffer.h"
+#include "../buffer/chainbuffer.h"
 #include "../log/log.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/sqlconnRAII.h"
+#include "../pool/authbackend.h"
+#include "../pool/credcache.h"
+#include "../pool/sessionstore.h"
+#include "router.h"
 
 class HttpRequest {
 public:
@@ -38,22 +45,40 @@ public:
         CLOSED_CONNECTION,
     };
     
-    HttpRequest() { Init(); }
+    // 请求中的字符串都从arena分配，默认使用全局new/delete
+    explicit HttpRequest(std::pmr::memory_resource* arena = std::pmr::get_default_resource());
     ~HttpRequest() = default;
-    // 初始化
+    // 初始化（丢弃上一个请求在arena中的所有对象）
     void Init();
     // 
     bool parse(Buffer& buff);
+    bool parse(ChainBuffer& buff);      // 链式缓冲区，行不跨块时不拷贝
+    // 解析到一半（首部或请求体没收全）时parse返回true，已解析的部分保留，数据到齐后继续parse
+    bool IsFinished() const { return state_ == FINISH; }
+    // parse返回false时的响应码：400格式错误或首部过长，413请求体过大
+    int ErrorCode() const { return errCode_; }
 
-    std::string path() const;
-    std::string& path();
-    std::string method() const;
-    std::string version() const;
+    static constexpr size_t MAX_LINE = 8192;        // 请求行/单个首部行的最大长度
+    static constexpr size_t MAX_HEADER = 65536;     // 请求行加全部首部的最大长度
+    static constexpr size_t MAX_BODY = 1 << 20;     // 请求体的最大长度（Content-Length）
+
+    const std::pmr::string& path() const;
+    std::pmr::string& path();
+    const std::pmr::string& method() const;
+    const std::pmr::string& version() const;
+    const std::pmr::string& user() const;          // 会话对应的用户名，未登录时为空
+    const std::pmr::string& session() const;       // 本次新发放的会话id，需要写入Set-Cookie
     std::string GetPost(const std::string& key) const;
     std::string GetPost(const char* key) const;
+    std::string_view GetHeader(const char* key) const;     // 不存在时返回空
+    const Router::Route* route() const { return route_; }  // 匹配的路由，没有时为nullptr（按路径查找文件）
 
     bool IsKeepAlive() const;
 
+    // 登录/注册请求在解析时只记下类型，数据库查询由Verify()完成（可能阻塞，不要在工作线程调用）
+    bool NeedVerify() const { return verifyTag_ >= 0; }
+    void Verify();
+
     /* 
     todo 
     void HttpConn::ParseFormData() {}
@@ -61,23 +86,35 @@ public:
     */
 
 private:
-    bool ParseRequestLine_(const std::string& line);
-    void ParseHeader_(const std::string& line);
-    void ParseBody_(const std::string& line);
+    bool HeaderLimit_(size_t lineLen);
+    bool ParseLine_(std::string_view line);
+    bool ParseRequestLine_(std::string_view line);
+    bool ParseHeader_(std::string_view line);
+    bool ParseContentLength_();
+    void ParseBody_(std::string_view line);
 
+    bool NormalizePath_();
     void ParsePath_();
     void ParsePost_();
     void ParseFromUrlencoded_();
+    void Login_();
+
+    static bool UserVerify(std::string_view name, std::string_view pwd, bool isLogin);
 
-    static bool UserVerify(const std::string& name, const std::string& pwd, bool isLogin);
+    typedef std::pmr::unordered_map<std::pmr::string, std::pmr::string> StrMap;
 
+    std::pmr::memory_resource* arena_;              // 请求内存（单调分配，请求结束整体释放）
     PARSE_STATE state_;                             // 请求报文的状态
-    std::string method_, path_, version_, body_;    // 请求方法 ，请求路径， 协议版本 ，请求体
-    std::unordered_map<std::string, std::string> header_;   // 请求头
-    std::unordered_map<std::string, std::string> post_;     // POST表单数据
+    size_t contentLen_;                             // 请求体长度（Content-Length）
+    size_t headerBytes_;                            // 已解析的请求行和首部的字节数
+    int errCode_;                                   // 解析失败时的响应码
+    int verifyTag_;                                 // 待查询数据库：0注册，1登录，-1不需要
+    const Router::Route* route_;                    // 路由表中匹配的路由
+    std::pmr::string method_, path_, version_, body_;   // 请求方法 ，请求路径， 协议版本 ，请求体
+    std::pmr::string user_, session_;               // 已登录的用户，新发放的会话id
+    StrMap header_;                                 // 请求头
+    StrMap post_;                                   // POST表单数据
 
-    static const std::unordered_set<std::string> DEFAULT_HTML;  // 默认的网页
-    static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG;
     static int ConverHex(char ch);  // 转换成16进制
 };
 
@@ -3,6 +3,7 @@
  * @Date         : 2020-06-27
  * @copyleft Apache 2.0
  */ 
+#define LOG_MODULE Log::MODULE_HTTP
 #include "httpresponse.h"
 
 using namespace std;
@@ -34,18 +35,20 @@ const unordered_map<int, string> HttpResponse::CODE_STATUS = {
     { 400, "Bad Request" },
     { 403, "Forbidden" },
     { 404, "Not Found" },
+    { 413, "Payload Too Large" },
 };
 
 const unordered_map<int, string> HttpResponse::CODE_PATH = {
     { 400, "/400.html" },
     { 403, "/403.html" },
     { 404, "/404.html" },
+    { 413, "/413.html" },
 };
 
-HttpResponse::HttpResponse() {
+HttpResponse::HttpResponse(pmr::memory_resource* arena) : arena_(arena) {
     code_ = -1;
-    path_ = srcDir_ = "";
     isKeepAlive_ = false;
+    cookieAge_ = 0;
     mmFile_ = nullptr; 
     mmFileStat_ = { 0 };
 };
@@ -54,21 +57,27 @@ HttpResponse::~HttpResponse() {
     UnmapFile();
 }
 
-void HttpResponse::Init(const string& srcDir, string& path, bool isKeepAlive, int code){
-    assert(srcDir != "");
+void HttpResponse::Init(string_view srcDir, string_view path, bool isKeepAlive, int code){
+    assert(!srcDir.empty());
     if(mmFile_) { UnmapFile(); }
 
     code_ = code;
     isKeepAlive_ = isKeepAlive;
     path_ = path;
     srcDir_ = srcDir;
+    cookie_ = {};
+    cookieAge_ = 0;
     mmFile_ = nullptr; 
     mmFileStat_ = { 0 };
 }
 
 void HttpResponse::MakeResponse(Buffer& buff) {
-    /* 判断请求的资源文件 */
-    if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
+    /* 资源文件的完整路径只拼接一次 */
+    pmr::string file(srcDir_, arena_);
+    file.append(path_);
+    /* 判断请求的资源文件；已经是错误码（请求解析失败）时直接返回错误页 */
+    if(code_ >= 400) {}
+    else if(stat(file.c_str(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
         code_ = 404;
     }
     else if(!(mmFileStat_.st_mode & S_IROTH)) {
@@ -77,10 +86,25 @@ void HttpResponse::MakeResponse(Buffer& buff) {
     else if(code_ == -1) { 
         code_ = 200; 
     }
-    ErrorHtml_();
+    ErrorHtml_(file);
     AddStateLine_(buff);    
-    AddHeader_(buff);
-    AddContent_(buff);
+    AddHeader_(buff, GetFileType_());
+    AddContent_(buff, file);
+}
+
+void HttpResponse::MakeTextResponse(Buffer& buff, string_view body, string_view type) {
+    if(code_ == -1) { code_ = 200; }
+    AddStateLine_(buff);
+    AddHeader_(buff, type);
+    char len[64];
+    int n = snprintf(len, sizeof(len), "Content-length: %zu\r\n\r\n", body.size());
+    buff.Append(len, n);
+    buff.Append(body.data(), body.size());
+}
+
+void HttpResponse::SetCookie(string_view id, int maxAge) {
+    cookie_ = id;
+    cookieAge_ = maxAge;
 }
 
 char* HttpResponse::File() {
@@ -91,29 +115,33 @@ size_t HttpResponse::FileLen() const {
     return mmFileStat_.st_size;
 }
 
-void HttpResponse::ErrorHtml_() {
-    if(CODE_PATH.count(code_) == 1) {
-        path_ = CODE_PATH.find(code_)->second;
-        stat((srcDir_ + path_).data(), &mmFileStat_);
+void HttpResponse::ErrorHtml_(pmr::string& file) {
+    auto it = CODE_PATH.find(code_);
+    if(it != CODE_PATH.end()) {
+        path_ = it->second;
+        file.assign(srcDir_);
+        file.append(path_);
+        stat(file.c_str(), &mmFileStat_);
     }
 }
 
 // 添加响应行
 void HttpResponse::AddStateLine_(Buffer& buff) {
-    string status;
-    if(CODE_STATUS.count(code_) == 1) {
-        status = CODE_STATUS.find(code_)->second;
-    }
-    else {
+    auto it = CODE_STATUS.find(code_);
+    if(it == CODE_STATUS.end()) {
         code_ = 400;
-        status = CODE_STATUS.find(400)->second;
+        it = CODE_STATUS.find(400);
     }
     // HTTP/1.1 200 OK
-    buff.Append("HTTP/1.1 " + to_string(code_) + " " + status + "\r\n");
+    char line[64];
+    int n = snprintf(line, sizeof(line), "HTTP/1.1 %d ", code_);
+    buff.Append(line, n);
+    buff.Append(it->second);
+    buff.Append("\r\n", 2);
 }
 
 // 添加响应头部
-void HttpResponse::AddHeader_(Buffer& buff) {
+void HttpResponse::AddHeader_(Buffer& buff, string_view type) {
     buff.Append("Connection: ");
     if(isKeepAlive_) {
         buff.Append("keep-alive\r\n");
@@ -121,12 +149,21 @@ void HttpResponse::AddHeader_(Buffer& buff) {
     } else{
         buff.Append("close\r\n");
     }
-    buff.Append("Content-type: " + GetFileType_() + "\r\n");
+    if(!cookie_.empty()) {
+        char cookie[192];
+        int n = snprintf(cookie, sizeof(cookie),
+                         "Set-Cookie: %s=%.*s; Max-Age=%d; Path=/; HttpOnly; SameSite=Lax\r\n",
+                         SessionStore::COOKIE, (int)cookie_.size(), cookie_.data(), cookieAge_);
+        buff.Append(cookie, n);
+    }
+    buff.Append("Content-type: ");
+    buff.Append(type.data(), type.size());
+    buff.Append("\r\n", 2);
 }
 
 // 添加响应体
-void HttpResponse::AddContent_(Buffer& buff) {
-    int srcFd = open((srcDir_ + path_).data(), O_RDONLY);
+void HttpResponse::AddContent_(Buffer& buff, const pmr::string& file) {
+    int srcFd = open(file.c_str(), O_RDONLY);
     
     if(srcFd < 0) { 
         ErrorContent(buff, "File NotFound!");
@@ -135,7 +172,7 @@ void HttpResponse::AddContent_(Buffer& buff) {
 
     /* 将文件映射到内存提高文件的访问速度 
         MAP_PRIVATE 建立一个写入时拷贝的私有映射*/
-    LOG_DEBUG("file path %s", (srcDir_ + path_).data());
+    LOG_DEBUG("file path %s", file.c_str());
     int* mmRet = (int*)mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
     if(*mmRet == -1) {
         ErrorContent(buff, "File NotFound!");
@@ -143,7 +180,9 @@ void HttpResponse::AddContent_(Buffer& buff) {
     }
     mmFile_ = (char*)mmRet;
     close(srcFd);
-    buff.Append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n\r\n");
+    char len[64];
+    int n = snprintf(len, sizeof(len), "Content-length: %lld\r\n\r\n", (long long)mmFileStat_.st_size);
+    buff.Append(len, n);
 }
 
 void HttpResponse::UnmapFile() {
@@ -154,34 +193,43 @@ void HttpResponse::UnmapFile() {
 }
 
 // 获取文件对应的Type
-string HttpResponse::GetFileType_() {
+const string& HttpResponse::GetFileType_() {
+    static const string DEFAULT_TYPE = "text/plain";
     /* 判断文件类型 */
-    string::size_type idx = path_.find_last_of('.');
-    if(idx == string::npos) {
-        return "text/plain";
+    string_view::size_type idx = path_.find_last_of('.');
+    if(idx == string_view::npos) {
+        return DEFAULT_TYPE;
+    }
+    string_view suffix = path_.substr(idx);
+    if(suffix.size() > 8) {     // 没有这么长的后缀，不必查表
+        return DEFAULT_TYPE;
     }
-    string suffix = path_.substr(idx);
-    if(SUFFIX_TYPE.count(suffix) == 1) {
-        return SUFFIX_TYPE.find(suffix)->second;
+    auto it = SUFFIX_TYPE.find(string(suffix));     // 短后缀不会分配内存
+    if(it != SUFFIX_TYPE.end()) {
+        return it->second;
     }
-    return "text/plain";
+    return DEFAULT_TYPE;
 }
 
-void HttpResponse::ErrorContent(Buffer& buff, string message) 
+void HttpResponse::ErrorContent(Buffer& buff, string_view message) 
 {
-    string body;
-    string status;
+    pmr::string body(arena_);
+    string_view status = "Bad Request";
+    auto it = CODE_STATUS.find(code_);
+    if(it != CODE_STATUS.end()) {
+        status = it->second;
+    }
+    char code[16];
+    int n = snprintf(code, sizeof(code), "%d", code_);
+
     body += "<html><title>Error</title>";
     body += "<body bgcolor=\"ffffff\">";
-    if(CODE_STATUS.count(code_) == 1) {
-        status = CODE_STATUS.find(code_)->second;
-    } else {
-        status = "Bad Request";
-    }
-    body += to_string(code_) + " : " + status  + "\n";
-    body += "<p>" + message + "</p>";
+    body.append(code, n).append(" : ").append(status).append("\n");
+    body.append("<p>").append(message).append("</p>");
     body += "<hr><em>TinyWebServer</em></body></html>";
 
-    buff.Append("Content-length: " + to_string(body.size()) + "\r\n\r\n");
-    buff.Append(body);
+    char len[64];
+    n = snprintf(len, sizeof(len), "Content-length: %zu\r\n\r\n", body.size());
+    buff.Append(len, n);
+    buff.Append(body.data(), body.size());
 }
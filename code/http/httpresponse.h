@@ -7,6 +7,8 @@
 #define HTTP_RESPONSE_H
 
 #include <unordered_map>
+#include <string_view>
+#include <memory_resource>
 #include <fcntl.h>       // open
 #include <unistd.h>      // close
 #include <sys/stat.h>    // stat
@@ -14,33 +16,43 @@
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
+#include "../pool/sessionstore.h"
 
 class HttpResponse {
 public:
-    HttpResponse();
+    // 拼接路径、错误页面等临时字符串从arena分配
+    explicit HttpResponse(std::pmr::memory_resource* arena = std::pmr::get_default_resource());
     ~HttpResponse();
 
-    void Init(const std::string& srcDir, std::string& path, bool isKeepAlive = false, int code = -1);
+    // srcDir、path 只保存视图，需在 MakeResponse 完成前保持有效
+    void Init(std::string_view srcDir, std::string_view path, bool isKeepAlive = false, int code = -1);
     void MakeResponse(Buffer& buff);
     void UnmapFile();
     char* File();
     size_t FileLen() const;
-    void ErrorContent(Buffer& buff, std::string message);
+    void ErrorContent(Buffer& buff, std::string_view message);
+    // 不对应文件的响应（如/metrics），body直接写入buff
+    void MakeTextResponse(Buffer& buff, std::string_view body, std::string_view type);
     int Code() const { return code_; }
+    // 登录成功时在响应头中下发会话Cookie，id只保存视图
+    void SetCookie(std::string_view id, int maxAge);
 
 private:
     void AddStateLine_(Buffer &buff);
-    void AddHeader_(Buffer &buff);
-    void AddContent_(Buffer &buff);
+    void AddHeader_(Buffer &buff, std::string_view type);
+    void AddContent_(Buffer &buff, const std::pmr::string& file);
 
-    void ErrorHtml_();
-    std::string GetFileType_();
+    void ErrorHtml_(std::pmr::string& file);
+    const std::string& GetFileType_();
 
+    std::pmr::memory_resource* arena_;  // 请求内存
     int code_;              // 状态码
     bool isKeepAlive_;      // 是否保活
 
-    std::string path_;      // 资源路径
-    std::string srcDir_;    // 资源目录
+    std::string_view path_;     // 资源路径
+    std::string_view srcDir_;   // 资源目录
+    std::string_view cookie_;   // 新的会话id，为空时不发Set-Cookie
+    int cookieAge_;
     
     char* mmFile_;              // 文件内存映射信息
     struct stat mmFileStat_;    // 文件的状态信息
@@ -0,0 +1,180 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-26
+ * @copyleft Apache 2.0
+ */
+#define LOG_MODULE Log::MODULE_HTTP
+#include "router.h"
+#include "../log/log.h"
+#include "../metrics/metrics.h"
+#include <assert.h>
+
+using namespace std;
+
+Router::Router(bool defaults) {
+    nodes_.emplace_back();
+    if(!defaults) { return; }
+
+    // 默认的网页：/ 和不带后缀的页面名
+    File("/", "/index.html");
+    for(const char* page : { "/index", "/register", "/login", "/welcome", "/video", "/picture" }) {
+        File(page, string(page) + ".html");
+    }
+    // 需要登录的页面
+    File("/welcome.html", "", true);
+    // 登录/注册表单
+    Form("/register.html", ACTION_REGISTER);
+    Form("/login.html", ACTION_LOGIN);
+    // 运行时统计
+    Handle("", "/metrics", [](const HttpRequest&, Reply* reply) {
+        Metrics::Render(&reply->body);
+        reply->type = "text/plain; version=0.0.4";
+    });
+}
+
+Router::~Router() = default;
+
+Router* Router::Instance() {
+    static Router router(true);
+    return &router;
+}
+
+void Router::File(string_view path, string_view file, bool auth) {
+    Route route;
+    route.action = ACTION_FILE;
+    route.target = file;
+    route.auth = auth;
+    Add_(path, false, move(route));
+}
+
+void Router::Static(string_view prefix, string_view dir) {
+    Route route;
+    route.action = ACTION_FILE;
+    route.target = dir;
+    Add_(prefix, true, move(route));
+}
+
+void Router::Form(string_view path, int action) {
+    assert(action == ACTION_LOGIN || action == ACTION_REGISTER);
+    Route route;
+    route.action = action;
+    route.method = "POST";
+    Add_(path, false, move(route));
+}
+
+void Router::Handle(string_view method, string_view path, Handler handler) {
+    assert(handler);
+    Route route;
+    route.action = ACTION_HANDLER;
+    route.method = method;
+    route.handler = move(handler);
+    Add_(path, false, move(route));
+}
+
+void Router::HandlePrefix(string_view method, string_view prefix, Handler handler) {
+    assert(handler);
+    Route route;
+    route.action = ACTION_HANDLER;
+    route.method = method;
+    route.handler = move(handler);
+    Add_(prefix, true, move(route));
+}
+
+int Router::Child_(int node, char ch) const {
+    for(auto& item : nodes_[node].next) {
+        if(item.first == ch) { return item.second; }
+    }
+    return -1;
+}
+
+// 返回key对应的节点，没有时新建；边的一部分匹配时把边拆成两段
+// nodes_扩容后引用失效，全程用下标
+int Router::Insert_(string_view key) {
+    int cur = 0;
+    while(!key.empty()) {
+        int child = Child_(cur, key[0]);
+        // 01：没有以这个字符开头的边：剩下的整段作为一条新边
+        if(child < 0) {
+            Node node;
+            node.label = key;
+            nodes_.push_back(move(node));
+            nodes_[cur].next.emplace_back(key[0], (int)nodes_.size() - 1);
+            return nodes_.size() - 1;
+        }
+        // 02：求边和key的公共前缀
+        const string& label = nodes_[child].label;
+        size_t n = 0;
+        while(n < label.size() && n < key.size() && label[n] == key[n]) { n++; }
+        // 03：只匹配了边的一部分：中间插入一个节点
+        if(n < label.size()) {
+            Node mid;
+            mid.label = label.substr(0, n);
+            mid.next.emplace_back(label[n], child);
+            nodes_[child].label.erase(0, n);
+            nodes_.push_back(move(mid));
+            int midIdx = nodes_.size() - 1;
+            for(auto& item : nodes_[cur].next) {
+                if(item.second == child) { item.second = midIdx; }
+            }
+            child = midIdx;
+        }
+        key.remove_prefix(n);
+        cur = child;
+    }
+    return cur;
+}
+
+void Router::Add_(string_view key, bool isPrefix, Route route) {
+    assert(!key.empty() && key[0] == '/');
+    route.prefixLen = isPrefix ? key.size() : 0;
+    int node = Insert_(key);
+    vector<Route*>& routes = isPrefix ? nodes_[node].prefix : nodes_[node].exact;
+    // 同一路径同一方法再次注册时替换原来的路由
+    for(Route* old : routes) {
+        if(old->method == route.method) {
+            *old = move(route);
+            return;
+        }
+    }
+    routes_.emplace_back(new Route(move(route)));
+    routes.push_back(routes_.back().get());
+}
+
+// 指定了方法的路由优先于任意方法的路由
+const Router::Route* Router::Pick_(const vector<Route*>& routes, string_view method) {
+    const Route* any = nullptr;
+    for(const Route* route : routes) {
+        if(route->method == method) { return route; }
+        if(route->method.empty()) { any = route; }
+    }
+    return any;
+}
+
+const Router::Route* Router::Match(string_view method, string_view path) const {
+    path = path.substr(0, path.find('?'));
+    const Route* best = nullptr;
+    int cur = 0;
+    size_t pos = 0;
+    while(true) {
+        const Node& node = nodes_[cur];
+        // 01：前缀路由：已匹配的部分在路径段的边界上结束，越深越长
+        if(!node.prefix.empty() && pos > 0 &&
+           (pos == path.size() || path[pos - 1] == '/' || path[pos] == '/')) {
+            const Route* route = Pick_(node.prefix, method);
+            if(route) { best = route; }
+        }
+        // 02：整个路径走完：有精确路由时优先
+        if(pos == path.size()) {
+            const Route* route = Pick_(node.exact, method);
+            return route ? route : best;
+        }
+        // 03：沿首字符相同的边往下走，边要完整匹配
+        int child = Child_(cur, path[pos]);
+        if(child < 0) { break; }
+        const string& label = nodes_[child].label;
+        if(path.compare(pos, label.size(), label) != 0) { break; }
+        pos += label.size();
+        cur = child;
+    }
+    return best;
+}
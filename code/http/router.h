@@ -0,0 +1,84 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-26
+ * @copyleft Apache 2.0
+ */
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <functional>
+
+class HttpRequest;
+
+/* 路由表：路径按字符存成压缩前缀树（边上是一段字符串），匹配时沿路径走一遍，不分配内存
+   每个节点上有精确路由和前缀路由，可以按请求方法区分；精确路由优先，否则取最长的前缀路由
+   前缀路由只在路径段的边界上匹配（/static匹配/static/a.css，不匹配/statics）
+   启动时注册（在Start之前），之后只读；没有匹配的路由时按路径查找资源目录下的文件 */
+class Router {
+public:
+    enum ACTION {
+        ACTION_FILE = 0,        // 返回资源目录下的文件，按target改写路径
+        ACTION_LOGIN,           // 登录表单，需要查询用户表
+        ACTION_REGISTER,        // 注册表单
+        ACTION_HANDLER,         // 调用注册的函数生成响应
+    };
+
+    // 处理函数的响应，body不对应文件
+    struct Reply {
+        int code = 200;
+        std::string body;
+        std::string_view type = "text/plain";
+    };
+    typedef std::function<void(const HttpRequest&, Reply*)> Handler;
+
+    struct Route {
+        int action = ACTION_FILE;
+        std::string method;     // 空表示任意方法
+        std::string target;     // ACTION_FILE：精确路由替换整个路径，前缀路由只替换前缀；空表示不改写
+        size_t prefixLen = 0;   // 前缀路由的前缀长度，精确路由为0
+        bool auth = false;      // 需要登录：没有会话时返回登录页
+        Handler handler;
+    };
+
+    static Router* Instance();      // 带默认路由：站点的页面、登录/注册表单和/metrics
+
+    explicit Router(bool defaults = false);
+    ~Router();
+
+    // 精确路径返回文件：file为改写后的路径（如/login -> /login.html），空表示路径本身
+    void File(std::string_view path, std::string_view file, bool auth = false);
+    // 前缀下的路径映射到资源目录下的dir中（如/static/ -> /assets/）
+    void Static(std::string_view prefix, std::string_view dir);
+    // POST表单：ACTION_LOGIN或ACTION_REGISTER
+    void Form(std::string_view path, int action);
+    // 处理函数：method为空时匹配任意方法
+    void Handle(std::string_view method, std::string_view path, Handler handler);
+    void HandlePrefix(std::string_view method, std::string_view prefix, Handler handler);
+
+    // 路径中的查询串（?之后）不参与匹配；没有匹配时返回nullptr
+    const Route* Match(std::string_view method, std::string_view path) const;
+
+    size_t Size() const { return routes_.size(); }
+
+private:
+    struct Node {
+        std::string label;                          // 父节点到这里的边
+        std::vector<std::pair<char, int>> next;     // 子节点：边的首字符 -> 下标
+        std::vector<Route*> exact;
+        std::vector<Route*> prefix;
+    };
+
+    int Child_(int node, char ch) const;
+    int Insert_(std::string_view key);
+    void Add_(std::string_view key, bool isPrefix, Route route);
+    static const Route* Pick_(const std::vector<Route*>& routes, std::string_view method);
+
+    std::vector<Node> nodes_;                       // nodes_[0]为根，边为空
+    std::vector<std::unique_ptr<Route>> routes_;    // 地址不变，匹配结果直接指向这里
+};
+
+#endif // ROUTER_H
@@ -0,0 +1,226 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#include "accesslog.h"
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <assert.h>
+#include <cstring>
+#include <cstdio>
+
+using namespace std;
+
+// 每个线程缓存当前秒格式化好的时间
+struct AccessClock {
+    time_t sec = -1;
+    char clf[40];           // [18/Oct/2026:14:12:23 +0800]
+    int clfLen = 0;
+    char iso[40];           // 2026-10-18T14:12:23+0800
+    int isoLen = 0;
+};
+static thread_local AccessClock tlsClock;
+
+static thread_local unsigned tlsSample = 0;
+
+/* 在定长缓冲区中追加内容，超出部分截断 */
+struct LineWriter {
+    char* p;
+    char* end;
+
+    void Put(char c) { if(p < end) { *p++ = c; } }
+    void Put(string_view s) {
+        size_t n = min(s.size(), (size_t)(end - p));
+        memcpy(p, s.data(), n);
+        p += n;
+    }
+    void Num(long long v) {
+        char tmp[24];
+        Put(string_view(tmp, snprintf(tmp, sizeof(tmp), "%lld", v)));
+    }
+    // CLF中的引号字段：空值写'-'，引号和反斜杠转义
+    void Escaped(string_view s) {
+        for(char c : s) {
+            if(c == '"' || c == '\\') { Put('\\'); }
+            Put((unsigned char)c < 0x20 ? '?' : c);
+        }
+    }
+    void Quoted(string_view s) {
+        Put('"');
+        if(s.empty()) { Put('-'); }
+        Escaped(s);
+        Put('"');
+    }
+    void Json(string_view s) {
+        static const char HEX[] = "0123456789abcdef";
+        Put('"');
+        for(char c : s) {
+            unsigned char u = c;
+            if(c == '"' || c == '\\') { Put('\\'); Put(c); }
+            else if(u < 0x20) { Put("\\u00"); Put(HEX[u >> 4]); Put(HEX[u & 15]); }
+            else { Put(c); }
+        }
+        Put('"');
+    }
+};
+
+AccessLog::AccessLog() : rings_(RING_BYTES) {
+    format_ = FORMAT_COMBINED;
+    sampleRate_ = 1;
+    isOpen_ = false;
+    stop_ = false;
+    dropped_ = 0;
+}
+
+AccessLog::~AccessLog() {
+    if(writeThread_ && writeThread_->joinable()) {
+        stop_ = true;
+        wake_.NotifyAll();
+        writeThread_->join();
+    }
+}
+
+AccessLog* AccessLog::Instance() {
+    static AccessLog inst;
+    return &inst;
+}
+
+void AccessLog::Init(const char* path, int format, int sampleRate) {
+    format_ = format;
+    sampleRate_ = max(sampleRate, 1);
+    // ./log/access.log -> 目录./log，文件名access_年_月_日.log
+    string file(path);
+    size_t slash = file.rfind('/');
+    string dir = slash == string::npos ? "." : file.substr(0, slash);
+    string name = slash == string::npos ? file : file.substr(slash + 1);
+    size_t dot = name.rfind('.');
+    string suffix = dot == string::npos ? "" : name.substr(dot);
+    string prefix = name.substr(0, dot) + "_";
+    {
+        lock_guard<mutex> locker(fileMtx_);
+        bool opened = file_.Open(dir, prefix, suffix);
+        assert(opened);
+        (void)opened;
+    }
+    if(!writeThread_) {
+        writeThread_.reset(new thread([this] { WriterLoop_(); }));
+    }
+    isOpen_ = true;
+}
+
+void AccessLog::SetRotation(size_t maxFileBytes, int intervalSec) {
+    lock_guard<mutex> locker(fileMtx_);
+    file_.SetRotation(maxFileBytes, intervalSec);
+}
+
+void AccessLog::SetRetention(size_t diskBudget, bool compress) {
+    lock_guard<mutex> locker(fileMtx_);
+    file_.SetRetention(diskBudget, compress);
+}
+
+string AccessLog::FileName() {
+    lock_guard<mutex> locker(fileMtx_);
+    return file_.Name();
+}
+
+bool AccessLog::Sample() {
+    int rate = sampleRate_.load(std::memory_order_relaxed);
+    return rate <= 1 || ++tlsSample % rate == 0;
+}
+
+void AccessLog::Write(const Entry& e) {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    if(tlsClock.sec != now.tv_sec) {
+        struct tm t;
+        localtime_r(&now.tv_sec, &t);
+        tlsClock.sec = now.tv_sec;
+        tlsClock.clfLen = strftime(tlsClock.clf, sizeof(tlsClock.clf), "[%d/%b/%Y:%H:%M:%S %z]", &t);
+        tlsClock.isoLen = strftime(tlsClock.iso, sizeof(tlsClock.iso), "%Y-%m-%dT%H:%M:%S%z", &t);
+    }
+
+    char line[LINE_MAX_LEN];
+    LineWriter w = { line, line + LINE_MAX_LEN - 1 };
+    int format = format_.load(std::memory_order_relaxed);
+    if(format == FORMAT_JSON) {
+        w.Put("{\"time\":\"");
+        w.Put(string_view(tlsClock.iso, tlsClock.isoLen));
+        w.Put("\",\"ip\":");            w.Json(e.ip);
+        w.Put(",\"method\":");          w.Json(e.method);
+        w.Put(",\"path\":");            w.Json(e.path);
+        w.Put(",\"version\":");         w.Json(e.version);
+        w.Put(",\"status\":");          w.Num(e.status);
+        w.Put(",\"bytes\":");           w.Num(e.bytes);
+        w.Put(",\"latency_us\":");      w.Num(e.latencyUs);
+        w.Put(",\"reuse\":");           w.Num(e.reuse);
+        w.Put(",\"referer\":");         w.Json(e.referer);
+        w.Put(",\"user_agent\":");      w.Json(e.userAgent);
+        w.Put('}');
+    } else {
+        // host ident user [time] "request" status bytes ["referer" "user-agent"] latency_us reuse
+        w.Put(e.ip);
+        w.Put(" - - ");
+        w.Put(string_view(tlsClock.clf, tlsClock.clfLen));
+        w.Put(" \"");
+        if(e.method.empty()) {
+            w.Put('-');
+        } else {
+            w.Escaped(e.method); w.Put(' '); w.Escaped(e.path); w.Put(" HTTP/"); w.Escaped(e.version);
+        }
+        w.Put("\" ");
+        w.Num(e.status);
+        w.Put(' ');
+        w.Num(e.bytes);
+        if(format == FORMAT_COMBINED) {
+            w.Put(' '); w.Quoted(e.referer);
+            w.Put(' '); w.Quoted(e.userAgent);
+        }
+        w.Put(' ');
+        w.Num(e.latencyUs);
+        w.Put(' ');
+        w.Num(e.reuse);
+    }
+    *w.p++ = '\n';
+
+    LogRing* ring = rings_.Local();
+    if(!ring->Push(line, w.p - line)) {
+        // 写不过来时丢弃，不阻塞请求线程
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        wake_.Notify();
+        return;
+    }
+    if(ring->Size() > ring->Capacity() / 2) { wake_.Notify(); }
+}
+
+void AccessLog::Flush() {
+    if(!writeThread_) { return; }
+    rings_.WaitDrained(&wake_);
+}
+
+// 写出所有线程缓冲区中的记录，写之前按大小和日期切分
+size_t AccessLog::Drain_() {
+    return rings_.Drain([this](struct iovec* iov, int cnt, const int*, size_t) {
+        lock_guard<mutex> locker(fileMtx_);
+        file_.RotateIfNeeded();
+        file_.Writev(iov, cnt);
+    });
+}
+
+void AccessLog::WriterLoop_() {
+    while(true) {
+        if(Drain_() > 0) { continue; }
+        if(stop_) { break; }
+        {
+            lock_guard<mutex> locker(fileMtx_);
+            file_.Reap();
+        }
+        uint32_t seq = wake_.Prepare();
+        if(stop_) {
+            wake_.Cancel();
+            continue;
+        }
+        wake_.Wait(seq, FLUSH_INTERVAL_MS);
+    }
+}
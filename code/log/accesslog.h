@@ -0,0 +1,83 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#ifndef ACCESSLOG_H
+#define ACCESSLOG_H
+
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include "logring.h"
+#include "logfile.h"
+#include "../pool/futexevent.h"
+
+/* 访问日志：每个请求一条记录，与普通日志分开
+   工作线程格式化后放入本线程的环形缓冲区，写线程批量writev写出；缓冲区满时丢弃并计数
+   文件和普通日志一样按日期、大小切分，写完的文件压缩，超过目录上限时删除最旧的 */
+class AccessLog {
+public:
+    enum FORMAT {
+        FORMAT_COMMON = 0,      // Common Log Format
+        FORMAT_COMBINED,        // Combined Log Format（多referer和user-agent）
+        FORMAT_JSON,            // 每行一个JSON对象
+    };
+
+    // 一次请求的信息，字符串只在Write调用期间有效
+    struct Entry {
+        const char* ip;
+        std::string_view method;
+        std::string_view path;
+        std::string_view version;
+        std::string_view referer;
+        std::string_view userAgent;
+        int status;
+        size_t bytes;           // 响应字节数（含响应头）
+        int64_t latencyUs;      // 从收到请求到响应发送完毕
+        int reuse;              // 同一连接上之前已处理的请求数
+    };
+
+    static AccessLog* Instance();
+
+    // 采样率n：每n个请求记录一个
+    // path如./log/access.log：写入./log/access_年_月_日.log，切分出的文件为 access_年_月_日-1.log …
+    void Init(const char* path, int format = FORMAT_COMBINED, int sampleRate = 1);
+    // 同Log::SetRotation/SetRetention
+    void SetRotation(size_t maxFileBytes, int intervalSec = 0);
+    void SetRetention(size_t diskBudget, bool compress = true);
+    std::string FileName();             // 当前写入的文件
+    bool IsOpen() const { return isOpen_.load(std::memory_order_relaxed); }
+    bool Sample();                      // 本次请求是否需要记录
+    void Write(const Entry& entry);
+    void Flush();                       // 等待已写入的记录落盘
+    uint64_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    AccessLog();
+    ~AccessLog();
+    size_t Drain_();
+    void WriterLoop_();
+
+    static const size_t RING_BYTES = 256 * 1024;    // 每个线程的缓冲区
+    static const int LINE_MAX_LEN = 4096;
+    static const int FLUSH_INTERVAL_MS = 100;
+
+    LogFile file_;
+    std::atomic<int> format_;
+    std::atomic<int> sampleRate_;
+    std::atomic<bool> isOpen_;
+    std::atomic<bool> stop_;
+    std::atomic<uint64_t> dropped_;
+
+    RingSet rings_;
+    std::mutex fileMtx_;                // 保护file_
+    FutexEvent wake_;
+    std::unique_ptr<std::thread> writeThread_;
+};
+
+#endif // ACCESSLOG_H
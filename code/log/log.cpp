@@ -2,212 +2,374 @@
  * @Author       : mark
  * @Date         : 2020-06-16
  * @copyleft Apache 2.0
- */ 
+ */
 #include "log.h"
+#include <unistd.h>
+#include <algorithm>
 
 using namespace std;
+using logcodec::LEVEL_TITLE_LEN;
+
+// 每个线程缓存当前秒的时间前缀，同一秒内不再调用localtime
+struct LogClock {
+    time_t sec = -1;
+    char prefix[32];        // 2020-06-16 12:00:00.
+    int len = 0;
+};
+static thread_local LogClock tlsClock;
 
 // 构造函数
-Log::Log() {
-    lineCount_ = 0;
+Log::Log() : rings_(0) {
     isAsync_ = false;
+    isOpen_ = false;
+    level_ = 1;
+    for(int i = 0; i < MODULE_NUM; i++) {
+        moduleOverride_[i] = -1;
+        moduleLevel_[i] = LEVEL_OFF;
+    }
     writeThread_ = nullptr;
-    deque_ = nullptr;
-    toDay_ = 0;
-    fp_ = nullptr;
+    stop_ = false;
+    writerIdle_ = false;
+    format_ = FORMAT_TEXT;
+    overflow_ = OVERFLOW_DROP_BELOW;
+    keepLevel_ = 2;
+    overflowTimeoutMs_ = OVERFLOW_TIMEOUT_MS;
+    dropped_ = 0;
+    delayed_ = 0;
+    reported_ = 0;
+    formatCnt_ = 0;
+    needMagic_ = false;
 }
 
-// 析构函数
+// 析构函数：写线程把所有环形缓冲区写完后退出
 Log::~Log() {
     if(writeThread_ && writeThread_->joinable()) {
-        while(!deque_->empty()) {
-            deque_->flush();
-        };
-        deque_->Close();
+        stop_ = true;
+        WakeWriter_();
         writeThread_->join();
     }
-    if(fp_) {
-        lock_guard<mutex> locker(mtx_);
-        flush();
-        fclose(fp_);
-    }
 }
 
 // 获取日志级别
 int Log::GetLevel() {
-    lock_guard<mutex> locker(mtx_);
-    return level_;
+    return level_.load(std::memory_order_relaxed);
 }
 
 // 设置日志级别
 void Log::SetLevel(int level) {
     lock_guard<mutex> locker(mtx_);
     level_ = level;
+    UpdateModuleLevels_();
 }
 
-// 日志初始化：（级别，路径，后缀名，异步队列大小）
-void Log::init(int level = 1, const char* path, const char* suffix,int maxQueueSize) {
-    isOpen_ = true;
-    level_ = level;
-    // 采用异步
+// 设置某个模块的级别
+void Log::SetModuleLevel(int module, int level) {
+    assert(module >= 0 && module < MODULE_NUM);
+    lock_guard<mutex> locker(mtx_);
+    moduleOverride_[module] = level;
+    UpdateModuleLevels_();
+}
+
+// 重新计算各模块生效的级别（持有mtx_时调用）
+void Log::UpdateModuleLevels_() {
+    for(int i = 0; i < MODULE_NUM; i++) {
+        int level = moduleOverride_[i] >= 0 ? moduleOverride_[i].load() : level_.load();
+        moduleLevel_[i].store(isOpen_ ? level : LEVEL_OFF, std::memory_order_relaxed);
+    }
+}
+
+// 设置切分条件
+void Log::SetRotation(size_t maxFileBytes, int intervalSec) {
+    lock_guard<mutex> locker(fileMtx_);
+    file_.SetRotation(maxFileBytes, intervalSec);
+}
+
+// 设置保留策略
+void Log::SetRetention(size_t diskBudget, bool compress) {
+    lock_guard<mutex> locker(fileMtx_);
+    file_.SetRetention(diskBudget, compress);
+}
+
+// 设置溢出策略
+void Log::SetOverflowPolicy(int policy, int keepLevel, int timeoutMs) {
+    overflow_ = policy;
+    keepLevel_ = keepLevel;
+    overflowTimeoutMs_ = timeoutMs;
+}
+
+// 日志初始化：（级别，路径，后缀名，异步队列大小，日志格式）
+void Log::init(int level = 1, const char* path, const char* suffix,int maxQueueSize, int format) {
+    // 采用异步：每个线程一个环形缓冲区，由写线程统一写入文件
     if(maxQueueSize > 0) {
+        rings_.SetRingBytes(max<size_t>(64 * 1024, (size_t)maxQueueSize * RING_BYTES_PER_ITEM));
         isAsync_ = true;
-        // 判断队列是否为空
-        if(!deque_) {
-            // 创建新的队列
-            unique_ptr<BlockDeque<std::string>> newDeque(new BlockDeque<std::string>);
-            deque_ = move(newDeque);
-            // 异步线程
-            std::unique_ptr<std::thread> NewThread(new thread(FlushLogThread)); 
+        if(!writeThread_) {
+            std::unique_ptr<std::thread> NewThread(new thread(FlushLogThread));
             writeThread_ = move(NewThread);
         }
     } else {
         isAsync_ = false;
     }
 
-    lineCount_ = 0;
-    // 获取时间
-    time_t timer = time(nullptr);
-    struct tm *sysTime = localtime(&timer);
-    struct tm t = *sysTime;
-
-    path_ = path;           // 路径（./log）
-    suffix_ = suffix;       // 后缀名(.log)
-
-    char fileName[LOG_NAME_LEN] = {0};  // 文件名
-    snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s", 
-            path_, t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, suffix_);
-
-    toDay_ = t.tm_mday;     // 今天日期
-
+    // 之前的日志写完再切换文件
+    flush();
     {
-        lock_guard<mutex> locker(mtx_);
-        buff_.RetrieveAll();
-        // 刷新
-        if(fp_) { 
-            flush();
-            fclose(fp_); 
-        }
-
-        // 打开新的文件
-        fp_ = fopen(fileName, "a");
-        if(fp_ == nullptr) {
-            mkdir(path_, 0777);
-            fp_ = fopen(fileName, "a");
-        } 
-        
-        assert(fp_ != nullptr);
+        lock_guard<mutex> locker(fileMtx_);
+        // 同步写没有写线程，只能用文本格式
+        format_ = isAsync_ ? format : FORMAT_TEXT;
+        // 打开新的文件：路径（./log）下的 年_月_日 + 后缀名(.log)
+        bool opened = file_.Open(path, "", suffix);
+        assert(opened);
+        (void)opened;
+        FileOpened_();
     }
+    isOpen_ = true;
+    SetLevel(level);
 }
 
-// 写日志操作
+// 写日志操作：调用线程只负责格式化并放入本线程的环形缓冲区，不加锁、不分配内存
 void Log::write(int level, const char *format, ...) {
     // 获取时间信息
     struct timeval now = {0, 0};
     gettimeofday(&now, nullptr);
-    time_t tSec = now.tv_sec;
-    struct tm *sysTime = localtime(&tSec);
-    struct tm t = *sysTime;
-    va_list vaList;
+    if(tlsClock.sec != now.tv_sec) {
+        struct tm t;
+        localtime_r(&now.tv_sec, &t);
+        tlsClock.sec = now.tv_sec;
+        tlsClock.len = snprintf(tlsClock.prefix, sizeof(tlsClock.prefix), "%d-%02d-%02d %02d:%02d:%02d.",
+                    t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec);
+    }
 
+    char line[LINE_MAX_LEN];
+    int n = tlsClock.len;
+    memcpy(line, tlsClock.prefix, n);
+    long usec = now.tv_usec;
+    for(int i = 5; i >= 0; i--, usec /= 10) {      // 微秒，固定6位
+        line[n + i] = '0' + usec % 10;
+    }
+    n += 6;
+    line[n++] = ' ';
+    memcpy(line + n, logcodec::LevelTitle(level), LEVEL_TITLE_LEN);    // 记录级别
+    n += LEVEL_TITLE_LEN;
 
-    /* 日志日期 日志行数 */
-    if (toDay_ != t.tm_mday || (lineCount_ && (lineCount_  %  MAX_LINES == 0)))
-    {
-        // 获取互斥锁
-        unique_lock<mutex> locker(mtx_);
-        locker.unlock();
-        
-        char newFile[LOG_NAME_LEN];
-        char tail[36] = {0};
-        snprintf(tail, 36, "%04d_%02d_%02d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);    // 年_月_日
-
-        // 日期变化
-        if (toDay_ != t.tm_mday)
-        {
-            snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s%s", path_, tail, suffix_);
-            toDay_ = t.tm_mday;
-            lineCount_ = 0;
-        }
-        // 行数变换
-        else 
-        {
-            snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s-%d%s", path_, tail, (lineCount_  / MAX_LINES), suffix_);
-        }
-        
-        // 处理旧文件的信息
-        locker.lock();
-        flush();
-        fclose(fp_);
-        fp_ = fopen(newFile, "a");
-        assert(fp_ != nullptr);
+    va_list vaList;
+    va_start(vaList, format);
+    int m = vsnprintf(line + n, LINE_MAX_LEN - n - 1, format, vaList);
+    va_end(vaList);                 // 日志具体内容
+    if(m < 0) { m = 0; }
+    if(m > LINE_MAX_LEN - n - 2) { m = LINE_MAX_LEN - n - 2; }     // 截断
+    n += m;
+    line[n++] = '\n';
+
+    if(isAsync_) {
+        PushRecord_(level, line, n);
     }
+    else {
+        lock_guard<mutex> locker(fileMtx_);
+        RotateIfNeeded_();
+        file_.Write(line, n);
+    }
+}
 
-    // 写操作
-    {
-        // 01：获取互斥锁
-        unique_lock<mutex> locker(mtx_);
-        lineCount_++;
-        int n = snprintf(buff_.BeginWrite(), 128, "%d-%02d-%02d %02d:%02d:%02d.%06ld ",
-                    t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
-                    t.tm_hour, t.tm_min, t.tm_sec, now.tv_usec);    // 记录时间
-                    
-        buff_.HasWritten(n);
-        AppendLogLevelTitle_(level);    // 记录级别
-
-        va_start(vaList, format);
-        int m = vsnprintf(buff_.BeginWrite(), buff_.WritableBytes(), format, vaList);
-        va_end(vaList);                 // 日志具体内容
-
-        buff_.HasWritten(m);
-        buff_.Append("\n\0", 2);        // 结束标志     
-
-        if(isAsync_ && deque_ && !deque_->full())   //异步 队列不为空 队列没满
-        {
-            deque_->push_back(buff_.RetrieveAllToStr());
-        } 
-        else 
-        {
-            fputs(buff_.Peek(), fp_);
+// 放入本线程的环形缓冲区（文本行或二进制记录）
+void Log::PushRecord_(int level, const char* data, size_t len) {
+    LogRing* ring = rings_.Local();
+    if(!ring->Push(data, len)) {
+        // 缓冲区满：按策略丢弃，或叫醒写线程等它腾出空间
+        int policy = overflow_.load(std::memory_order_relaxed);
+        if(policy == OVERFLOW_DROP ||
+            (policy == OVERFLOW_DROP_BELOW && level < keepLevel_.load(std::memory_order_relaxed))) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
         }
-        buff_.RetrieveAll();            // 清空
+        delayed_.fetch_add(1, std::memory_order_relaxed);
+        struct timeval start, now;
+        gettimeofday(&start, nullptr);
+        long timeoutUs = overflowTimeoutMs_.load(std::memory_order_relaxed) * 1000L;
+        do {
+            gettimeofday(&now, nullptr);
+            if(stop_ || (now.tv_sec - start.tv_sec) * 1000000L + (now.tv_usec - start.tv_usec) >= timeoutUs) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            WakeWriter_();
+            usleep(100);
+        } while(!ring->Push(data, len));
+    }
+    // 积压过半且写线程在休眠时才唤醒，避免每条日志一次系统调用
+    if(ring->Size() > ring->Capacity() / 2 && writerIdle_.exchange(false)) {
+        WakeWriter_();
     }
 }
 
-void Log::AppendLogLevelTitle_(int level) {
-    switch(level) {
-    case 0:
-        buff_.Append("[debug]: ", 9);
-        break;
-    case 1:
-        buff_.Append("[info] : ", 9);
-        break;
-    case 2:
-        buff_.Append("[warn] : ", 9);
-        break;
-    case 3:
-        buff_.Append("[error]: ", 9);
-        break;
-    default:
-        buff_.Append("[info] : ", 9);
-        break;
+// 丢弃日志时在文件中留下记录，便于发现磁盘跟不上
+void Log::ReportDropped_() {
+    uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+    if(dropped == reported_) { return; }
+    struct timeval now = {0, 0};
+    gettimeofday(&now, nullptr);
+    string line;
+    logcodec::AppendTimestamp((int64_t)now.tv_sec * 1000000 + now.tv_usec, &line);
+    line.append(logcodec::LevelTitle(2), LEVEL_TITLE_LEN);
+    line.append("log overflow, dropped ").append(to_string(dropped - reported_)).append(" records\n");
+    reported_ = dropped;
+
+    lock_guard<mutex> locker(fileMtx_);
+    if(format_ == FORMAT_BINARY && needMagic_) {
+        line.insert(0, logcodec::MAGIC, logcodec::MAGIC_LEN);
+        needMagic_ = false;
     }
+    file_.Write(line.data(), line.size());
 }
 
-// 刷新
+// 注册格式串，返回ID；格式串在第一次使用前解析好，写线程和编码时共用
+int Log::RegisterFormat(const char* format) {
+    lock_guard<mutex> locker(fmtMtx_);
+    if(formatCnt_ >= MAX_FORMATS) { return -1; }
+    formats_[formatCnt_].reset(new logcodec::LogFormat(format));
+    return formatCnt_++;
+}
+
+// 刷新：唤醒写线程，等待调用前已产生的日志全部写出
 void Log::flush() {
-    if(isAsync_) { 
-        deque_->flush(); 
+    if(!writeThread_) { return; }
+    rings_.WaitDrained(&wake_);
+}
+
+void Log::RingDepths(vector<size_t>* depths) {
+    rings_.Depths(depths);
+}
+
+void Log::WakeWriter_() {
+    wake_.Notify();
+}
+
+// 切分后换了新文件：二进制格式在新文件中重新写出文件头和用到的格式串（持有fileMtx_时调用）
+void Log::RotateIfNeeded_() {
+    if(file_.RotateIfNeeded()) { FileOpened_(); }
+}
+
+// 二进制格式下每个文件重新写出用到的格式串，使文件可以单独解码
+void Log::FileOpened_() {
+    emitted_.assign(MAX_FORMATS, false);
+    needMagic_ = (file_.Bytes() == 0);
+}
+
+// 在一个缓冲区的一段或两段数据上依次取出每条记录：二进制记录或以'\n'结尾的文本行
+// 跨越回绕点的记录拷贝到tmp中
+template<class F>
+static void ForEachRecord(const struct iovec* iov, int k, char* tmp, size_t tmpSize, F fn) {
+    const char* base0 = static_cast<const char*>(iov[0].iov_base);
+    const char* base1 = k > 1 ? static_cast<const char*>(iov[1].iov_base) : nullptr;
+    size_t len0 = iov[0].iov_len;
+    size_t total = len0 + (k > 1 ? iov[1].iov_len : 0);
+    auto copy = [&](size_t off, size_t n, char* dst) {
+        size_t first = off < len0 ? min(n, len0 - off) : 0;
+        if(first) { memcpy(dst, base0 + off, first); }
+        if(n > first) { memcpy(dst + first, base1 + (off + first - len0), n - first); }
+    };
+
+    size_t off = 0;
+    while(off < total) {
+        const char* start = off < len0 ? base0 + off : base1 + (off - len0);
+        size_t len = 0;
+        if(*start == logcodec::REC_LOG) {
+            uint16_t recLen;
+            if(total - off < logcodec::HEAD_LEN) { break; }
+            copy(off + 2, sizeof(recLen), reinterpret_cast<char*>(&recLen));
+            len = recLen;
+        } else {
+            const char* nl = nullptr;
+            if(off < len0) {
+                nl = static_cast<const char*>(memchr(start, '\n', len0 - off));
+                if(nl) { len = nl - start + 1; }
+            }
+            if(!nl && base1) {
+                size_t from = off < len0 ? 0 : off - len0;
+                nl = static_cast<const char*>(memchr(base1 + from, '\n', total - len0 - from));
+                if(nl) { len = (nl - base1) + len0 - off + 1; }
+            }
+        }
+        if(len == 0 || len > total - off || len > tmpSize) { break; }    // 数据损坏
+        if(off >= len0 || off + len <= len0) {
+            fn(start, len);
+        } else {
+            copy(off, len, tmp);
+            fn(tmp, len);
+        }
+        off += len;
     }
-    fflush(fp_);
+}
+
+// 写线程：把本批二进制记录格式化成文本（或补上格式串定义）放入out_
+void Log::EncodeBatch_(const struct iovec* iov, const int* segs, size_t ringCnt) {
+    char tmp[LINE_MAX_LEN];
+    int format = format_;
+    out_.clear();
+    if(format == FORMAT_BINARY && needMagic_) {
+        out_.append(logcodec::MAGIC, logcodec::MAGIC_LEN);
+        needMagic_ = false;
+    }
+    for(size_t i = 0; i < ringCnt; iov += segs[i], i++) {
+        if(segs[i] == 0) { continue; }
+        ForEachRecord(iov, segs[i], tmp, sizeof(tmp), [&](const char* rec, size_t len) {
+            if(*rec != logcodec::REC_LOG) {         // 切换格式前留下的文本行
+                out_.append(rec, len);
+                return;
+            }
+            logcodec::RecordHead head;
+            logcodec::ReadHead(rec, &head);
+            const logcodec::LogFormat* fmt = head.fmtId < MAX_FORMATS ? formats_[head.fmtId].get() : nullptr;
+            if(!fmt) { return; }
+            if(format == FORMAT_BINARY) {
+                if(!emitted_[head.fmtId]) {
+                    logcodec::MakeFormatRecord(head.fmtId, fmt->fmt, &out_);
+                    emitted_[head.fmtId] = true;
+                }
+                out_.append(rec, len);
+            } else {
+                logcodec::FormatRecord(*fmt, rec, len, &out_);
+            }
+        });
+    }
+}
+
+// 写出所有线程环形缓冲区中的数据，返回写出的字节数
+size_t Log::DrainRings_() {
+    return rings_.Drain([this](struct iovec* iov, int cnt, const int* segs, size_t ringCnt) {
+        lock_guard<mutex> locker(fileMtx_);
+        // 写之前切分：文件最多超出一批的大小，二进制格式的格式串定义写进新文件
+        RotateIfNeeded_();
+        if(IsDeferred()) {
+            EncodeBatch_(iov, segs, ringCnt);
+            if(out_.empty()) { return; }
+            struct iovec encoded = { &out_[0], out_.size() };
+            file_.Writev(&encoded, 1);
+        } else {
+            file_.Writev(iov, cnt);
+        }
+    });
 }
 
 // 异步写操作
 void Log::AsyncWrite_() {
-    string str = "";
-    while(deque_->pop(str)) {
-        lock_guard<mutex> locker(mtx_);
-        fputs(str.c_str(), fp_);
+    while(true) {
+        ReportDropped_();
+        if(DrainRings_() > 0) { continue; }
+        if(stop_) { break; }
+        {
+            lock_guard<mutex> locker(fileMtx_);
+            file_.Reap();
+        }
+        // 没有数据：休眠到被唤醒或超时
+        uint32_t seq = wake_.Prepare();
+        if(stop_) {
+            wake_.Cancel();
+            continue;
+        }
+        writerIdle_ = true;
+        wake_.Wait(seq, FLUSH_INTERVAL_MS);
+        writerIdle_ = false;
     }
 }
 
@@ -219,4 +381,4 @@ Log* Log::Instance() {
 // 异步线程
 void Log::FlushLogThread() {
     Log::Instance()->AsyncWrite_();
-}
\ No newline at end of file
+}
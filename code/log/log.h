@@ -2,74 +2,171 @@
  * @Author       : mark
  * @Date         : 2020-06-16
  * @copyleft Apache 2.0
- */ 
+ */
 #ifndef LOG_H
 #define LOG_H
 
 #include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
+#include <atomic>
+#include <memory>
 #include <sys/time.h>
 #include <string.h>
 #include <stdarg.h>           // vastart va_end
 #include <assert.h>
 #include <sys/stat.h>         //mkdir
-#include "blockqueue.h"
-#include "../buffer/buffer.h"
+#include "logring.h"
+#include "logfile.h"
+#include "logcodec.h"
+#include "../pool/futexevent.h"
+
+/* 编译期最低日志级别，低于它的日志调用在编译时被整体删除（make LOG_MIN_LEVEL=0 保留debug） */
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
+/* 日志所属模块，源文件在包含头文件之前定义 LOG_MODULE 即可归入对应模块 */
+#ifndef LOG_MODULE
+#define LOG_MODULE Log::MODULE_DEFAULT
+#endif
 
 class Log {
 public:
-    void init(int level, const char* path = "./log", 
+    enum MODULE {
+        MODULE_DEFAULT = 0,
+        MODULE_SERVER,
+        MODULE_HTTP,
+        MODULE_POOL,
+        MODULE_TIMER,
+        MODULE_NUM,
+    };
+    // 日志格式：文本 / 写线程格式化 / 二进制文件（用tools/logdecode还原），后两种只在异步模式下有效
+    enum FORMAT {
+        FORMAT_TEXT = 0,
+        FORMAT_DEFERRED,
+        FORMAT_BINARY,
+    };
+    // 环形缓冲区满（磁盘写不过来）时的处理：丢弃新日志 / 只等待高级别日志 / 全部等待
+    // 等待最多timeoutMs，超时后丢弃，请求线程不会被慢磁盘一直卡住
+    enum OVERFLOW {
+        OVERFLOW_DROP = 0,
+        OVERFLOW_DROP_BELOW,
+        OVERFLOW_BLOCK,
+    };
+
+    void init(int level, const char* path = "./log",
                 const char* suffix =".log",
-                int maxQueueCapacity = 1024);
+                int maxQueueCapacity = 1024,
+                int format = FORMAT_TEXT);
 
-    static Log* Instance();                         
+    static Log* Instance();
     static void FlushLogThread();
 
     void write(int level, const char *format,...);
     void flush();
 
+    // 延迟格式化：调用线程只记录格式串ID和原始参数
+    bool IsDeferred() const { return format_.load(std::memory_order_relaxed) != FORMAT_TEXT; }
+    int RegisterFormat(const char* format);     // 每个日志调用点注册一次，满了返回-1
+    template<class... Args>
+    void WriteBinary(int level, int fmtId, Args... args) {
+        char rec[LINE_MAX_LEN];
+        logcodec::Encoder enc(rec, sizeof(rec), formats_[fmtId].get());
+        struct timeval now = {0, 0};
+        gettimeofday(&now, nullptr);
+        enc.Begin(level, fmtId, (int64_t)now.tv_sec * 1000000 + now.tv_usec);
+        (enc.Add(args), ...);
+        PushRecord_(level, rec, enc.Finish());
+    }
+
     int GetLevel();
     void SetLevel(int level);
+    void SetModuleLevel(int module, int level);     // level < 0 表示跟随全局级别
     bool IsOpen() { return isOpen_; }
-    
+    // 切分：单个文件最大字节数，按时间切分的间隔（秒，0表示只按日期）
+    void SetRotation(size_t maxFileBytes, int intervalSec = 0);
+    // 保留：日志目录总大小上限（0不限），写完的文件是否在后台gzip压缩
+    void SetRetention(size_t diskBudget, bool compress = true);
+    // 溢出策略：OVERFLOW_DROP_BELOW时低于keepLevel的日志直接丢弃
+    void SetOverflowPolicy(int policy, int keepLevel = 2, int timeoutMs = 10);
+    uint64_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }    // 丢弃的日志条数
+    uint64_t Delayed() const { return delayed_.load(std::memory_order_relaxed); }    // 等待过的日志条数
+    void RingDepths(std::vector<size_t>* depths);   // 各线程环形缓冲区中待写出的字节数
+    // 日志宏使用：一次relaxed读，日志关闭时级别为LEVEL_OFF
+    int GetLevel(int module) const {
+        return moduleLevel_[module].load(std::memory_order_relaxed);
+    }
+
 private:
     Log();
-    void AppendLogLevelTitle_(int level);
     virtual ~Log();
     void AsyncWrite_();
+    void PushRecord_(int level, const char* data, size_t len);
+    void ReportDropped_();                  // 写线程：把新增的丢弃条数写进日志
+    void EncodeBatch_(const struct iovec* iov, const int* segs, size_t ringCnt);
+    size_t DrainRings_();                   // 写线程：写出所有线程的日志
+    // 以下持有fileMtx_时调用
+    void RotateIfNeeded_();
+    void FileOpened_();
+    void WakeWriter_();
+    void UpdateModuleLevels_();
 
 private:
-    static const int LOG_PATH_LEN = 256;    // 日志文件路径
-    static const int LOG_NAME_LEN = 256;    // 日志文件名长度
-    static const int MAX_LINES = 50000;     // 日志最大条数
+    static const int LINE_MAX_LEN = 1024;   // 单条日志最大长度（超出截断）
+    static const int RING_BYTES_PER_ITEM = 256; // 队列容量换算成字节：每条日志按256字节估计
+    static const int FLUSH_INTERVAL_MS = 50;    // 写线程空闲时最长等待时间
+    static const int OVERFLOW_TIMEOUT_MS = 10;  // 默认溢出等待时间
+    static const int LEVEL_OFF = 4;         // 比所有级别都高，全部过滤
+    static const int MAX_FORMATS = 4096;    // 可注册的格式串个数
+
+    LogFile file_;                          // 日志文件（按日期、大小和时间切分）
 
-    const char* path_;                      // 路径
-    const char* suffix_;                    
+    std::atomic<bool> isOpen_;
 
-    int MAX_LINES_;                        
+    std::atomic<int> level_;                // 全局级别
+    std::atomic<int> moduleOverride_[MODULE_NUM];   // 各模块单独设置的级别，-1为未设置
+    std::atomic<int> moduleLevel_[MODULE_NUM];      // 各模块生效的级别
+    std::atomic<bool> isAsync_;             // 是否异步
 
-    int lineCount_;                         //  记录当前日志的条数
-    int toDay_;                             // 当前日期                     
+    RingSet rings_;                         // 各线程的环形缓冲区
+    std::atomic<bool> stop_;                // 通知写线程退出
+    std::atomic<bool> writerIdle_;          // 写线程正在等待
+    FutexEvent wake_;                       // 唤醒写线程
 
-    bool isOpen_;
- 
-    Buffer buff_;                           // 缓冲区
-    int level_;                             // 级别                  
-    bool isAsync_;                          // 是否异步
+    std::atomic<int> overflow_;             // OVERFLOW
+    std::atomic<int> keepLevel_;
+    std::atomic<int> overflowTimeoutMs_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<uint64_t> delayed_;
+    uint64_t reported_;                     // 写线程已报告的丢弃条数
 
-    FILE* fp_;      // 文件描述符      
-    std::unique_ptr<BlockDeque<std::string>> deque_;    // 缓冲区
+    std::atomic<int> format_;               // FORMAT
+    std::unique_ptr<logcodec::LogFormat> formats_[MAX_FORMATS];    // 按ID索引的格式串，注册后不再修改
+    int formatCnt_;
+    std::mutex fmtMtx_;                     // 保护注册
+    std::vector<bool> emitted_;             // 二进制模式：当前文件已写出定义的格式串
+    bool needMagic_;                        // 二进制模式：当前文件为空，需要先写文件头
+    std::string out_;                       // 写线程：本批格式化/编码后的数据
     std::unique_ptr<std::thread> writeThread_;          // 写入线程
-    std::mutex mtx_;                                    // 互斥锁
+    std::mutex fileMtx_;                                // 文件锁：写线程/同步写/init
+    std::mutex mtx_;                                    // 互斥锁：修改级别
 };
 
 #define LOG_BASE(level, format, ...) \
     do {\
-        Log* log = Log::Instance();\
-        if (log->IsOpen() && log->GetLevel() <= level) {\
-            log->write(level, format, ##__VA_ARGS__); \
-            log->flush();\
+        if ((level) >= LOG_MIN_LEVEL) {\
+            Log* log = Log::Instance();\
+            if (log->GetLevel(LOG_MODULE) <= (level)) {\
+                if (log->IsDeferred()) {\
+                    static const int fmtId = log->RegisterFormat(format);\
+                    if (fmtId >= 0) { log->WriteBinary(level, fmtId, ##__VA_ARGS__); }\
+                    else { log->write(level, format, ##__VA_ARGS__); }\
+                } else {\
+                    log->write(level, format, ##__VA_ARGS__); \
+                }\
+            }\
         }\
     } while(0);
 
@@ -78,4 +175,4 @@ private:
 #define LOG_WARN(format, ...) do {LOG_BASE(2, format, ##__VA_ARGS__)} while(0);
 #define LOG_ERROR(format, ...) do {LOG_BASE(3, format, ##__VA_ARGS__)} while(0);
 
-#endif //LOG_H
\ No newline at end of file
+#endif //LOG_H
@@ -0,0 +1,256 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#include "logcodec.h"
+#include <cstdio>
+#include <cstdlib>
+#include <ctype.h>
+#include <time.h>
+#include <algorithm>
+
+namespace logcodec {
+
+static const size_t MAX_STR = 512;          // 单个字符串参数最多记录的字节数
+
+const char* LevelTitle(int level) {
+    static const char* TITLE[] = { "[debug]: ", "[info] : ", "[warn] : ", "[error]: " };
+    return (level >= 0 && level <= 3) ? TITLE[level] : TITLE[1];
+}
+
+// 解析格式串，记录每个参数对应的转换字符
+LogFormat::LogFormat(const char* format) : fmt(format) {
+    const char* p = format;
+    while(*p) {
+        if(*p++ != '%') { continue; }
+        if(*p == '%') { p++; continue; }
+        while(*p && strchr("-+ #0'", *p)) { p++; }         // 标志
+        if(*p == '*') { args.push_back({'*', -1}); p++; }   // 宽度
+        else { while(isdigit((unsigned char)*p)) { p++; } }
+        int limit = -1;
+        if(*p == '.') {                                     // 精度
+            p++;
+            if(*p == '*') { args.push_back({'*', -1}); limit = -2; p++; }
+            else { limit = atoi(p); while(isdigit((unsigned char)*p)) { p++; } }
+        }
+        while(*p && strchr("hlLqjzt", *p)) { p++; }         // 长度修饰
+        if(!*p) { break; }
+        char conv = *p++;
+        args.push_back({conv, conv == 's' ? limit : -1});
+    }
+}
+
+void Encoder::Begin(int level, uint32_t fmtId, int64_t usec) {
+    buf_[0] = REC_LOG;
+    buf_[1] = (char)level;
+    memcpy(buf_ + 4, &fmtId, sizeof(fmtId));
+    memcpy(buf_ + 8, &usec, sizeof(usec));
+    pos_ = HEAD_LEN;
+}
+
+size_t Encoder::Finish() {
+    uint16_t len = (uint16_t)pos_;
+    memcpy(buf_ + 2, &len, sizeof(len));
+    return pos_;
+}
+
+// 字符串按格式串中的精度截断，%.*s 不会越界读取未以'\0'结尾的数据
+void Encoder::Str_(const char* s) {
+    size_t limit = MAX_STR;
+    if(fmt_ && index_ < fmt_->args.size() && fmt_->args[index_].conv == 's') {
+        int l = fmt_->args[index_].strLimit;
+        if(l == -2 && lastInt_ >= 0 && (size_t)lastInt_ < limit) { limit = lastInt_; }
+        else if(l >= 0 && (size_t)l < limit) { limit = l; }
+    }
+    size_t len = 0;
+    if(s) { len = strnlen(s, limit); }
+    else { s = "(null)"; len = 6; }
+    if(pos_ + 3 > size_) { return; }
+    len = std::min(len, size_ - pos_ - 3);
+    uint16_t len16 = (uint16_t)len;
+    buf_[pos_++] = 's';
+    memcpy(buf_ + pos_, &len16, sizeof(len16));
+    pos_ += sizeof(len16);
+    memcpy(buf_ + pos_, s, len);
+    pos_ += len;
+}
+
+void ReadHead(const char* p, RecordHead* head) {
+    head->type = p[0];
+    head->level = (unsigned char)p[1];
+    memcpy(&head->len, p + 2, sizeof(head->len));
+    memcpy(&head->fmtId, p + 4, sizeof(head->fmtId));
+    memcpy(&head->usec, p + 8, sizeof(head->usec));
+}
+
+size_t MakeFormatRecord(uint32_t fmtId, const std::string& fmt, std::string* out) {
+    size_t fmtLen = std::min(fmt.size(), (size_t)UINT16_MAX - HEAD_LEN);
+    uint16_t len = (uint16_t)(HEAD_LEN + fmtLen);
+    int64_t zero = 0;
+    char head[HEAD_LEN];
+    head[0] = REC_FORMAT;
+    head[1] = 0;
+    memcpy(head + 2, &len, sizeof(len));
+    memcpy(head + 4, &fmtId, sizeof(fmtId));
+    memcpy(head + 8, &zero, sizeof(zero));
+    out->append(head, HEAD_LEN);
+    out->append(fmt.data(), fmtLen);
+    return len;
+}
+
+void AppendTimestamp(int64_t usec, std::string* out) {
+    // 同一秒内复用已格式化的前缀
+    static thread_local time_t lastSec = -1;
+    static thread_local char prefix[32];
+    static thread_local int prefixLen = 0;
+    time_t sec = usec / 1000000;
+    if(sec != lastSec) {
+        struct tm t;
+        localtime_r(&sec, &t);
+        prefixLen = snprintf(prefix, sizeof(prefix), "%d-%02d-%02d %02d:%02d:%02d.",
+                    t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec);
+        lastSec = sec;
+    }
+    char us[8];
+    long u = usec % 1000000;
+    for(int i = 5; i >= 0; i--, u /= 10) {
+        us[i] = '0' + u % 10;
+    }
+    us[6] = ' ';
+    out->append(prefix, prefixLen);
+    out->append(us, 7);
+}
+
+/* 顺序读取编码后的参数 */
+struct ArgReader {
+    const char* p;
+    const char* end;
+    char tag;
+    int64_t i;
+    uint64_t u;
+    double d;
+    const char* s;
+    size_t slen;
+
+    bool Next() {
+        if(p >= end) { return false; }
+        tag = *p++;
+        switch(tag) {
+        case 'i': if(end - p < 8) { return false; } memcpy(&i, p, 8); p += 8; u = i; d = i; break;
+        case 'u': case 'p':
+                  if(end - p < 8) { return false; } memcpy(&u, p, 8); p += 8; i = u; d = u; break;
+        case 'd': if(end - p < 8) { return false; } memcpy(&d, p, 8); p += 8; i = (int64_t)d; u = i; break;
+        case 's': {
+            uint16_t len;
+            if(end - p < 2) { return false; }
+            memcpy(&len, p, 2);
+            p += 2;
+            if((size_t)(end - p) < len) { return false; }
+            s = p;
+            slen = len;
+            p += len;
+            break;
+        }
+        default:
+            return false;
+        }
+        return true;
+    }
+};
+
+void FormatRecord(const LogFormat& fmt, const char* rec, size_t len, std::string* out) {
+    RecordHead head;
+    ReadHead(rec, &head);
+    AppendTimestamp(head.usec, out);
+    out->append(LevelTitle(head.level), LEVEL_TITLE_LEN);
+
+    ArgReader args = { rec + HEAD_LEN, rec + len, 0, 0, 0, 0, nullptr, 0 };
+    char spec[64];
+    char tmp[1024];
+    const char* f = fmt.fmt.c_str();
+    while(*f) {
+        if(*f != '%') {
+            const char* q = strchr(f, '%');
+            if(!q) { q = f + strlen(f); }
+            out->append(f, q - f);
+            f = q;
+            continue;
+        }
+        if(f[1] == '%') { out->push_back('%'); f += 2; continue; }
+
+        // 重新拼出转换说明：'*'替换成实际数值，长度修饰统一成与编码类型一致
+        const char* start = f++;
+        int n = 0;
+        spec[n++] = '%';
+        while(*f && strchr("-+ #0'", *f) && n < 16) { spec[n++] = *f++; }
+        bool ok = true;
+        if(*f == '*') {
+            f++;
+            ok = args.Next();
+            if(ok) { n += snprintf(spec + n, 16, "%d", (int)args.i); }
+        } else {
+            while(isdigit((unsigned char)*f) && n < 32) { spec[n++] = *f++; }
+        }
+        int prec = -1;
+        if(*f == '.') {
+            f++;
+            if(*f == '*') {
+                f++;
+                ok = ok && args.Next();
+                if(ok) { prec = (int)args.i; }
+            } else {
+                prec = atoi(f);
+                while(isdigit((unsigned char)*f)) { f++; }
+            }
+        }
+        while(*f && strchr("hlLqjzt", *f)) { f++; }
+        if(!*f) { out->append(start); break; }
+        char conv = *f++;
+        if(conv == 'n') { continue; }
+        if(!ok || !args.Next()) {           // 参数不够：原样输出
+            out->append(start, f - start);
+            continue;
+        }
+
+        int m = 0;
+        if(args.tag == 's' || conv == 's') {
+            if(args.tag == 's') {
+                memcpy(spec + n, ".*s", 4);
+                m = snprintf(tmp, sizeof(tmp), spec, (int)args.slen, args.s);
+            } else {
+                m = snprintf(tmp, sizeof(tmp), "%lld", (long long)args.i);
+            }
+        } else {
+            if(prec >= 0) { n += snprintf(spec + n, 16, ".%d", prec); }
+            switch(conv) {
+            case 'd': case 'i':
+                memcpy(spec + n, "ll", 2); spec[n + 2] = conv; spec[n + 3] = '\0';
+                m = snprintf(tmp, sizeof(tmp), spec, (long long)args.i);
+                break;
+            case 'u': case 'o': case 'x': case 'X':
+                memcpy(spec + n, "ll", 2); spec[n + 2] = conv; spec[n + 3] = '\0';
+                m = snprintf(tmp, sizeof(tmp), spec, (unsigned long long)args.u);
+                break;
+            case 'c':
+                spec[n] = 'c'; spec[n + 1] = '\0';
+                m = snprintf(tmp, sizeof(tmp), spec, (int)args.i);
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                spec[n] = conv; spec[n + 1] = '\0';
+                m = snprintf(tmp, sizeof(tmp), spec, args.d);
+                break;
+            case 'p':
+                m = snprintf(tmp, sizeof(tmp), "%p", (void*)(uintptr_t)args.u);
+                break;
+            default:
+                out->append(start, f - start);
+                break;
+            }
+        }
+        if(m > 0) { out->append(tmp, std::min((size_t)m, sizeof(tmp) - 1)); }
+    }
+    out->push_back('\n');
+}
+
+} // namespace logcodec
@@ -0,0 +1,113 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#ifndef LOGCODEC_H
+#define LOGCODEC_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+
+/* 二进制日志的编解码：调用线程只记录格式串ID和原始参数，
+   由写线程或离线工具(tools/logdecode)再格式化成文本
+
+   记录布局（本机字节序）：
+     'L' level(1) len(2) fmtId(4) usec(8) 参数...     一条日志
+     'F' 0(1)     len(2) fmtId(4) 格式串...           格式串定义，先于使用它的日志写入文件
+   参数：'i' int64 | 'u' uint64 | 'd' double | 'p' uint64 | 's' len(2) 字节... */
+
+namespace logcodec {
+
+const char MAGIC[] = "WSBLOG01";            // 二进制日志文件头
+const size_t MAGIC_LEN = 8;
+const size_t HEAD_LEN = 16;                 // 记录头长度
+const char REC_LOG = 'L';
+const char REC_FORMAT = 'F';
+
+const char* LevelTitle(int level);          // "[info] : "
+const int LEVEL_TITLE_LEN = 9;
+
+/* 格式串中的一个转换说明，如 %05.2f */
+struct ArgSpec {
+    char conv;          // 转换字符：d i u x c f s p ... ；'*'表示宽度/精度参数
+    int strLimit;       // %s 的最大长度：-1 不限，-2 取前一个参数，>=0 字面精度
+};
+
+/* 解析好的格式串，注册后不再修改，可被多个线程同时读取 */
+struct LogFormat {
+    std::string fmt;
+    std::vector<ArgSpec> args;
+    explicit LogFormat(const char* format);
+};
+
+/* 把一条日志的参数编码进定长缓冲区，超出部分截断 */
+class Encoder {
+public:
+    Encoder(char* buf, size_t size, const LogFormat* fmt) :
+        buf_(buf), size_(size), pos_(HEAD_LEN), fmt_(fmt), index_(0), lastInt_(-1) {}
+
+    void Begin(int level, uint32_t fmtId, int64_t usec);
+    size_t Finish();        // 填写记录长度，返回记录总长度
+
+    template<class T>
+    void Add(T v) {
+        if constexpr (std::is_same<T, const char*>::value || std::is_same<T, char*>::value) {
+            Str_(v);
+        } else if constexpr (std::is_pointer<T>::value) {
+            Tag_('p', (uint64_t)(uintptr_t)v);
+        } else if constexpr (std::is_floating_point<T>::value) {
+            Tag_('d', (double)v);
+        } else if constexpr (std::is_enum<T>::value) {
+            Tag_('i', (int64_t)v);
+            lastInt_ = (int64_t)v;
+        } else if constexpr (std::is_integral<T>::value && std::is_signed<T>::value) {
+            Tag_('i', (int64_t)v);
+            lastInt_ = (int64_t)v;
+        } else {
+            static_assert(std::is_integral<T>::value, "unsupported log argument");
+            Tag_('u', (uint64_t)v);
+            lastInt_ = (int64_t)v;
+        }
+        index_++;
+    }
+
+private:
+    template<class V>
+    void Tag_(char tag, V v) {
+        if(pos_ + 1 + sizeof(v) > size_) { return; }
+        buf_[pos_++] = tag;
+        memcpy(buf_ + pos_, &v, sizeof(v));
+        pos_ += sizeof(v);
+    }
+    void Str_(const char* s);
+
+    char* buf_;
+    size_t size_;
+    size_t pos_;
+    const LogFormat* fmt_;
+    size_t index_;          // 当前是第几个参数
+    int64_t lastInt_;       // 上一个整数参数（%.*s 的精度）
+};
+
+/* 解码：读记录头 */
+struct RecordHead {
+    char type;
+    int level;
+    uint16_t len;
+    uint32_t fmtId;
+    int64_t usec;
+};
+void ReadHead(const char* p, RecordHead* head);
+size_t MakeFormatRecord(uint32_t fmtId, const std::string& fmt, std::string* out);  // 追加'F'记录
+
+/* 把一条'L'记录格式化成与文本日志相同的一行（含'\n'），追加到out */
+void FormatRecord(const LogFormat& fmt, const char* rec, size_t len, std::string* out);
+void AppendTimestamp(int64_t usec, std::string* out);   // 2020-06-16 12:00:00.000000
+
+} // namespace logcodec
+
+#endif // LOGCODEC_H
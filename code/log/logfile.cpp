@@ -0,0 +1,234 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#include "logfile.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+
+extern char** environ;
+
+using namespace std;
+
+LogFile::LogFile() {
+    fd_ = -1;
+    toDay_ = 0;
+    seq_ = 0;
+    openTime_ = 0;
+    fileBytes_ = 0;
+    maxFileBytes_ = MAX_FILE_BYTES;
+    rotateSec_ = 0;
+    diskBudget_ = DISK_BUDGET;
+    compress_ = true;
+}
+
+// 关闭文件；剩下的文件交给gzip后不再等待
+LogFile::~LogFile() {
+    if(fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    while(!pendingCompress_.empty()) {
+        Compress_(pendingCompress_.front());
+        pendingCompress_.pop_front();
+    }
+}
+
+bool LogFile::Open(const string& dir, const string& prefix, const string& suffix) {
+    time_t timer = time(nullptr);
+    struct tm t;
+    localtime_r(&timer, &t);
+    char fileName[LOG_NAME_LEN] = {0};
+    snprintf(fileName, LOG_NAME_LEN - 1, "%s/%s%04d_%02d_%02d%s", dir.c_str(), prefix.c_str(),
+            t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, suffix.c_str());
+
+    int oldFd = fd_;
+    if(!OpenFile_(fileName)) {
+        mkdir(dir.c_str(), 0777);
+        if(!OpenFile_(fileName)) { return false; }
+    }
+    if(oldFd >= 0) { close(oldFd); }
+    dir_ = dir;
+    prefix_ = prefix;
+    suffix_ = suffix;
+    toDay_ = t.tm_mday;
+    seq_ = 0;
+    return true;
+}
+
+void LogFile::SetRotation(size_t maxFileBytes, int intervalSec) {
+    maxFileBytes_ = maxFileBytes;
+    rotateSec_ = intervalSec;
+}
+
+void LogFile::SetRetention(size_t diskBudget, bool compress) {
+    diskBudget_ = diskBudget;
+    compress_ = compress;
+}
+
+ssize_t LogFile::Write(const char* data, size_t len) {
+    ssize_t n = ::write(fd_, data, len);
+    if(n > 0) { fileBytes_ += n; }
+    return n;
+}
+
+size_t LogFile::Writev(struct iovec* iov, int cnt) {
+    size_t total = 0;
+    while(cnt > 0) {
+        ssize_t len = writev(fd_, iov, cnt);
+        if(len < 0) {
+            if(errno == EINTR) { continue; }
+            break;          // 磁盘错误：丢弃本批，避免写线程空转
+        }
+        fileBytes_ += len;
+        total += len;
+        while(cnt > 0 && (size_t)len >= iov->iov_len) {
+            len -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if(cnt > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + len;
+            iov->iov_len -= len;
+        }
+    }
+    return total;
+}
+
+bool LogFile::RotateIfNeeded() {
+    if(fd_ < 0) { return false; }
+    time_t timer = time(nullptr);
+    struct tm t;
+    localtime_r(&timer, &t);
+
+    bool newDay = toDay_ != t.tm_mday;
+    bool full = fileBytes_ > 0 && fileBytes_ >= maxFileBytes_;
+    bool expired = rotateSec_ > 0 && fileBytes_ > 0 && timer - openTime_ >= rotateSec_;
+    if(!newDay && !full && !expired) { return false; }
+
+    char newFile[LOG_NAME_LEN];
+    char tail[36] = {0};
+    snprintf(tail, 36, "%04d_%02d_%02d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);    // 年_月_日
+
+    // 日期变化
+    if(newDay) {
+        snprintf(newFile, LOG_NAME_LEN, "%s/%s%s%s", dir_.c_str(), prefix_.c_str(), tail, suffix_.c_str());
+        toDay_ = t.tm_mday;
+        seq_ = 0;
+    }
+    // 大小或时间：跳过已存在（包括已压缩）的文件名
+    else {
+        char gzFile[LOG_NAME_LEN + 4];
+        do {
+            snprintf(newFile, LOG_NAME_LEN, "%s/%s%s-%d%s", dir_.c_str(), prefix_.c_str(), tail,
+                    ++seq_, suffix_.c_str());
+            snprintf(gzFile, sizeof(gzFile), "%s.gz", newFile);
+        } while(access(newFile, F_OK) == 0 || access(gzFile, F_OK) == 0);
+    }
+
+    int oldFd = fd_;
+    string oldFile = curFile_;
+    if(!OpenFile_(newFile)) { return false; }
+    close(oldFd);
+    if(compress_) {
+        pendingCompress_.push_back(oldFile);
+        Reap();
+    }
+    EnforceBudget_();
+    return true;
+}
+
+// 打开失败时保持原来的文件
+bool LogFile::OpenFile_(const char* fileName) {
+    int fd = open(fileName, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0) { return false; }
+    fd_ = fd;
+    curFile_ = fileName;
+    openTime_ = time(nullptr);
+    off_t size = lseek(fd_, 0, SEEK_END);
+    fileBytes_ = size > 0 ? size : 0;
+    return true;
+}
+
+// 用gzip压缩写完的文件，不依赖zlib；子进程由Reap回收
+void LogFile::Compress_(const string& file) {
+    char* argv[] = { (char*)"gzip", (char*)"-f", (char*)"-q", (char*)file.c_str(), nullptr };
+    pid_t pid;
+    if(posix_spawnp(&pid, "gzip", nullptr, nullptr, argv, environ) == 0) {
+        compressors_.emplace_back(pid, file);
+    }
+}
+
+// 回收结束的gzip进程并启动排队的压缩任务
+void LogFile::Reap() {
+    bool done = false;
+    for(size_t i = 0; i < compressors_.size();) {
+        if(waitpid(compressors_[i].first, nullptr, WNOHANG) != 0) {
+            compressors_[i] = compressors_.back();
+            compressors_.pop_back();
+            done = true;
+        } else {
+            i++;
+        }
+    }
+    while(!pendingCompress_.empty() && compressors_.size() < (size_t)MAX_COMPRESSORS) {
+        Compress_(pendingCompress_.front());
+        pendingCompress_.pop_front();
+    }
+    // 压缩后文件变小，重新计算占用
+    if(done) { EnforceBudget_(); }
+}
+
+// 目录超过上限时从最旧的文件开始删除，当前文件除外
+void LogFile::EnforceBudget_() {
+    if(diskBudget_ == 0) { return; }
+    DIR* dir = opendir(dir_.c_str());
+    if(!dir) { return; }
+    vector<pair<time_t, pair<string, size_t>>> files;
+    size_t total = 0;
+    struct dirent* ent;
+    while((ent = readdir(dir))) {
+        // 只处理本日志生成的文件：前缀之后是年_月_日且带后缀名（同一目录下的其他日志不算在内）
+        const char* name = ent->d_name;
+        size_t p = prefix_.size();
+        if(strlen(name) < p + 10 || prefix_.compare(0, p, name, p) != 0 ||
+            !isdigit((unsigned char)name[p]) || name[p + 4] != '_' || name[p + 7] != '_'
+            || !strstr(name + p, suffix_.c_str())) {
+            continue;
+        }
+        string file = dir_ + "/" + name;
+        struct stat st;
+        if(stat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) { continue; }
+        total += st.st_size;
+        if(file != curFile_) {
+            files.push_back({st.st_mtime, {file, (size_t)st.st_size}});
+        }
+    }
+    closedir(dir);
+    if(total <= diskBudget_) { return; }
+
+    sort(files.begin(), files.end());
+    for(auto& f : files) {
+        if(total <= diskBudget_) { break; }
+        // 正在压缩或排队的文件（包括未写完的.gz）等gzip结束后再处理
+        const string& file = f.second.first;
+        auto busy = [&file](const string& name) { return file.compare(0, name.size(), name) == 0; };
+        if(any_of(pendingCompress_.begin(), pendingCompress_.end(), busy) ||
+            any_of(compressors_.begin(), compressors_.end(),
+                [&busy](const pair<pid_t, string>& c) { return busy(c.second); })) {
+            continue;
+        }
+        if(unlink(f.second.first.c_str()) == 0) {
+            total -= f.second.second;
+        }
+    }
+}
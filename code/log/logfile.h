@@ -0,0 +1,72 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#ifndef LOGFILE_H
+#define LOGFILE_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* 按日期命名的日志文件：dir/prefix年_月_日suffix，超过大小或时间间隔时切分为 -1、-2…
+   写完的文件在后台gzip压缩，目录中本前缀的文件总大小超过上限时从最旧的开始删除
+   不加锁，由使用者（Log、AccessLog）在自己的文件锁内调用 */
+class LogFile {
+public:
+    LogFile();
+    ~LogFile();
+
+    // 目录不存在时创建；失败时返回false，原来的文件保持打开
+    bool Open(const std::string& dir, const std::string& prefix, const std::string& suffix);
+    bool IsOpen() const { return fd_ >= 0; }
+    int Fd() const { return fd_; }
+    size_t Bytes() const { return fileBytes_; }     // 当前文件大小
+    const std::string& Name() const { return curFile_; }
+
+    // 切分：单个文件最大字节数，按时间切分的间隔（秒，0表示只按日期）
+    void SetRotation(size_t maxFileBytes, int intervalSec = 0);
+    // 保留：目录总大小上限（0不限），写完的文件是否在后台gzip压缩
+    void SetRetention(size_t diskBudget, bool compress = true);
+
+    // 按日期、大小和时间切分，换了新文件时返回true
+    bool RotateIfNeeded();
+    // 回收结束的gzip进程，写线程空闲时调用
+    void Reap();
+
+    ssize_t Write(const char* data, size_t len);
+    // 处理部分写入，直到全部写完或出错；返回写出的字节数
+    size_t Writev(struct iovec* iov, int cnt);
+
+private:
+    static const int LOG_NAME_LEN = 256;
+    static const size_t MAX_FILE_BYTES = 64 << 20;  // 默认单个文件大小
+    static const size_t DISK_BUDGET = 1UL << 30;    // 默认目录总大小
+    static const int MAX_COMPRESSORS = 2;           // 同时运行的gzip进程数
+
+    bool OpenFile_(const char* fileName);
+    void Compress_(const std::string& file);
+    void EnforceBudget_();
+
+    std::string dir_;
+    std::string prefix_;
+    std::string suffix_;
+    int fd_;
+    int toDay_;                             // 当前日期
+    int seq_;                               // 当天的第几个文件
+    time_t openTime_;                       // 当前文件打开时间
+    size_t fileBytes_;
+    std::string curFile_;
+    size_t maxFileBytes_;
+    int rotateSec_;
+    size_t diskBudget_;
+    bool compress_;
+    std::vector<std::pair<pid_t, std::string>> compressors_;    // 运行中的gzip进程及其文件
+    std::deque<std::string> pendingCompress_;   // 等待压缩的文件
+};
+
+#endif // LOGFILE_H
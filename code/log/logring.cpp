@@ -0,0 +1,76 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#include "logring.h"
+#include <unistd.h>
+
+using namespace std;
+
+// 线程退出时把各登记表中的缓冲区交给写线程回收
+struct LocalRings {
+    shared_ptr<LogRing> ring[RingSet::MAX_SETS];
+    ~LocalRings() {
+        for(auto& r : ring) {
+            if(r) { r->Detach(); }
+        }
+    }
+};
+static thread_local LocalRings tlsRings;
+static atomic<int> setCount(0);
+
+RingSet::RingSet(size_t ringBytes) : slot_(setCount++), ringBytes_(ringBytes) {
+    assert(slot_ < MAX_SETS);
+}
+
+void RingSet::SetRingBytes(size_t ringBytes) {
+    ringBytes_.store(ringBytes, memory_order_relaxed);
+}
+
+LogRing* RingSet::Local() {
+    shared_ptr<LogRing>& ring = tlsRings.ring[slot_];
+    if(!ring) {
+        ring = make_shared<LogRing>(ringBytes_.load(memory_order_relaxed));
+        lock_guard<mutex> locker(mtx_);
+        rings_.push_back(ring);
+    }
+    return ring.get();
+}
+
+// 回收已退出线程的空缓冲区，取出本次要处理的缓冲区
+void RingSet::Snapshot_() {
+    lock_guard<mutex> locker(mtx_);
+    for(size_t i = 0; i < rings_.size();) {
+        if(rings_[i]->Detached() && rings_[i]->Size() == 0) {
+            rings_[i] = rings_.back();
+            rings_.pop_back();
+        } else {
+            i++;
+        }
+    }
+    drainRings_ = rings_;
+}
+
+void RingSet::WaitDrained(FutexEvent* wake) {
+    vector<pair<shared_ptr<LogRing>, size_t>> pending;
+    {
+        lock_guard<mutex> locker(mtx_);
+        for(auto& ring : rings_) {
+            pending.emplace_back(ring, ring->Written());
+        }
+    }
+    for(auto& item : pending) {
+        while(item.first->Consumed() < item.second) {
+            wake->Notify();
+            usleep(100);
+        }
+    }
+}
+
+void RingSet::Depths(vector<size_t>* depths) {
+    lock_guard<mutex> locker(mtx_);
+    for(auto& ring : rings_) {
+        depths->push_back(ring->Size());
+    }
+}
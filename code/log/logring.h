@@ -0,0 +1,155 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#ifndef LOGRING_H
+#define LOGRING_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <sys/uio.h>
+#include <assert.h>
+#include "../pool/futexevent.h"
+
+/* 单生产者单消费者的字节环形缓冲区
+   生产者：产生日志的线程（每个线程一个）；消费者：日志写线程
+   head_/tail_ 只增不减，取模得到下标，容量为2的幂 */
+class LogRing {
+public:
+    explicit LogRing(size_t capacity) : capacity_(RoundUp_(capacity)), mask_(capacity_ - 1),
+        buf_(new char[capacity_]), head_(0), tail_(0), detached_(false) {}
+
+    size_t Capacity() const { return capacity_; }
+
+    // 已写入未消费的字节数
+    size_t Size() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+    // 累计写入/消费的字节数
+    size_t Written() const { return head_.load(std::memory_order_acquire); }
+    size_t Consumed() const { return tail_.load(std::memory_order_acquire); }
+
+    // 生产者：空间不足时返回false，不会写入半条记录
+    bool Push(const char* data, size_t len) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t tail = tail_.load(std::memory_order_acquire);
+        if(capacity_ - (head - tail) < len) { return false; }
+        size_t pos = head & mask_;
+        size_t first = std::min(len, capacity_ - pos);
+        memcpy(buf_.get() + pos, data, first);
+        memcpy(buf_.get(), data + first, len - first);
+        head_.store(head + len, std::memory_order_release);
+        return true;
+    }
+
+    // 消费者：取出所有可读数据，回绕时分成两段
+    int Peek(struct iovec iov[2]) const {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t head = head_.load(std::memory_order_acquire);
+        size_t len = head - tail;
+        if(len == 0) { return 0; }
+        size_t pos = tail & mask_;
+        size_t first = std::min(len, capacity_ - pos);
+        iov[0].iov_base = buf_.get() + pos;
+        iov[0].iov_len = first;
+        if(first == len) { return 1; }
+        iov[1].iov_base = buf_.get();
+        iov[1].iov_len = len - first;
+        return 2;
+    }
+
+    // 消费者：释放已写出的数据
+    void Consume(size_t len) {
+        assert(len <= Size());
+        tail_.store(tail_.load(std::memory_order_relaxed) + len, std::memory_order_release);
+    }
+
+    // 所属线程已退出，写线程读完后回收
+    void Detach() { detached_.store(true, std::memory_order_release); }
+    bool Detached() const { return detached_.load(std::memory_order_acquire); }
+
+private:
+    static size_t RoundUp_(size_t n) {
+        size_t cap = 1;
+        while(cap < n) { cap <<= 1; }
+        return cap;
+    }
+
+    const size_t capacity_;
+    const size_t mask_;
+    std::unique_ptr<char[]> buf_;
+    alignas(64) std::atomic<size_t> head_;      // 写位置（生产者）
+    alignas(64) std::atomic<size_t> tail_;      // 读位置（消费者）
+    std::atomic<bool> detached_;
+};
+
+/* 各线程环形缓冲区的登记表（Log和AccessLog各一个）
+   每个线程第一次写入时建立自己的缓冲区，线程退出后由写线程读完再回收
+   Drain把所有缓冲区的数据按批交给写函数：每个缓冲区最多占两个iov，每批最多MAX_IOV/2个缓冲区 */
+class RingSet {
+public:
+    static const int MAX_IOV = 1024;
+    static const int MAX_SETS = 4;          // 进程内RingSet的个数上限（线程局部存储按下标索引）
+
+    explicit RingSet(size_t ringBytes);
+
+    void SetRingBytes(size_t ringBytes);    // 之后新建的缓冲区大小
+    LogRing* Local();                       // 当前线程的缓冲区
+
+    // 写线程：write(iov, cnt, segs, ringCnt)写出一批，segs[i]为这一批第i个缓冲区占的iov个数
+    // 写完释放这一批的数据，返回取出的字节数
+    template<class Write>
+    size_t Drain(Write write);
+
+    // 等待调用前已写入的数据全部被写线程取走
+    void WaitDrained(FutexEvent* wake);
+    void Depths(std::vector<size_t>* depths);     // 各缓冲区中待写出的字节数
+
+private:
+    void Snapshot_();
+
+    int slot_;
+    std::atomic<size_t> ringBytes_;
+    std::vector<std::shared_ptr<LogRing>> rings_;       // 所有线程的缓冲区
+    std::vector<std::shared_ptr<LogRing>> drainRings_;  // 写线程本次处理的缓冲区
+    std::mutex mtx_;                        // 保护rings_（只在线程第一次写入时加锁）
+};
+
+template<class Write>
+size_t RingSet::Drain(Write write) {
+    Snapshot_();
+    size_t total = 0;
+    for(size_t first = 0; first < drainRings_.size(); first += MAX_IOV / 2) {
+        size_t ringCnt = std::min(drainRings_.size() - first, (size_t)MAX_IOV / 2);
+        struct iovec iov[MAX_IOV];
+        size_t taken[MAX_IOV / 2] = {0};       // 每个缓冲区本批取出的字节数
+        int segs[MAX_IOV / 2] = {0};           // 每个缓冲区占用的iov个数
+        int cnt = 0;
+        size_t bytes = 0;
+        for(size_t i = 0; i < ringCnt; i++) {
+            int k = drainRings_[first + i]->Peek(iov + cnt);
+            segs[i] = k;
+            for(int j = 0; j < k; j++) {
+                taken[i] += iov[cnt + j].iov_len;
+            }
+            cnt += k;
+            bytes += taken[i];
+        }
+        if(bytes == 0) { continue; }
+        write(iov, cnt, segs, ringCnt);
+        for(size_t i = 0; i < ringCnt; i++) {
+            if(taken[i]) { drainRings_[first + i]->Consume(taken[i]); }
+        }
+        total += bytes;
+    }
+    drainRings_.clear();
+    return total;
+}
+
+#endif // LOGRING_H
@@ -10,10 +10,29 @@ int main() {
     /* 守护进程 后台运行 */
     //daemon(1, 0); 
 
+    ServerConfig config;
+    config.chainBuffer = false;         /* 链式读缓冲区 */
+    config.logFormat = 0;               /* 日志格式(0文本 1写线程格式化 2二进制) */
+    config.accessLogFormat = 1;         /* 访问日志格式(-1关闭 0CLF 1Combined 2JSON) */
+    config.accessLogSample = 1;         /* 访问日志采样(每n个请求记录一个) */
+    config.statsIntervalMs = 1000;      /* 共享内存统计发布间隔ms(0关闭) */
+    config.authCacheSec = 300;          /* 登录缓存有效期s(0关闭) */
+    config.authCacheMB = 4;             /* 登录缓存内存上限MB */
+    config.sessionSec = 1800;           /* 登录会话有效期s(0关闭) */
+    config.sqlMinConn = 4;              /* 数据库最小连接数(-1固定为连接池数量) */
+    config.sqlWaitMs = 1000;            /* 取连接等待上限ms */
+    config.authBackend = 0;             /* 用户表(0 MySQL 1本地文件) */
+    config.authFile = "./auth.db";      /* 本地用户文件 */
+    config.regBatchUs = 0;              /* 注册组提交窗口us(0为不定时等待) */
+    config.regBatchMax = 32;            /* 每批最多注册数 */
+    config.sqlReplicas = "";            /* 只读副本(host:port逗号分隔 空为不用) */
+    config.sqlPinMs = 5000;             /* 注册后读主库的时间ms */
+
     WebServer server(
         5050, 3, 60000, false,              /* 端口 ET模式 timeoutMs 优雅退出  */
         3306, "root", "123456", "webserver",    /* Mysql配置 */
-        12, 6, true, 1, 1024);              /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        12, 6, true, 1, 1024,               /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        config);
     server.Start();
 } 
   
\ No newline at end of file
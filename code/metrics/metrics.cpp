@@ -0,0 +1,284 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-20
+ * @copyleft Apache 2.0
+ */
+#include "metrics.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+static const char* COUNTER_NAME[] = {
+    "accepts", "requests", "responses_2xx", "responses_3xx", "responses_4xx", "responses_5xx",
+    "bytes_received", "bytes_sent", "epoll_wakeups", "tasks_queued",
+    "timer_expired", "sql_waits", "sql_timeouts", "sql_connect_errors", "sql_broken",
+    "auth_cache_hits", "auth_cache_misses", "auth_cache_evictions",
+    "register_batches", "register_rows",
+    "sql_replica_reads", "sql_pinned_reads", "sql_replica_fallbacks",
+};
+static const char* LEVEL_NAME[] = { "reading", "active", "writing", "db" };
+static const char* HIST_NAME[] = { "parse", "response", "request", "verify", "sql_acquire", "sql_in_use" };
+static_assert(sizeof(COUNTER_NAME) / sizeof(COUNTER_NAME[0]) == Metrics::COUNTER_NUM, "counter names");
+static_assert(sizeof(LEVEL_NAME) / sizeof(LEVEL_NAME[0]) == Metrics::LEVEL_NUM, "level names");
+static_assert(sizeof(HIST_NAME) / sizeof(HIST_NAME[0]) == Metrics::HIST_NUM, "histogram names");
+
+// 线程退出时归还分片
+struct ShardHolder {
+    Metrics::Shard* shard = nullptr;
+    ~ShardHolder() {
+        if(shard) {
+            lock_guard<mutex> locker(Metrics::Mtx_());
+            shard->inUse = false;
+        }
+    }
+};
+static thread_local ShardHolder tlsShard;
+
+mutex& Metrics::Mtx_() {
+    static mutex* mtx = new mutex;
+    return *mtx;
+}
+
+vector<Metrics::Shard*>& Metrics::Shards_() {
+    static vector<Shard*>* shards = new vector<Shard*>;
+    return *shards;
+}
+
+vector<Metrics::Gauge>& Metrics::Gauges_() {
+    static vector<Gauge>* gauges = new vector<Gauge>;
+    return *gauges;
+}
+
+Metrics::Shard* Metrics::ThreadShard_() {
+    if(tlsShard.shard) { return tlsShard.shard; }
+    lock_guard<mutex> locker(Mtx_());
+    for(Shard* shard : Shards_()) {
+        if(!shard->inUse) {
+            shard->inUse = true;
+            tlsShard.shard = shard;
+            return shard;
+        }
+    }
+    Shard* shard = new Shard();     // 值初始化：计数全部为0
+    shard->inUse = true;
+    Shards_().push_back(shard);
+    tlsShard.shard = shard;
+    return shard;
+}
+
+void Metrics::Add(int counter, uint64_t n) {
+    Bump_(ThreadShard_()->counters[counter], n);
+}
+
+void Metrics::Record(int hist, uint64_t usec) {
+    Histogram& h = ThreadShard_()->hists[hist];
+    Bump_(h.buckets[BucketOf(usec)], 1);
+    Bump_(h.count, 1);
+    Bump_(h.sum, usec);
+}
+
+void Metrics::Adjust(int level, int64_t delta) {
+    Bump_(ThreadShard_()->levels[level], (uint64_t)delta);
+}
+
+int Metrics::BucketOf(uint64_t value) {
+    if(value < (uint64_t)SUB_COUNT) { return value; }
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - SUB_BITS;
+    int sub = (value >> shift) & (SUB_COUNT - 1);
+    return (shift + 1) * SUB_COUNT + sub;
+}
+
+uint64_t Metrics::BucketUpper(int bucket) {
+    if(bucket < SUB_COUNT) { return bucket; }
+    int shift = bucket / SUB_COUNT - 1;
+    uint64_t lower = (uint64_t)(SUB_COUNT + bucket % SUB_COUNT) << shift;
+    return lower + (((uint64_t)1 << shift) - 1);
+}
+
+void Metrics::AddGauge(const char* name, const char* help, function<double()> fn) {
+    lock_guard<mutex> locker(Mtx_());
+    for(auto& g : Gauges_()) {
+        if(g.name == name) {        // 重复注册时替换
+            g.help = help;
+            g.fn = move(fn);
+            return;
+        }
+    }
+    Gauges_().push_back({ name, help, move(fn) });
+}
+
+uint64_t Metrics::Counter(int counter) {
+    lock_guard<mutex> locker(Mtx_());
+    uint64_t total = 0;
+    for(Shard* shard : Shards_()) {
+        total += shard->counters[counter].load(memory_order_relaxed);
+    }
+    return total;
+}
+
+int64_t Metrics::Level(int level) {
+    lock_guard<mutex> locker(Mtx_());
+    uint64_t total = 0;
+    for(Shard* shard : Shards_()) {
+        total += shard->levels[level].load(memory_order_relaxed);
+    }
+    return (int64_t)total;
+}
+
+// 持有Mtx_()时调用
+void Metrics::Merge_(int hist, uint64_t* buckets, uint64_t* count, uint64_t* sum) {
+    memset(buckets, 0, sizeof(uint64_t) * BUCKETS);
+    *count = *sum = 0;
+    for(Shard* shard : Shards_()) {
+        Histogram& h = shard->hists[hist];
+        for(int i = 0; i < BUCKETS; i++) {
+            buckets[i] += h.buckets[i].load(memory_order_relaxed);
+        }
+        *count += h.count.load(memory_order_relaxed);
+        *sum += h.sum.load(memory_order_relaxed);
+    }
+}
+
+static double QuantileOf(const uint64_t* buckets, uint64_t count, double q) {
+    // 各桶分别读取，count可能与桶的总和略有出入，以桶为准
+    uint64_t total = 0;
+    for(int i = 0; i < Metrics::BUCKETS; i++) { total += buckets[i]; }
+    if(total == 0) { return 0; }
+    uint64_t rank = (uint64_t)ceil(q * total);
+    if(rank == 0) { rank = 1; }
+    uint64_t seen = 0;
+    for(int i = 0; i < Metrics::BUCKETS; i++) {
+        seen += buckets[i];
+        if(seen >= rank) { return Metrics::BucketUpper(i); }
+    }
+    return Metrics::BucketUpper(Metrics::BUCKETS - 1);
+}
+
+double Metrics::Quantile(int hist, double q) {
+    uint64_t buckets[BUCKETS], count, sum;
+    lock_guard<mutex> locker(Mtx_());
+    Merge_(hist, buckets, &count, &sum);
+    return QuantileOf(buckets, count, q);
+}
+
+void Metrics::Snapshot(Samples* counters, Samples* gauges) {
+    static const double QUANTILES[] = { 0.5, 0.99, 0.999 };
+    static const char* QUANTILE_NAME[] = { "p50", "p99", "p999" };
+    uint64_t counts[COUNTER_NUM] = {0};
+    uint64_t levels[LEVEL_NUM] = {0};
+    unique_lock<mutex> locker(Mtx_());
+    for(Shard* shard : Shards_()) {
+        for(int i = 0; i < COUNTER_NUM; i++) {
+            counts[i] += shard->counters[i].load(memory_order_relaxed);
+        }
+        for(int i = 0; i < LEVEL_NUM; i++) {
+            levels[i] += shard->levels[i].load(memory_order_relaxed);
+        }
+    }
+    for(int i = 0; i < COUNTER_NUM; i++) {
+        counters->emplace_back(COUNTER_NAME[i], (double)counts[i]);
+    }
+    for(int i = 0; i < LEVEL_NUM; i++) {
+        gauges->emplace_back(string("connections_") + LEVEL_NAME[i], (double)(int64_t)levels[i]);
+    }
+    uint64_t buckets[BUCKETS], count, sum;
+    for(int h = 0; h < HIST_NUM; h++) {
+        Merge_(h, buckets, &count, &sum);
+        for(int q = 0; q < 3; q++) {
+            gauges->emplace_back(string(HIST_NAME[h]) + "_" + QUANTILE_NAME[q] + "_us",
+                                QuantileOf(buckets, count, QUANTILES[q]));
+        }
+    }
+    // 回调可能要拿其他模块的锁，复制一份后在锁外调用
+    vector<Gauge> gaugeList = Gauges_();
+    locker.unlock();
+    for(auto& g : gaugeList) {
+        gauges->emplace_back(g.name, g.fn());
+    }
+}
+
+void Metrics::Render(string* out) {
+    static const char* COUNTER_HELP[] = {
+        "Accepted connections.", "Completed requests.", nullptr, nullptr, nullptr, nullptr,
+        "Bytes read from clients.", "Bytes written to clients.", "epoll_wait returns.",
+        "Tasks queued to the thread pool.", "Connections closed by idle timeout.",
+        "SQL connection requests that had to wait.", "SQL connection requests that timed out.",
+        "Failed attempts to open an SQL connection.", "Idle SQL connections closed after a failed ping.",
+        "Logins answered by the credential cache.",
+        "Logins that had to query the database.", "Credential cache entries evicted by the memory cap.",
+        "Group commits of registrations.", "Registrations written by group commits.",
+        "Lookups served by a read replica.", "Lookups sent to the primary after a recent write.",
+        "Lookups sent to the primary because no replica could serve them.",
+    };
+    static const char* HIST_HELP[] = {
+        "Request parse time.", "File lookup and response build time.",
+        "Time from request arrival to response sent.",
+        "Login/register time on the DB executor, including queueing.",
+        "Time to acquire an SQL connection from the pool.",
+        "Time an SQL connection is held before being returned.",
+    };
+    static const double QUANTILES[] = { 0.5, 0.9, 0.99, 0.999 };
+
+    char line[256];
+    uint64_t counters[COUNTER_NUM] = {0};
+    uint64_t levels[LEVEL_NUM] = {0};
+    unique_lock<mutex> locker(Mtx_());
+    for(Shard* shard : Shards_()) {
+        for(int i = 0; i < COUNTER_NUM; i++) {
+            counters[i] += shard->counters[i].load(memory_order_relaxed);
+        }
+        for(int i = 0; i < LEVEL_NUM; i++) {
+            levels[i] += shard->levels[i].load(memory_order_relaxed);
+        }
+    }
+
+    for(int i = 0; i < COUNTER_NUM; i++) {
+        if(i >= STATUS_2XX && i <= STATUS_5XX) { continue; }
+        snprintf(line, sizeof(line), "# HELP webserver_%s_total %s\n# TYPE webserver_%s_total counter\n"
+                "webserver_%s_total %llu\n", COUNTER_NAME[i], COUNTER_HELP[i], COUNTER_NAME[i],
+                COUNTER_NAME[i], (unsigned long long)counters[i]);
+        out->append(line);
+    }
+    out->append("# HELP webserver_responses_total Responses by status class.\n"
+                "# TYPE webserver_responses_total counter\n");
+    for(int i = STATUS_2XX; i <= STATUS_5XX; i++) {
+        snprintf(line, sizeof(line), "webserver_responses_total{code=\"%dxx\"} %llu\n",
+                i - STATUS_2XX + 2, (unsigned long long)counters[i]);
+        out->append(line);
+    }
+
+    out->append("# HELP webserver_connections_by_state Open connections by state.\n"
+                "# TYPE webserver_connections_by_state gauge\n");
+    for(int i = 0; i < LEVEL_NUM; i++) {
+        snprintf(line, sizeof(line), "webserver_connections_by_state{state=\"%s\"} %lld\n",
+                LEVEL_NAME[i], (long long)(int64_t)levels[i]);
+        out->append(line);
+    }
+
+    uint64_t buckets[BUCKETS], count, sum;
+    for(int h = 0; h < HIST_NUM; h++) {
+        Merge_(h, buckets, &count, &sum);
+        snprintf(line, sizeof(line), "# HELP webserver_%s_seconds %s\n# TYPE webserver_%s_seconds summary\n",
+                HIST_NAME[h], HIST_HELP[h], HIST_NAME[h]);
+        out->append(line);
+        for(double q : QUANTILES) {
+            snprintf(line, sizeof(line), "webserver_%s_seconds{quantile=\"%g\"} %.6f\n",
+                    HIST_NAME[h], q, QuantileOf(buckets, count, q) / 1e6);
+            out->append(line);
+        }
+        snprintf(line, sizeof(line), "webserver_%s_seconds_sum %.6f\nwebserver_%s_seconds_count %llu\n",
+                HIST_NAME[h], sum / 1e6, HIST_NAME[h], (unsigned long long)count);
+        out->append(line);
+    }
+
+    vector<Gauge> gaugeList = Gauges_();
+    locker.unlock();
+    for(auto& g : gaugeList) {
+        snprintf(line, sizeof(line), "# HELP webserver_%s %s\n# TYPE webserver_%s gauge\nwebserver_%s %.17g\n",
+                g.name.c_str(), g.help.c_str(), g.name.c_str(), g.name.c_str(), g.fn());
+        out->append(line);
+    }
+}
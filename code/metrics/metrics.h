@@ -0,0 +1,127 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-20
+ * @copyleft Apache 2.0
+ */
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+/* 运行时统计：计数器和延迟直方图
+   每个线程写自己的分片（按缓存行对齐，单写者不需要原子加），只有抓取/metrics时才汇总所有分片 */
+class Metrics {
+public:
+    enum COUNTER {
+        ACCEPTS = 0,            // 接受的连接
+        REQUESTS,               // 完成的请求
+        STATUS_2XX,
+        STATUS_3XX,
+        STATUS_4XX,
+        STATUS_5XX,
+        BYTES_IN,
+        BYTES_OUT,
+        EPOLL_WAKEUPS,          // epoll_wait返回次数
+        TASKS_QUEUED,           // 放入线程池的任务
+        TIMER_EXPIRED,          // 超时关闭的连接
+        SQL_WAITS,              // 取数据库连接时需要等待的次数
+        SQL_TIMEOUTS,           // 等待超时没取到连接
+        SQL_CONNECT_ERRORS,     // 建立连接失败
+        SQL_BROKEN,             // 定期检查发现断开并关闭的连接
+        AUTH_CACHE_HITS,        // 登录/注册由缓存直接给出结果
+        AUTH_CACHE_MISSES,      // 需要查询数据库
+        AUTH_CACHE_EVICTIONS,   // 超过内存上限被淘汰的条目
+        REGISTER_BATCHES,       // 注册的组提交次数
+        REGISTER_ROWS,          // 组提交写入的注册数，除以次数即平均每批大小
+        SQL_REPLICA_READS,      // 由只读副本返回的查询
+        SQL_PINNED_READS,       // 刚写入过，改读主库的查询（read-your-writes）
+        SQL_REPLICA_FALLBACKS,  // 没有可用副本或副本出错，改读主库的查询
+        COUNTER_NUM,
+    };
+
+    enum HISTOGRAM {
+        HIST_PARSE = 0,         // 解析请求
+        HIST_FILE,              // 查找/映射文件并生成响应
+        HIST_REQUEST,           // 从收到请求到响应发送完毕
+        HIST_VERIFY,            // 登录/注册：从挂起连接到数据库返回结果（含排队）
+        HIST_SQL_ACQUIRE,       // 从连接池取连接（含等待和新建连接）
+        HIST_SQL_HOLD,          // 数据库连接借出到归还
+        HIST_NUM,
+    };
+
+    // 可增可减的计数（各分片之和即当前值），目前用于各状态的连接数
+    enum LEVEL {
+        CONN_READING = 0,       // 等待请求数据
+        CONN_ACTIVE,            // 在线程池中排队或处理
+        CONN_WRITING,           // 等待socket可写
+        CONN_DB,                // 挂起，等待数据库线程组返回结果
+        LEVEL_NUM,
+    };
+
+    // 对数-线性分桶（HDR风格）：每个2的幂区间再分8份，相对误差约12.5%
+    static const int SUB_BITS = 3;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+    static void Add(int counter, uint64_t n = 1);
+    static void Record(int hist, uint64_t usec);
+    static void Adjust(int level, int64_t delta);
+
+    static int BucketOf(uint64_t value);
+    static uint64_t BucketUpper(int bucket);    // 桶内最大值
+
+    // 额外的即时值（连接数、日志丢弃数等），抓取时调用
+    static void AddGauge(const char* name, const char* help, std::function<double()> fn);
+
+    // Prometheus文本格式
+    static void Render(std::string* out);
+
+    // 汇总后的值，供测试和其他导出方式使用
+    static uint64_t Counter(int counter);
+    static int64_t Level(int level);
+    static double Quantile(int hist, double q);
+
+    // 按名字导出全部数值（共享内存统计段使用）：计数器 / 即时值（含各状态连接数和延迟分位数，单位微秒）
+    typedef std::vector<std::pair<std::string, double>> Samples;
+    static void Snapshot(Samples* counters, Samples* gauges);
+
+private:
+    struct Histogram {
+        std::atomic<uint64_t> buckets[BUCKETS];
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sum;
+    };
+
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> counters[COUNTER_NUM];
+        std::atomic<uint64_t> levels[LEVEL_NUM];    // 按2^64取模累加，求和后转成有符号数
+        alignas(64) Histogram hists[HIST_NUM];
+        bool inUse;
+    };
+
+    struct Gauge {
+        std::string name;
+        std::string help;
+        std::function<double()> fn;
+    };
+
+    static Shard* ThreadShard_();
+    static void Bump_(std::atomic<uint64_t>& v, uint64_t n) {
+        // 只有所属线程写，relaxed读改写即可，不需要带锁前缀的原子加
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    static void Merge_(int hist, uint64_t* buckets, uint64_t* count, uint64_t* sum);
+
+    friend struct ShardHolder;
+    // 以下对象在进程退出时不析构，已分离的线程退出得晚也能安全访问
+    static std::mutex& Mtx_();                  // 保护分片列表和gauge
+    static std::vector<Shard*>& Shards_();      // 分片不释放：线程退出后留给新线程复用，数值继续累加
+    static std::vector<Gauge>& Gauges_();
+};
+
+#endif // METRICS_H
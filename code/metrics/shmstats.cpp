@@ -0,0 +1,167 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-20
+ * @copyleft Apache 2.0
+ */
+#include "shmstats.h"
+#include "metrics.h"
+#include <cstring>
+#include <assert.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+using namespace std;
+using namespace shmstats;
+
+static int64_t NowUs() {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+static void SetValue(Value* v, const string& name, double value) {
+    size_t len = min(name.size(), (size_t)NAME_LEN - 1);
+    memcpy(v->name, name.data(), len);
+    v->name[len] = '\0';
+    v->value = value;
+}
+
+string shmstats::SegmentName(int port) {
+    return "/webserver-" + to_string(port);
+}
+
+ShmStats::ShmStats() : layout_(nullptr), intervalMs_(1000), startUs_(0), stop_(false) {}
+
+ShmStats::~ShmStats() {
+    Stop();
+}
+
+bool ShmStats::Start(const char* name, int intervalMs, ThreadFn threads) {
+    assert(name && intervalMs > 0 && !layout_);
+    // 01：创建并映射共享内存段（上次异常退出留下的同名段直接复用）
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if(fd < 0) { return false; }
+    if(ftruncate(fd, sizeof(Layout)) < 0) {
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+    void* addr = mmap(nullptr, sizeof(Layout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED) {
+        shm_unlink(name);
+        return false;
+    }
+
+    // 02：先写好头部，magic最后写，读者看到magic时其余字段已就绪
+    layout_ = static_cast<Layout*>(addr);
+    layout_->magic = 0;
+    atomic_thread_fence(memory_order_release);
+    memset(&layout_->data, 0, sizeof(layout_->data));
+    layout_->version = VERSION;
+    layout_->size = sizeof(Layout);
+    layout_->pid = getpid();
+    layout_->seq.store(0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    layout_->magic = MAGIC;
+
+    name_ = name;
+    intervalMs_ = intervalMs;
+    startUs_ = NowUs();
+    threadFn_ = move(threads);
+    stop_ = false;
+    Publish();
+
+    // 03：发布线程
+    thread_ = std::thread(&ShmStats::Run_, this);
+    return true;
+}
+
+void ShmStats::Stop() {
+    if(thread_.joinable()) {
+        stop_ = true;
+        wake_.NotifyAll();
+        thread_.join();
+    }
+    if(layout_) {
+        munmap(layout_, sizeof(Layout));
+        shm_unlink(name_.c_str());
+        layout_ = nullptr;
+    }
+}
+
+void ShmStats::Run_() {
+    while(!stop_) {
+        uint32_t seq = wake_.Prepare();
+        if(stop_) { wake_.Cancel(); break; }
+        wake_.Wait(seq, intervalMs_);
+        if(!stop_) { Publish(); }
+    }
+}
+
+void ShmStats::Publish() {
+    if(!layout_) { return; }
+    // 01：先在锁外收集，seq为奇数的时间尽量短
+    Metrics::Samples counters, gauges;
+    Metrics::Snapshot(&counters, &gauges);
+    vector<Thread> threads;
+    if(threadFn_) { threadFn_(&threads); }
+
+    // 02：顺序锁写入
+    Snapshot& d = layout_->data;
+    uint32_t seq = layout_->seq.load(memory_order_relaxed);
+    layout_->seq.store(seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    d.startUs = startUs_;
+    d.updateUs = NowUs();
+    d.intervalMs = intervalMs_;
+    d.counterCnt = min(counters.size(), (size_t)MAX_COUNTERS);
+    for(uint32_t i = 0; i < d.counterCnt; i++) {
+        SetValue(&d.counters[i], counters[i].first, counters[i].second);
+    }
+    d.gaugeCnt = min(gauges.size(), (size_t)MAX_GAUGES);
+    for(uint32_t i = 0; i < d.gaugeCnt; i++) {
+        SetValue(&d.gauges[i], gauges[i].first, gauges[i].second);
+    }
+    d.threadCnt = min(threads.size(), (size_t)MAX_THREADS);
+    memcpy(d.threads, threads.data(), sizeof(Thread) * d.threadCnt);
+
+    layout_->seq.store(seq + 2, memory_order_release);
+}
+
+bool ShmStats::Read(const char* name, Snapshot* snap, int* pid) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0) { return false; }
+    struct stat st;
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Layout)) {
+        close(fd);
+        return false;
+    }
+    void* addr = mmap(nullptr, sizeof(Layout), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED) { return false; }
+
+    const Layout* layout = static_cast<const Layout*>(addr);
+    bool ok = false;
+    if(layout->magic == MAGIC && layout->version == VERSION && layout->size == sizeof(Layout)) {
+        atomic_thread_fence(memory_order_acquire);
+        if(pid) { *pid = layout->pid; }
+        for(int i = 0; i < READ_RETRY && !ok; i++) {
+            uint32_t before = layout->seq.load(memory_order_acquire);
+            if(before & 1) {            // 正在写
+                sched_yield();
+                continue;
+            }
+            memcpy(snap, &layout->data, sizeof(Snapshot));
+            atomic_thread_fence(memory_order_acquire);
+            ok = layout->seq.load(memory_order_relaxed) == before;
+        }
+    }
+    munmap(addr, sizeof(Layout));
+    return ok;
+}
@@ -0,0 +1,107 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-20
+ * @copyleft Apache 2.0
+ */
+#ifndef SHMSTATS_H
+#define SHMSTATS_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <cstdint>
+#include "../pool/futexevent.h"
+
+/* 共享内存统计段：发布线程定期把运行指标写进POSIX共享内存（/dev/shm），
+   外部工具（tools/webserver-top）只读映射，不向服务器发请求，也不经过事件循环
+
+   单写者顺序锁：写之前seq加1变成奇数，写完再加1变成偶数；
+   读者拷贝前后读到的seq相同且为偶数，才算拿到一致的快照 */
+
+namespace shmstats {
+
+const uint32_t MAGIC = 0x54535357;      // "WSST"
+const uint32_t VERSION = 1;             // 布局变化时加1，读者不认识的版本直接拒绝
+const int NAME_LEN = 40;
+const int MAX_COUNTERS = 64;
+const int MAX_GAUGES = 64;
+const int MAX_THREADS = 128;
+
+const char THREAD_WORKER = 'w';         // 线程池工作线程
+const char THREAD_LOG = 'l';            // 写日志线程的环形缓冲区
+const char THREAD_DB = 'd';             // 数据库线程组
+
+struct Value {
+    char name[NAME_LEN];
+    double value;
+};
+
+struct Thread {
+    char kind;              // THREAD_*
+    uint8_t busy;           // 正在执行任务
+    uint16_t pad;
+    uint32_t index;
+    uint64_t tasks;         // 已执行的任务数
+    uint64_t depth;         // 队列深度（日志缓冲区为待写出的字节数）
+};
+
+// 受seq保护的数据，读者整体拷贝
+struct Snapshot {
+    int64_t startUs;        // 服务器启动时间
+    int64_t updateUs;       // 本次发布时间
+    uint32_t intervalMs;    // 发布间隔
+    uint32_t counterCnt;
+    uint32_t gaugeCnt;
+    uint32_t threadCnt;
+    Value counters[MAX_COUNTERS];   // 只增不减，读者自己算速率
+    Value gauges[MAX_GAUGES];       // 即时值：各状态连接数、延迟分位数、队列长度、连接池使用情况
+    Thread threads[MAX_THREADS];
+};
+
+struct Layout {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;          // sizeof(Layout)
+    int32_t pid;
+    std::atomic<uint32_t> seq;
+    uint32_t pad;
+    Snapshot data;
+};
+
+std::string SegmentName(int port);     // "/webserver-<port>"
+
+} // namespace shmstats
+
+class ShmStats {
+public:
+    typedef std::function<void(std::vector<shmstats::Thread>*)> ThreadFn;
+
+    ShmStats();
+    ~ShmStats();
+
+    // 创建共享内存段并启动发布线程，threads用来收集各线程的状态（可为空）
+    bool Start(const char* name, int intervalMs, ThreadFn threads = nullptr);
+    void Stop();            // 停止发布并删除共享内存段
+    void Publish();         // 立即发布一次
+
+    // 读者：映射name并拷贝出一致的快照，段不存在或版本不符时返回false
+    static bool Read(const char* name, shmstats::Snapshot* snap, int* pid = nullptr);
+
+private:
+    void Run_();
+
+    static const int READ_RETRY = 1000;     // 读者遇到写入中的快照时重试的次数
+
+    std::string name_;
+    shmstats::Layout* layout_;
+    int intervalMs_;
+    int64_t startUs_;
+    ThreadFn threadFn_;
+    std::thread thread_;
+    std::atomic<bool> stop_;
+    FutexEvent wake_;
+};
+
+#endif // SHMSTATS_H
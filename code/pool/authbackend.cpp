@@ -0,0 +1,63 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-19
+ * @copyleft Apache 2.0
+ */
+
+#define LOG_MODULE Log::MODULE_POOL
+#include "authbackend.h"
+#include "mysqlauth.h"
+#include "localauth.h"
+#include "../log/log.h"
+
+using namespace std;
+
+AuthBackend::AuthBackend()
+    : writer_([this](std::vector<Row*>& rows) { InsertBatch(rows); }) {}
+
+int AuthBackend::Insert(string_view name, string_view pwd) {
+    return writer_.Submit(name, pwd);
+}
+
+void AuthBackend::SetBatch(int windowUs, int maxBatch) {
+    writer_.SetBatch(windowUs, maxBatch);
+}
+
+// 默认使用MySQL，与原来的行为一致
+unique_ptr<AuthBackend>& AuthBackend::Backend_() {
+    static unique_ptr<AuthBackend> backend(new MySqlAuth());
+    return backend;
+}
+
+AuthBackend* AuthBackend::Instance() {
+    return Backend_().get();
+}
+
+bool AuthBackend::Init(int type, const char* path, int batchUs, int batchMax) {
+    unique_ptr<AuthBackend> backend;
+    switch(type) {
+    case BACKEND_MYSQL:
+        backend.reset(new MySqlAuth());
+        break;
+    case BACKEND_LOCAL: {
+        unique_ptr<LocalAuth> local(new LocalAuth());
+        if(!local->Open(path)) { return false; }
+        backend = move(local);
+        break;
+    }
+    default:
+        LOG_ERROR("Unknown auth backend: %d", type);
+        return false;
+    }
+    backend->SetBatch(batchUs, batchMax);
+    Backend_() = move(backend);
+    return true;
+}
+
+const char* AuthBackend::TypeName(int type) {
+    switch(type) {
+    case BACKEND_MYSQL: return "mysql";
+    case BACKEND_LOCAL: return "local";
+    default: return "unknown";
+    }
+}
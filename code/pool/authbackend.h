@@ -0,0 +1,52 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-19
+ * @copyleft Apache 2.0
+ */
+#ifndef AUTHBACKEND_H
+#define AUTHBACKEND_H
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <vector>
+#include "registerwriter.h"
+
+/* 用户表的存储：登录/注册只通过这个接口读写用户，不直接依赖MySQL
+   启动时用Init选择实现，之后只读，各线程可以并发调用 */
+class AuthBackend {
+public:
+    enum TYPE {
+        BACKEND_MYSQL = 0,      // 数据库连接池中的user表
+        BACKEND_LOCAL,          // 本地文件中的哈希表（mmap），不需要数据库
+    };
+
+    static AuthBackend* Instance();
+    // 失败时返回false，保持原来的实现；batchUs/batchMax为注册的组提交窗口（见RegisterWriter）
+    static bool Init(int type, const char* path, int batchUs = 0, int batchMax = 1);
+    static const char* TypeName(int type);
+
+    AuthBackend();
+    virtual ~AuthBackend() = default;
+
+    // 查询密码：1存在（写入pwd），0不存在，-1出错
+    // fresh为true时必须读到最新数据（注册前检查用户名），不能读可能落后的副本
+    virtual int Lookup(std::string_view name, std::string* pwd, bool fresh = false) = 0;
+    // 新建用户：1成功，0用户名已被使用，-1出错；并发的注册合并成一批写入
+    int Insert(std::string_view name, std::string_view pwd);
+    void SetBatch(int windowUs, int maxBatch);
+    // 不需要数据库连接池时不用初始化SqlConnPool
+    virtual bool NeedSqlPool() const { return false; }
+
+protected:
+    typedef RegisterWriter::Row Row;
+    // 写入一批新用户，每行写入自己的结果
+    virtual void InsertBatch(std::vector<Row*>& rows) = 0;
+
+private:
+    static std::unique_ptr<AuthBackend>& Backend_();
+
+    RegisterWriter writer_;
+};
+
+#endif // AUTHBACKEND_H
@@ -0,0 +1,168 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-19
+ * @copyleft Apache 2.0
+ */
+
+#include "credcache.h"
+#include "../metrics/metrics.h"
+#include <random>
+#include <functional>
+#include <assert.h>
+
+using namespace std;
+
+static inline uint64_t Rotl(uint64_t x, int b) {
+    return (x << b) | (x >> (64 - b));
+}
+
+#define SIPROUND do { \
+    v0 += v1; v1 = Rotl(v1, 13); v1 ^= v0; v0 = Rotl(v0, 32); \
+    v2 += v3; v3 = Rotl(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = Rotl(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = Rotl(v1, 17); v1 ^= v2; v2 = Rotl(v2, 32); \
+} while(0)
+
+// SipHash-2-4：带密钥的64位摘要，不知道密钥时无法构造碰撞
+static uint64_t SipHash(const uint64_t key[2], const char* data, size_t len) {
+    uint64_t v0 = 0x736f6d6570736575ULL ^ key[0], v1 = 0x646f72616e646f6dULL ^ key[1];
+    uint64_t v2 = 0x6c7967656e657261ULL ^ key[0], v3 = 0x7465646279746573ULL ^ key[1];
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    size_t blocks = len / 8;
+    for(size_t i = 0; i < blocks; i++, p += 8) {
+        uint64_t m = 0;
+        for(int j = 0; j < 8; j++) { m |= (uint64_t)p[j] << (8 * j); }
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+    uint64_t b = (uint64_t)len << 56;
+    for(size_t j = 0; j < len % 8; j++) { b |= (uint64_t)p[j] << (8 * j); }
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+CredCache::CredCache() : ttlMs_(0), shardBytes_(0) {
+    random_device rd;
+    key_[0] = ((uint64_t)rd() << 32) | rd();
+    key_[1] = ((uint64_t)rd() << 32) | rd();
+}
+
+CredCache* CredCache::Instance() {
+    static CredCache cache;
+    return &cache;
+}
+
+void CredCache::Init(int ttlSec, size_t maxBytes) {
+    ttlMs_ = ttlSec > 0 ? ttlSec * 1000 : 0;
+    shardBytes_ = maxBytes / SHARDS;
+}
+
+CredCache::Shard& CredCache::ShardOf_(string_view name) {
+    return shards_[hash<string_view>()(name) % SHARDS];
+}
+
+uint64_t CredCache::Digest_(string_view pwd) const {
+    return SipHash(key_, pwd.data(), pwd.size());
+}
+
+// 一个条目大约占用的内存：用户名、链表节点和哈希表节点
+size_t CredCache::Cost_(const Entry& e) {
+    return e.name.capacity() + sizeof(Entry) + 64;
+}
+
+void CredCache::Erase_(Shard& shard, list<Entry>::iterator it) {
+    shard.bytes -= Cost_(*it);
+    shard.index.erase(string_view(it->name));
+    shard.lru.erase(it);
+}
+
+int CredCache::Check(string_view name, string_view pwd, bool isLogin) {
+    if(!IsOpen()) { return -1; }
+    int result = CheckLocked_(name, pwd, isLogin);
+    // 统计在锁外记录：/metrics抓取时持有统计的锁再读缓存（gauge），两把锁的顺序不能反过来
+    Metrics::Add(result < 0 ? Metrics::AUTH_CACHE_MISSES : Metrics::AUTH_CACHE_HITS);
+    return result;
+}
+
+int CredCache::CheckLocked_(string_view name, string_view pwd, bool isLogin) {
+    Shard& shard = ShardOf_(name);
+    lock_guard<mutex> locker(shard.mtx);
+    auto found = shard.index.find(name);
+    if(found == shard.index.end()) { return -1; }
+    auto it = found->second;
+    if(Clock::now() >= it->expires) {
+        Erase_(shard, it);
+        return -1;
+    }
+    // 命中：移到表头
+    shard.lru.splice(shard.lru.begin(), shard.lru, it);
+    if(!isLogin) {
+        // 注册：已知用户存在时直接拒绝，不存在时仍要写数据库
+        return it->exists ? 0 : -1;
+    }
+    return it->exists && it->digest == Digest_(pwd) ? 1 : 0;
+}
+
+void CredCache::Put(string_view name, const string_view* pwd) {
+    if(!IsOpen()) { return; }
+    uint64_t digest = pwd ? Digest_(*pwd) : 0;     // 锁外计算
+    Shard& shard = ShardOf_(name);
+    unique_lock<mutex> locker(shard.mtx);
+    // 01：已有条目先删除
+    auto found = shard.index.find(name);
+    if(found != shard.index.end()) {
+        Erase_(shard, found->second);
+    }
+    // 02：插到表头
+    shard.lru.push_front({ string(name), pwd != nullptr, digest,
+                           Clock::now() + chrono::milliseconds(ttlMs_) });
+    auto it = shard.lru.begin();
+    shard.index.emplace(string_view(it->name), it);
+    shard.bytes += Cost_(*it);
+    // 03：超过内存上限时从表尾淘汰
+    int evicted = 0;
+    while(shard.bytes > shardBytes_ && shard.lru.size() > 1) {
+        Erase_(shard, prev(shard.lru.end()));
+        evicted++;
+    }
+    locker.unlock();
+    if(evicted > 0) { Metrics::Add(Metrics::AUTH_CACHE_EVICTIONS, evicted); }
+}
+
+void CredCache::Invalidate(string_view name) {
+    if(!IsOpen()) { return; }
+    Shard& shard = ShardOf_(name);
+    lock_guard<mutex> locker(shard.mtx);
+    auto found = shard.index.find(name);
+    if(found != shard.index.end()) {
+        Erase_(shard, found->second);
+    }
+}
+
+size_t CredCache::Entries() {
+    size_t n = 0;
+    for(Shard& shard : shards_) {
+        lock_guard<mutex> locker(shard.mtx);
+        n += shard.lru.size();
+    }
+    return n;
+}
+
+size_t CredCache::Bytes() {
+    size_t n = 0;
+    for(Shard& shard : shards_) {
+        lock_guard<mutex> locker(shard.mtx);
+        n += shard.bytes;
+    }
+    return n;
+}
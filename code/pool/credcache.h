@@ -0,0 +1,73 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-19
+ * @copyleft Apache 2.0
+ */
+#ifndef CREDCACHE_H
+#define CREDCACHE_H
+
+#include <string>
+#include <string_view>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+
+/* 已验证用户的缓存，放在UserVerify前面：同一用户反复登录时不再查数据库
+   不保存明文密码，只保存带随机密钥的密码摘要（SipHash-2-4），用户不存在也会缓存
+   按用户名分片，每片一把锁和一个LRU链表；条目过期（TTL）或超过内存上限时淘汰 */
+class CredCache {
+public:
+    static CredCache* Instance();
+
+    // ttlSec为0时关闭缓存，maxBytes为所有分片合计的近似内存上限
+    void Init(int ttlSec, size_t maxBytes);
+    bool IsOpen() const { return ttlMs_ > 0; }
+
+    // 返回值：1通过，0拒绝，-1不确定（需要查数据库）
+    int Check(std::string_view name, std::string_view pwd, bool isLogin);
+
+    // 查询数据库后更新：用户存在时传入数据库中的密码，不存在时pwd为nullptr
+    void Put(std::string_view name, const std::string_view* pwd);
+    void Invalidate(std::string_view name);      // 注册前调用，删除旧的条目
+
+    size_t Entries();
+    size_t Bytes();
+
+private:
+    CredCache();
+    ~CredCache() = default;
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry {
+        std::string name;
+        bool exists;            // 用户是否存在
+        uint64_t digest;        // 存在时为密码摘要
+        Clock::time_point expires;
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mtx;
+        std::list<Entry> lru;   // 表头为最近使用
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> index;   // 键引用Entry::name
+        size_t bytes = 0;
+    };
+
+    static const int SHARDS = 16;
+
+    Shard& ShardOf_(std::string_view name);
+    int CheckLocked_(std::string_view name, std::string_view pwd, bool isLogin);
+    uint64_t Digest_(std::string_view pwd) const;
+    static size_t Cost_(const Entry& e);
+    void Erase_(Shard& shard, std::list<Entry>::iterator it);
+
+    int ttlMs_;
+    size_t shardBytes_;         // 每片的内存上限
+    uint64_t key_[2];           // SipHash密钥，启动时随机生成
+    Shard shards_[SHARDS];
+};
+
+#endif // CREDCACHE_H
@@ -0,0 +1,64 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-15
+ * @copyleft Apache 2.0
+ */
+#ifndef FUTEXEVENT_H
+#define FUTEXEVENT_H
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* 基于futex的等待/唤醒：快路径上没有等待者时只有一次fence和一次读，不进内核
+   等待方：s = Prepare(); 再检查一次条件; Wait(s, ms)
+   通知方：改完条件后 Notify() */
+class FutexEvent {
+public:
+    FutexEvent() : seq_(0), waiters_(0) {}
+
+    uint32_t Prepare() {
+        waiters_.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return seq_.load(std::memory_order_acquire);
+    }
+
+    // Prepare之后条件已经满足，不再等待
+    void Cancel() { waiters_.fetch_sub(1, std::memory_order_relaxed); }
+
+    // timeoutMs < 0 一直等待；被唤醒、超时或seq已变化时返回
+    void Wait(uint32_t seq, int timeoutMs) {
+        struct timespec ts;
+        struct timespec* pts = nullptr;
+        if(timeoutMs >= 0) {
+            ts.tv_sec = timeoutMs / 1000;
+            ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+            pts = &ts;
+        }
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&seq_), FUTEX_WAIT_PRIVATE, seq, pts, nullptr, 0);
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void Notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(waiters_.load(std::memory_order_relaxed) > 0) {
+            seq_.fetch_add(1, std::memory_order_release);
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&seq_), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+        }
+    }
+
+    void NotifyAll() {
+        seq_.fetch_add(1, std::memory_order_seq_cst);
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&seq_), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+    }
+
+private:
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word");
+    alignas(64) std::atomic<uint32_t> seq_;
+    std::atomic<int> waiters_;
+};
+
+#endif // FUTEXEVENT_H
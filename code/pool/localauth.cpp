@@ -0,0 +1,356 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-19
+ * @copyleft Apache 2.0
+ */
+
+#define LOG_MODULE Log::MODULE_POOL
+#include "localauth.h"
+#include "../log/log.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+#include <assert.h>
+
+using namespace std;
+
+static const char MAGIC[8] = { 'W', 'S', 'A', 'U', 'T', 'H', '\0', '\0' };
+
+LocalAuth::LocalAuth()
+    : fd_(-1), base_(nullptr), size_(0), header_(nullptr), slots_(nullptr), used_(0) {
+    static_assert(sizeof(Header) == 128 && sizeof(Slot) == 128, "slot size");
+}
+
+LocalAuth::~LocalAuth() {
+    Close();
+}
+
+// FNV-1a：写进文件的哈希，不能随编译器/版本变化
+uint64_t LocalAuth::Hash_(string_view name) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for(unsigned char c : name) {
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+    return h ? h : 1;
+}
+
+size_t LocalAuth::FileSize_(uint64_t slots) {
+    return sizeof(Header) + slots * sizeof(Slot);
+}
+
+bool LocalAuth::Map_(int fd, size_t size, char** base) {
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED) {
+        LOG_ERROR("mmap auth file error: %d", errno);
+        return false;
+    }
+    *base = static_cast<char*>(p);
+    return true;
+}
+
+// 文件在ftruncate之后、写文件头之前崩溃时全是0：文件头为空、所有槽位为空
+bool LocalAuth::Blank_(const char* base, size_t size) {
+    if(size != FileSize_(INIT_SLOTS)) { return false; }
+    const Header* header = reinterpret_cast<const Header*>(base);
+    for(char c : header->magic) {
+        if(c != 0) { return false; }
+    }
+    const Slot* slots = reinterpret_cast<const Slot*>(base + sizeof(Header));
+    for(uint64_t i = 0; i < INIT_SLOTS; i++) {
+        if(slots[i].hash) { return false; }
+    }
+    return true;
+}
+
+// 新建或rename之后同步所在目录，目录项落盘后文件才不会在掉电后丢失
+bool LocalAuth::SyncDir_(const string& path) {
+    size_t slash = path.rfind('/');
+    string dir = slash == string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) {
+        LOG_ERROR("open dir %s error: %d", dir.c_str(), errno);
+        return false;
+    }
+    bool ok = (fsync(fd) == 0);
+    if(!ok) { LOG_ERROR("fsync dir %s error: %d", dir.c_str(), errno); }
+    close(fd);
+    return ok;
+}
+
+bool LocalAuth::Open(const char* path) {
+    assert(path);
+    Close();
+    // 01：打开并锁住文件
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if(fd < 0) {
+        LOG_ERROR("open auth file %s error: %d", path, errno);
+        return false;
+    }
+    if(flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        LOG_ERROR("auth file %s is used by another process", path);
+        close(fd);
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
+
+    // 02：新文件写入文件头
+    size_t size = st.st_size;
+    bool created = (size == 0);
+    if(created) {
+        size = FileSize_(INIT_SLOTS);
+        if(ftruncate(fd, size) < 0) {
+            LOG_ERROR("ftruncate auth file error: %d", errno);
+            close(fd);
+            return false;
+        }
+    }
+    char* base;
+    if(size < sizeof(Header) || !Map_(fd, size, &base)) {
+        close(fd);
+        return false;
+    }
+    Header* header = reinterpret_cast<Header*>(base);
+    if(!created && Blank_(base, size)) {
+        LOG_WARN("auth file %s has no header, re-initialized", path);
+        created = true;
+    }
+    if(created) {
+        memcpy(header->magic, MAGIC, sizeof(MAGIC));
+        header->version = VERSION;
+        header->slots = INIT_SLOTS;
+        msync(base, sizeof(Header), MS_SYNC);
+        SyncDir_(path);
+    }
+
+    // 03：检查文件头和大小
+    uint64_t slots = header->slots;
+    if(memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION ||
+       slots == 0 || (slots & (slots - 1)) != 0 || size != FileSize_(slots)) {
+        LOG_ERROR("auth file %s is corrupted", path);
+        munmap(base, size);
+        close(fd);
+        return false;
+    }
+
+    path_ = path;
+    fd_ = fd;
+    base_ = base;
+    size_ = size;
+    header_ = header;
+    slots_ = reinterpret_cast<Slot*>(base + sizeof(Header));
+    used_ = 0;
+    for(uint64_t i = 0; i < slots; i++) {
+        if(slots_[i].hash) { used_++; }
+    }
+    LOG_INFO("Auth file %s: %zu users, %llu slots", path, used_, (unsigned long long)slots);
+    return true;
+}
+
+void LocalAuth::Close() {
+    unique_lock<shared_mutex> locker(mtx_);
+    if(base_) {
+        munmap(base_, size_);
+        base_ = nullptr;
+    }
+    if(fd_ >= 0) {
+        close(fd_);     // 同时释放flock
+        fd_ = -1;
+    }
+    header_ = nullptr;
+    slots_ = nullptr;
+    used_ = 0;
+    pending_.clear();
+}
+
+// 返回同名的槽位，或者探测到的第一个空槽位
+LocalAuth::Slot* LocalAuth::Probe_(Slot* slots, uint64_t mask, string_view name, uint64_t hash) {
+    for(uint64_t i = hash & mask; ; i = (i + 1) & mask) {
+        Slot* slot = &slots[i];
+        if(slot->hash == 0) { return slot; }
+        if(slot->hash == hash && slot->nameLen == name.size() &&
+           memcmp(slot->name, name.data(), name.size()) == 0) {
+            return slot;
+        }
+    }
+}
+
+int LocalAuth::Lookup(string_view name, string* pwd, bool) {
+    assert(pwd);
+    if(name.size() > MAX_NAME) { return 0; }
+    uint64_t hash = Hash_(name);
+    shared_lock<shared_mutex> locker(mtx_);
+    if(!slots_) { return -1; }
+    // 正在同步的用户还不算注册成功
+    if(!pending_.empty() && find(pending_.begin(), pending_.end(), name) != pending_.end()) { return 0; }
+    Slot* slot = Probe_(slots_, header_->slots - 1, name, hash);
+    if(slot->hash == 0) { return 0; }
+    pwd->assign(slot->pwd, slot->pwdLen);
+    return 1;
+}
+
+// 写入一个新用户，不同步；[lo, hi)记录写过的范围（相对文件头），调用时持有独占锁
+int LocalAuth::Put_(string_view name, string_view pwd, size_t* lo, size_t* hi) {
+    if(name.size() > MAX_NAME || pwd.size() > MAX_PWD) {
+        LOG_WARN("Username or password too long");
+        return -1;
+    }
+    uint64_t hash = Hash_(name);
+    Slot* slot = Probe_(slots_, header_->slots - 1, name, hash);
+    if(slot->hash != 0) { return 0; }
+    // 先写内容，最后写哈希值，崩溃时不会出现半个用户
+    slot->nameLen = name.size();
+    slot->pwdLen = pwd.size();
+    memcpy(slot->name, name.data(), name.size());
+    memcpy(slot->pwd, pwd.data(), pwd.size());
+    slot->hash = hash;
+    used_++;
+
+    size_t offset = reinterpret_cast<char*>(slot) - base_;
+    *lo = min(*lo, offset);
+    *hi = max(*hi, offset + sizeof(Slot));
+    return 1;
+}
+
+void LocalAuth::InsertBatch(vector<Row*>& rows) {
+    lock_guard<mutex> batch(batchMtx_);
+    // 01：装载率会超过0.7时先扩容
+    while(true) {
+        {
+            shared_lock<shared_mutex> locker(mtx_);
+            if(!slots_) { return; }     // 结果默认为-1
+            if((used_ + rows.size()) * 10 <= header_->slots * 7) { break; }
+        }
+        if(!Grow_()) { return; }
+    }
+
+    // 02：独占锁下写槽位，这一批的用户名记为未同步
+    size_t lo, hi = 0;
+    {
+        unique_lock<shared_mutex> locker(mtx_);
+        if(!slots_) { return; }
+        lo = size_;
+        for(Row* row : rows) {
+            row->result = Put_(row->name, row->pwd, &lo, &hi);
+            if(row->result == 1) { pending_.push_back(row->name); }
+        }
+    }
+    if(lo >= hi) { return; }
+
+    // 03：一批只同步一次，msync只写回范围内的脏页；持有共享锁，查询照常进行
+    bool synced = true;
+    {
+        shared_lock<shared_mutex> locker(mtx_);
+        if(!slots_) { synced = false; }
+        else {
+            size_t page = sysconf(_SC_PAGESIZE);
+            lo &= ~(page - 1);
+            if(msync(base_ + lo, hi - lo, MS_SYNC) < 0) {
+                LOG_ERROR("msync auth file error: %d", errno);
+                synced = false;
+            }
+        }
+    }
+    Publish_(rows, synced);
+}
+
+// 同步成功时公开这一批用户；失败时清空这一批写入的槽位，之前的用户不会探测经过它们
+void LocalAuth::Publish_(vector<Row*>& rows, bool synced) {
+    unique_lock<shared_mutex> locker(mtx_);
+    if(synced) {
+        pending_.clear();
+        return;
+    }
+    if(slots_) {
+        // 先找全再清空：同一批的用户可能探测经过彼此的槽位
+        vector<Slot*> written;
+        for(string_view name : pending_) {
+            written.push_back(Probe_(slots_, header_->slots - 1, name, Hash_(name)));
+        }
+        for(Slot* slot : written) {
+            memset(slot, 0, sizeof(Slot));
+        }
+        used_ -= written.size();
+    }
+    pending_.clear();
+    for(Row* row : rows) {
+        if(row->result == 1) { row->result = -1; }
+    }
+}
+
+// 写一个两倍大的新文件，同步后rename替换旧文件并同步目录；调用时持有batchMtx_
+// 复制和同步只持有共享锁，替换映射时才独占
+bool LocalAuth::Grow_() {
+    shared_lock<shared_mutex> reader(mtx_);
+    if(!slots_) { return false; }
+    uint64_t slots = header_->slots * 2;
+    size_t size = FileSize_(slots);
+    string tmp = path_ + ".tmp";
+    int fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd < 0) {
+        LOG_ERROR("open %s error: %d", tmp.c_str(), errno);
+        return false;
+    }
+    char* base;
+    if(ftruncate(fd, size) < 0 || !Map_(fd, size, &base)) {
+        close(fd);
+        unlink(tmp.c_str());
+        return false;
+    }
+    Header* header = reinterpret_cast<Header*>(base);
+    memcpy(header, header_, sizeof(Header));
+    header->slots = slots;
+    Slot* newSlots = reinterpret_cast<Slot*>(base + sizeof(Header));
+    for(uint64_t i = 0; i < header_->slots; i++) {
+        const Slot& old = slots_[i];
+        if(old.hash == 0) { continue; }
+        Slot* slot = Probe_(newSlots, slots - 1, string_view(old.name, old.nameLen), old.hash);
+        memcpy(slot, &old, sizeof(Slot));
+    }
+    if(msync(base, size, MS_SYNC) < 0 || flock(fd, LOCK_EX | LOCK_NB) < 0 ||
+       rename(tmp.c_str(), path_.c_str()) < 0) {
+        LOG_ERROR("replace auth file error: %d", errno);
+        munmap(base, size);
+        close(fd);
+        unlink(tmp.c_str());
+        return false;
+    }
+    // rename只改了目录项：同步目录后新文件才算替换完成；失败时新文件已经生效，只记录错误
+    SyncDir_(path_);
+    reader.unlock();
+
+    unique_lock<shared_mutex> locker(mtx_);
+    if(!slots_) {       // 期间被关闭
+        munmap(base, size);
+        close(fd);
+        return false;
+    }
+    munmap(base_, size_);
+    close(fd_);
+    fd_ = fd;
+    base_ = base;
+    size_ = size;
+    header_ = header;
+    slots_ = newSlots;
+    LOG_INFO("Auth file grown to %llu slots", (unsigned long long)slots);
+    return true;
+}
+
+size_t LocalAuth::Size() {
+    shared_lock<shared_mutex> locker(mtx_);
+    return used_;
+}
+
+size_t LocalAuth::Capacity() {
+    shared_lock<shared_mutex> locker(mtx_);
+    return header_ ? header_->slots : 0;
+}
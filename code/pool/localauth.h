@@ -0,0 +1,84 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-19
+ * @copyleft Apache 2.0
+ */
+#ifndef LOCALAUTH_H
+#define LOCALAUTH_H
+
+#include <string>
+#include <string_view>
+#include <shared_mutex>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include "authbackend.h"
+
+/* 本地用户表：文件整个mmap进来，开放寻址（线性探测）的哈希表，没有网络往返
+   每个槽位128字节，不跨页；新用户先写内容最后写哈希值，一批注册写完后一次msync，返回时已持久
+   msync只持有共享锁，查询不被阻塞；同步完成前这一批用户查不到，同步失败时清掉这一批的槽位
+   装载率超过0.7时写一个两倍大的新文件再rename替换；文件加了flock，只能有一个进程打开
+   字段长度与user表一致（char(50)） */
+class LocalAuth : public AuthBackend {
+public:
+    static const int MAX_NAME = 50;
+    static const int MAX_PWD = 50;
+
+    LocalAuth();
+    ~LocalAuth();
+
+    bool Open(const char* path);
+    void Close();
+
+    int Lookup(std::string_view name, std::string* pwd, bool fresh = false) override;
+
+    size_t Size();
+    size_t Capacity();
+
+protected:
+    void InsertBatch(std::vector<Row*>& rows) override;
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t slots;         // 槽位数，2的幂
+        char pad[104];          // 补足一个槽位大小，槽位不跨页
+    };
+
+    struct Slot {
+        uint64_t hash;          // 0表示空槽位
+        uint8_t nameLen;
+        uint8_t pwdLen;
+        char name[MAX_NAME];
+        char pwd[MAX_PWD];
+        char pad[18];
+    };
+
+    static const uint32_t VERSION = 1;
+    static const uint64_t INIT_SLOTS = 1024;
+
+    static uint64_t Hash_(std::string_view name);
+    static size_t FileSize_(uint64_t slots);
+    static bool Blank_(const char* base, size_t size);
+    static bool SyncDir_(const std::string& path);
+    Slot* Probe_(Slot* slots, uint64_t mask, std::string_view name, uint64_t hash);
+    bool Map_(int fd, size_t size, char** base);
+    bool Grow_();
+    int Put_(std::string_view name, std::string_view pwd, size_t* lo, size_t* hi);
+    void Publish_(std::vector<Row*>& rows, bool synced);
+
+    std::string path_;
+    int fd_;
+    char* base_;
+    size_t size_;
+    Header* header_;
+    Slot* slots_;
+    size_t used_;
+    std::shared_mutex mtx_;     // 查询和同步共享，写槽位和替换映射独占
+    std::mutex batchMtx_;       // 一次只写一批
+    std::vector<std::string_view> pending_;     // 已写入、还没同步完成的用户名
+};
+
+#endif // LOCALAUTH_H
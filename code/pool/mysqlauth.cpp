@@ -0,0 +1,153 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-19
+ * @copyleft Apache 2.0
+ */
+
+#define LOG_MODULE Log::MODULE_POOL
+#include "mysqlauth.h"
+#include "sqlconnRAII.h"
+#include "sqlreplicas.h"
+#include "../metrics/metrics.h"
+#include <cstring>
+#include <unordered_set>
+
+using namespace std;
+
+// 参数按二进制协议发送，不拼接SQL
+static void BindString(MYSQL_BIND* bind, string_view str, unsigned long* len) {
+    *len = str.size();
+    memset(bind, 0, sizeof(*bind));
+    bind->buffer_type = MYSQL_TYPE_STRING;
+    bind->buffer = const_cast<char*>(str.data());
+    bind->buffer_length = *len;
+    bind->length = len;
+}
+
+int MySqlAuth::Lookup_(MYSQL* sql, SqlStmtCache* stmts, string_view name, string* pwd) {
+    unsigned long nameLen;
+    MYSQL_BIND param;
+    BindString(&param, name, &nameLen);
+
+    char password[256];
+    unsigned long passwordLen = 0;
+    MYSQL_BIND result;
+    memset(&result, 0, sizeof(result));
+    result.buffer_type = MYSQL_TYPE_STRING;
+    result.buffer = password;
+    result.buffer_length = sizeof(password);
+    result.length = &passwordLen;
+
+    int found = stmts->Execute(sql, SqlStmtCache::SELECT_USER, &param, &result);
+    if(found == 1) {
+        // 超过缓冲区时被截断，当作出错，不能拿截断的密码去比较
+        if(passwordLen > sizeof(password)) { return -1; }
+        pwd->assign(password, passwordLen);
+    }
+    return found;
+}
+
+int MySqlAuth::Insert_(MYSQL* sql, SqlStmtCache* stmts, const Row* row, bool retry) {
+    unsigned long nameLen, pwdLen;
+    MYSQL_BIND params[2];
+    BindString(&params[0], row->name, &nameLen);
+    BindString(&params[1], row->pwd, &pwdLen);
+    return stmts->Execute(sql, SqlStmtCache::INSERT_USER, params, nullptr, retry) == 1 ? 1 : -1;
+}
+
+int MySqlAuth::Lookup_(SqlConnPool* pool, string_view name, string* pwd) {
+    MYSQL* sql;
+    SqlConnRAII conn(&sql, pool);
+    SqlStmtCache* stmts = sql ? pool->Stmts(sql) : nullptr;
+    if(!stmts) { return -1; }
+    return Lookup_(sql, stmts, name, pwd);
+}
+
+int MySqlAuth::Lookup(string_view name, string* pwd, bool fresh) {
+    assert(pwd);
+    SqlReplicas* replicas = SqlReplicas::Instance();
+    if(replicas->Size() > 0) {
+        if(fresh || replicas->Pinned(name)) {
+            // 01：注册前的检查和刚注册过的用户：副本可能还没复制到，读主库
+            Metrics::Add(Metrics::SQL_PINNED_READS);
+        }
+        else {
+            // 02：读进行中的查询最少的副本，连不上或出错时改读主库
+            int i = replicas->Pick();
+            if(i >= 0) {
+                int found = Lookup_(replicas->Pool(i), name, pwd);
+                replicas->Done(i);
+                if(found >= 0) {
+                    Metrics::Add(Metrics::SQL_REPLICA_READS);
+                    return found;
+                }
+            }
+            Metrics::Add(Metrics::SQL_REPLICA_FALLBACKS);
+        }
+    }
+    return Lookup_(SqlConnPool::Instance(), name, pwd);
+}
+
+// 整批在一个事务中插入，只提交一次；任何一步失败都回滚
+bool MySqlAuth::InsertTx_(MYSQL* sql, SqlStmtCache* stmts, vector<Row*>& rows) {
+    if(mysql_autocommit(sql, 0)) { return false; }
+    bool ok = true;
+    for(Row* row : rows) {
+        if(Insert_(sql, stmts, row, false) != 1) {
+            ok = false;
+            break;
+        }
+    }
+    ok = ok && mysql_commit(sql) == 0;
+    if(!ok) {
+        LOG_WARN("Register batch of %zu failed: %s", rows.size(), mysql_error(sql));
+        mysql_rollback(sql);
+    }
+    mysql_autocommit(sql, 1);
+    if(ok) {
+        for(Row* row : rows) { row->result = 1; }
+    }
+    return ok;
+}
+
+void MySqlAuth::InsertBatch(vector<Row*>& rows) {
+    MYSQL* sql;
+    SqlConnRAII conn(&sql, SqlConnPool::Instance());
+    SqlStmtCache* stmts = sql ? SqlConnPool::Instance()->Stmts(sql) : nullptr;
+    if(!stmts) { return; }      // 结果默认为-1
+
+    // 01：同一批中重复的用户名只插入第一个
+    // user表没有唯一键，用户名是否已被使用由调用者先查询
+    vector<Row*> inserts;
+    unordered_set<string_view> names;
+    for(Row* row : rows) {
+        if(names.insert(row->name).second) { inserts.push_back(row); }
+        else { row->result = 0; }
+    }
+
+    // 02：多行时放在一个事务里，只提交一次
+    bool tried = inserts.size() > 1;
+    if(!tried || !InsertTx_(sql, stmts, inserts)) {
+        InsertRows_(sql, stmts, inserts, tried);
+    }
+
+    // 03：新用户在复制到副本之前读主库
+    SqlReplicas* replicas = SqlReplicas::Instance();
+    for(Row* row : inserts) {
+        if(row->result == 1) { replicas->Pin(row->name); }
+    }
+}
+
+void MySqlAuth::InsertRows_(MYSQL* sql, SqlStmtCache* stmts, vector<Row*>& rows, bool tried) {
+
+    // 单行或事务失败：逐条自动提交
+    // 提交时连接断开的话事务可能已经生效，先查一下，避免重复插入
+    for(Row* row : rows) {
+        string stored;
+        if(tried && Lookup_(sql, stmts, row->name, &stored) == 1) {
+            row->result = stored == row->pwd ? 1 : 0;
+            continue;
+        }
+        row->result = Insert_(sql, stmts, row, true);
+    }
+}
@@ -0,0 +1,32 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-19
+ * @copyleft Apache 2.0
+ */
+#ifndef MYSQLAUTH_H
+#define MYSQLAUTH_H
+
+#include <mysql/mysql.h>
+#include "authbackend.h"
+#include "sqlconnpool.h"
+
+/* user表：从SqlConnPool借连接，执行连接上缓存的预编译语句
+   一批注册放在一个事务里提交；事务失败时逐条自动提交，每个请求仍得到自己的结果
+   配置了只读副本时登录查询读副本（见SqlReplicas），注册和刚注册过的用户读主库 */
+class MySqlAuth : public AuthBackend {
+public:
+    int Lookup(std::string_view name, std::string* pwd, bool fresh = false) override;
+    bool NeedSqlPool() const override { return true; }
+
+protected:
+    void InsertBatch(std::vector<Row*>& rows) override;
+
+private:
+    static int Lookup_(MYSQL* sql, SqlStmtCache* stmts, std::string_view name, std::string* pwd);
+    static int Lookup_(SqlConnPool* pool, std::string_view name, std::string* pwd);
+    static int Insert_(MYSQL* sql, SqlStmtCache* stmts, const Row* row, bool retry);
+    static bool InsertTx_(MYSQL* sql, SqlStmtCache* stmts, std::vector<Row*>& rows);
+    static void InsertRows_(MYSQL* sql, SqlStmtCache* stmts, std::vector<Row*>& rows, bool tried);
+};
+
+#endif // MYSQLAUTH_H
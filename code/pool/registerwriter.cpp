@@ -0,0 +1,64 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-19
+ * @copyleft Apache 2.0
+ */
+
+#include "registerwriter.h"
+#include "../metrics/metrics.h"
+#include <assert.h>
+
+using namespace std;
+
+RegisterWriter::RegisterWriter(Flush flush)
+    : flush_(move(flush)), windowUs_(0), maxBatch_(1), collecting_(false), flushing_(0) {
+    assert(flush_);
+}
+
+void RegisterWriter::SetBatch(int windowUs, int maxBatch) {
+    lock_guard<mutex> locker(mtx_);
+    windowUs_ = windowUs > 0 ? windowUs : 0;
+    maxBatch_ = maxBatch > 1 ? maxBatch : 1;
+}
+
+int RegisterWriter::Submit(string_view name, string_view pwd) {
+    Row row;
+    row.name = name;
+    row.pwd = pwd;
+    unique_lock<mutex> locker(mtx_);
+    pending_.push_back(&row);
+    if(collecting_) {
+        // 01：已有leader：凑满时提前叫醒它，然后等这一行的结果
+        if(pending_.size() >= maxBatch_) { leaderCond_.notify_one(); }
+        doneCond_.wait(locker, [&row] { return row.done; });
+        return row.result;
+    }
+
+    // 02：成为leader：定时窗口等到窗口结束，否则只在有批次正在写入时等待，都在凑满一批时提前结束
+    collecting_ = true;
+    auto full = [this] { return pending_.size() >= maxBatch_; };
+    if(windowUs_ > 0) {
+        auto deadline = chrono::steady_clock::now() + chrono::microseconds(windowUs_);
+        leaderCond_.wait_until(locker, deadline, full);
+    } else {
+        leaderCond_.wait(locker, [this, &full] { return flushing_ == 0 || full(); });
+    }
+    vector<Row*> rows;
+    rows.swap(pending_);
+    collecting_ = false;
+    flushing_++;
+    locker.unlock();
+
+    // 03：在锁外写入，之后到达的注册由新的leader收集
+    flush_(rows);
+    Metrics::Add(Metrics::REGISTER_BATCHES);
+    Metrics::Add(Metrics::REGISTER_ROWS, rows.size());
+
+    locker.lock();
+    flushing_--;
+    for(Row* r : rows) { r->done = true; }
+    locker.unlock();
+    leaderCond_.notify_one();
+    doneCond_.notify_all();
+    return row.result;
+}
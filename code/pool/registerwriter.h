@@ -0,0 +1,49 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-19
+ * @copyleft Apache 2.0
+ */
+#ifndef REGISTERWRITER_H
+#define REGISTERWRITER_H
+
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+
+/* 注册的组提交：多个线程同时注册时，先到的线程作为leader收集一批，一起交给flush写入
+   （一次事务/一次刷盘），其余线程等待自己那一行的结果
+   windowUs为0时不定时等待：没有正在写入的批次就立即写入，否则等上一批写完（或凑满一批），
+   上一批写入期间到达的注册自然合并；windowUs大于0时leader总是等待这个窗口（或凑满一批）
+   leader取走一批后下一个到达的线程成为新的leader */
+class RegisterWriter {
+public:
+    struct Row {
+        std::string_view name;
+        std::string_view pwd;
+        int result = -1;        // 1成功，0用户名已被使用，-1出错
+        bool done = false;
+    };
+    typedef std::function<void(std::vector<Row*>& rows)> Flush;
+
+    explicit RegisterWriter(Flush flush);
+
+    // maxBatch为1时不等待，每个注册单独写入
+    void SetBatch(int windowUs, int maxBatch);
+    int Submit(std::string_view name, std::string_view pwd);
+
+private:
+    Flush flush_;
+    int windowUs_;
+    size_t maxBatch_;
+    bool collecting_;           // 已有leader在收集
+    int flushing_;              // 正在写入的批次数
+    std::vector<Row*> pending_;
+    std::mutex mtx_;
+    std::condition_variable leaderCond_;    // 凑满一批或一批写完时唤醒leader
+    std::condition_variable doneCond_;      // 一批写完时唤醒等待结果的线程
+};
+
+#endif // REGISTERWRITER_H
@@ -0,0 +1,117 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-19
+ * @copyleft Apache 2.0
+ */
+
+#define LOG_MODULE Log::MODULE_POOL
+#include "sessionstore.h"
+#include "../log/log.h"
+#include <sys/random.h>
+#include <functional>
+#include <cstring>
+#include <assert.h>
+
+using namespace std;
+
+SessionStore::SessionStore() : ttlSec_(0), shardMax_(0) {}
+
+SessionStore* SessionStore::Instance() {
+    static SessionStore store;
+    return &store;
+}
+
+void SessionStore::Init(int ttlSec, size_t maxSessions) {
+    ttlSec_ = ttlSec > 0 ? ttlSec : 0;
+    shardMax_ = (maxSessions + SHARDS - 1) / SHARDS;
+}
+
+SessionStore::Shard& SessionStore::ShardOf_(string_view id) {
+    return shards_[hash<string_view>()(id) % SHARDS];
+}
+
+bool SessionStore::Create(string_view user, char* id) {
+    assert(id);
+    if(!IsOpen()) { return false; }
+    // 01：会话id必须不可预测，直接取内核随机数
+    unsigned char bytes[ID_LEN / 2];
+    if(getrandom(bytes, sizeof(bytes), 0) != (ssize_t)sizeof(bytes)) {
+        LOG_ERROR("getrandom error: %d", errno);
+        return false;
+    }
+    static const char HEX[] = "0123456789abcdef";
+    for(int i = 0; i < ID_LEN / 2; i++) {
+        id[2 * i] = HEX[bytes[i] >> 4];
+        id[2 * i + 1] = HEX[bytes[i] & 0xf];
+    }
+
+    // 02：写入所在分片
+    string key(id, ID_LEN);
+    Shard& shard = ShardOf_(key);
+    lock_guard<mutex> locker(shard.mtx);
+    if(shard.sessions.size() >= shardMax_) {
+        LOG_WARN("Sessions are full!");
+        return false;
+    }
+    Clock::time_point expires = Clock::now() + chrono::seconds(ttlSec_);
+    shard.sessions[key] = { string(user), expires };
+    shard.order.emplace_back(expires, move(key));
+    return true;
+}
+
+bool SessionStore::Find(string_view id, string* user) {
+    if(!IsOpen() || id.size() != ID_LEN) { return false; }
+    Shard& shard = ShardOf_(id);
+    lock_guard<mutex> locker(shard.mtx);
+    auto it = shard.sessions.find(string(id));
+    // 过期但还没被清理的会话视为不存在
+    if(it == shard.sessions.end() || Clock::now() >= it->second.expires) {
+        return false;
+    }
+    if(user) { *user = it->second.user; }
+    return true;
+}
+
+// Cookie: a=1; sid=0123...; b=2
+string_view SessionStore::ParseCookie(string_view cookie) {
+    size_t nameLen = strlen(COOKIE);
+    size_t pos = 0;
+    while(pos < cookie.size()) {
+        while(pos < cookie.size() && (cookie[pos] == ' ' || cookie[pos] == ';')) { pos++; }
+        size_t end = cookie.find(';', pos);
+        if(end == string_view::npos) { end = cookie.size(); }
+        string_view pair = cookie.substr(pos, end - pos);
+        if(pair.size() > nameLen && pair.compare(0, nameLen, COOKIE) == 0 && pair[nameLen] == '=') {
+            return pair.substr(nameLen + 1);
+        }
+        pos = end;
+    }
+    return {};
+}
+
+size_t SessionStore::Expire() {
+    size_t removed = 0;
+    Clock::time_point now = Clock::now();
+    for(Shard& shard : shards_) {
+        lock_guard<mutex> locker(shard.mtx);
+        // 队头是最早到期的，遇到未到期的就停
+        while(!shard.order.empty() && shard.order.front().first <= now) {
+            auto it = shard.sessions.find(shard.order.front().second);
+            if(it != shard.sessions.end() && it->second.expires <= now) {
+                shard.sessions.erase(it);
+                removed++;
+            }
+            shard.order.pop_front();
+        }
+    }
+    return removed;
+}
+
+size_t SessionStore::Size() {
+    size_t n = 0;
+    for(Shard& shard : shards_) {
+        lock_guard<mutex> locker(shard.mtx);
+        n += shard.sessions.size();
+    }
+    return n;
+}
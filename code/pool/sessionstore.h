@@ -0,0 +1,71 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-19
+ * @copyleft Apache 2.0
+ */
+#ifndef SESSIONSTORE_H
+#define SESSIONSTORE_H
+
+#include <string>
+#include <string_view>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <deque>
+
+/* 登录会话：登录/注册成功后发放随机会话id（Set-Cookie），之后带着Cookie的请求
+   在解析首部时查表得到用户名，需要登录的页面不再访问数据库
+   按会话id分片，每片一把锁；过期的会话查找时直接忽略，
+   由服务器的定时器周期性调用Expire()清理（见WebServer::SweepSessions_）
+   有效期都相同，每片按创建顺序另记一个到期队列，清理时只看队头，开销与过期个数成正比 */
+class SessionStore {
+public:
+    static SessionStore* Instance();
+
+    static constexpr const char* COOKIE = "sid";    // Cookie名
+    static const int ID_LEN = 32;                   // 128位随机数的十六进制
+    static const int SWEEP_MS = 10000;              // 定时清理的间隔
+
+    // ttlSec为0时关闭会话，maxSessions为会话总数上限
+    void Init(int ttlSec, size_t maxSessions);
+    bool IsOpen() const { return ttlSec_ > 0; }
+    int TtlSec() const { return ttlSec_; }
+
+    // 新建会话，写入id（ID_LEN个字符），会话已满时返回false
+    bool Create(std::string_view user, char* id);
+    // 查找会话，找到时把用户名写入user
+    bool Find(std::string_view id, std::string* user);
+    // 从Cookie首部中取出会话id，没有时返回空
+    static std::string_view ParseCookie(std::string_view cookie);
+
+    size_t Expire();        // 删除过期的会话，返回删除的个数
+    size_t Size();
+
+private:
+    SessionStore();
+    ~SessionStore() = default;
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Session {
+        std::string user;
+        Clock::time_point expires;
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mtx;
+        std::unordered_map<std::string, Session> sessions;
+        std::deque<std::pair<Clock::time_point, std::string>> order;   // 按到期时间排列，清理用
+    };
+
+    static const int SHARDS = 16;
+
+    Shard& ShardOf_(std::string_view id);
+
+    int ttlSec_;
+    size_t shardMax_;       // 每片的会话数上限
+    Shard shards_[SHARDS];
+};
+
+#endif // SESSIONSTORE_H
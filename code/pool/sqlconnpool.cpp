@@ -2,15 +2,30 @@
  * @Author       : mark
  * @Date         : 2020-06-17
  * @copyleft Apache 2.0
- */ 
+ */
 
+#define LOG_MODULE Log::MODULE_POOL
 #include "sqlconnpool.h"
+#include "../metrics/metrics.h"
 using namespace std;
 
+static uint64_t Usec(chrono::steady_clock::duration d) {
+    return chrono::duration_cast<chrono::microseconds>(d).count();
+}
+
 // 构造函数
 SqlConnPool::SqlConnPool() {
-    useCount_ = 0;
-    freeCount_ = 0;
+    port_ = 0;
+    MAX_CONN_ = 0;
+    minConn_ = 0;
+    waitMs_ = 0;
+    total_ = 0;
+    busy_ = 0;
+    opening_ = 0;
+    waiting_ = 0;
+    grow_ = 0;
+    isClosed_ = false;
+    backoffMs_ = MIN_BACKOFF_MS;
 }
 
 // 单例
@@ -22,68 +37,301 @@ SqlConnPool* SqlConnPool::Instance() {
 // 初始化数据库连接池
 void SqlConnPool::Init(const char* host, int port,
             const char* user,const char* pwd, const char* dbName,
-            int connSize = 10) {
+            int connSize, int minSize, int waitMs) {
     assert(connSize > 0);
-
-    // 创建10个数据库连接描述符
-    for (int i = 0; i < connSize; i++) {
-        MYSQL *sql = nullptr;
-        sql = mysql_init(sql);
-        if (!sql) {
-            LOG_ERROR("MySql init error!");
-            assert(sql);
-        }
-        sql = mysql_real_connect(sql, host,
-                                 user, pwd,
-                                 dbName, port, nullptr, 0);
-        if (!sql) {
-            LOG_ERROR("MySql Connect error!");
-        }
-        connQue_.push(sql);
-    }
+    host_ = host;
+    port_ = port;
+    user_ = user;
+    pwd_ = pwd;
+    dbName_ = dbName;
     MAX_CONN_ = connSize;   // 最大连接数
-    sem_init(&semId_, 0, MAX_CONN_);    // 信号量
+    minConn_ = (minSize < 0 || minSize > connSize) ? connSize : minSize;
+    waitMs_ = waitMs > 0 ? waitMs : 0;
+
+    // 不在这里建立连接：后台线程并发建立，调用者（服务器启动）不用等待
+    maintainer_ = thread(&SqlConnPool::Maintain_, this);
 }
 
-// 获取一个连接标识
-MYSQL* SqlConnPool::GetConn() {
-    MYSQL *sql = nullptr;
-    if(connQue_.empty()){
-        LOG_WARN("SqlConnPool busy!");
+// 建立一个连接，不持有锁
+MYSQL* SqlConnPool::Connect_() {
+    MYSQL *sql = mysql_init(nullptr);
+    if (!sql) {
+        LOG_ERROR("MySql init error!");
         return nullptr;
     }
-    sem_wait(&semId_);
-    {
-        lock_guard<mutex> locker(mtx_);
-        sql = connQue_.front();
-        connQue_.pop();
+    // 断线后自动重连，预编译语句由SqlStmtCache发现线程id变化后重新编译
+    bool reconnect = true;
+    mysql_options(sql, MYSQL_OPT_RECONNECT, &reconnect);
+    // 数据库无响应时查询最终会失败返回，不会一直占住线程
+    unsigned int timeout = TIMEOUT_SEC;
+    mysql_options(sql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+    mysql_options(sql, MYSQL_OPT_READ_TIMEOUT, &timeout);
+    mysql_options(sql, MYSQL_OPT_WRITE_TIMEOUT, &timeout);
+    if (!mysql_real_connect(sql, host_.c_str(), user_.c_str(), pwd_.c_str(),
+                            dbName_.c_str(), port_, nullptr, 0)) {
+        LOG_ERROR("MySql Connect error (%s:%d): %s", host_.c_str(), port_, mysql_error(sql));
+        mysql_close(sql);
+        Metrics::Add(Metrics::SQL_CONNECT_ERRORS);
+        return nullptr;
     }
     return sql;
 }
 
+// 后台建立一个连接，建好立即放入空闲队列，等待中的请求不用等其他连接
+bool SqlConnPool::Open_() {
+    MYSQL* sql = Connect_();
+    lock_guard<mutex> locker(mtx_);
+    opening_--;
+    if(!sql) {
+        total_--;
+        cond_.notify_all();     // 等待者重新判断是否自己建立连接
+        return false;
+    }
+    Add_(sql);
+    idle_.push_back(sql);
+    cond_.notify_one();
+    return true;
+}
+
+// 以下两个函数调用时持有锁；total_在建立连接前已经加过
+void SqlConnPool::Add_(MYSQL* sql) {
+    Conn& conn = conns_[sql];
+    conn.stmts.reset(new SqlStmtCache());
+    conn.lastUsed = conn.lastCheck = Clock::now();
+    backoffMs_ = MIN_BACKOFF_MS;
+}
+
+// 从表中删除，返回的语句缓存要在mysql_close前释放
+unique_ptr<SqlStmtCache> SqlConnPool::Detach_(MYSQL* sql) {
+    auto it = conns_.find(sql);
+    assert(it != conns_.end());
+    unique_ptr<SqlStmtCache> stmts = move(it->second.stmts);
+    conns_.erase(it);
+    total_--;
+    return stmts;
+}
+
+void SqlConnPool::Close_(MYSQL* sql, unique_ptr<SqlStmtCache> stmts) {
+    stmts.reset();      // 语句要在连接关闭前释放
+    mysql_close(sql);
+}
+
+// 建立连接失败：一段时间内不再尝试，间隔逐次翻倍
+void SqlConnPool::Backoff_() {
+    retryAt_ = Clock::now() + chrono::milliseconds(backoffMs_);
+    backoffMs_ = min(backoffMs_ * 2, (int)MAX_BACKOFF_MS);
+}
+
+// 获取一个连接标识
+MYSQL* SqlConnPool::GetConn() {
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + chrono::milliseconds(waitMs_);
+    bool waited = false;
+    unique_lock<mutex> locker(mtx_);
+    while(!isClosed_) {
+        // 01：有空闲连接直接取，最近归还的先用
+        if(!idle_.empty()) {
+            MYSQL* sql = idle_.back();
+            idle_.pop_back();
+            busy_++;
+            Clock::time_point now = Clock::now();
+            conns_[sql].borrowed = now;
+            locker.unlock();
+            if(waited) { Metrics::Add(Metrics::SQL_WAITS); }
+            Metrics::Record(Metrics::HIST_SQL_ACQUIRE, Usec(now - start));
+            return sql;
+        }
+        // 02：没到上限且不在退避期：请求后台线程建立新连接，建好后放入空闲队列
+        // 连接超时比waitMs长，不在当前线程建立；正在建立的连接比其他等待者多时（如刚启动），等那些连接就够了
+        Clock::time_point now = Clock::now();
+        if(total_ < MAX_CONN_ && now >= retryAt_ && opening_ <= waiting_) {
+            total_++;
+            opening_++;
+            grow_++;
+            maintainCond_.notify_one();
+        }
+        // 03：等待归还或新建的连接，或等到退避结束再试
+        if(now >= deadline) { break; }
+        waited = true;
+        Clock::time_point until = deadline;
+        if(total_ < MAX_CONN_ && now < retryAt_ && retryAt_ < until) { until = retryAt_; }
+        waiting_++;
+        cond_.wait_until(locker, until);
+        waiting_--;
+    }
+    locker.unlock();
+    Metrics::Add(Metrics::SQL_TIMEOUTS);
+    Metrics::Record(Metrics::HIST_SQL_ACQUIRE, Usec(Clock::now() - start));
+    LOG_WARN("SqlConnPool busy!");
+    return nullptr;
+}
+
 // 返回一个sql描述符
 void SqlConnPool::FreeConn(MYSQL* sql) {
     assert(sql);
-    lock_guard<mutex> locker(mtx_);
-    connQue_.push(sql);
-    sem_post(&semId_);
+    unique_lock<mutex> locker(mtx_);
+    auto it = conns_.find(sql);
+    assert(it != conns_.end());
+    Clock::time_point now = Clock::now();
+    uint64_t held = Usec(now - it->second.borrowed);
+    busy_--;
+    if(isClosed_) {
+        // 连接池已关闭：直接关闭连接
+        unique_ptr<SqlStmtCache> stmts = Detach_(sql);
+        locker.unlock();
+        Metrics::Record(Metrics::HIST_SQL_HOLD, held);
+        Close_(sql, move(stmts));
+        return;
+    }
+    it->second.lastUsed = it->second.lastCheck = now;
+    idle_.push_back(sql);
+    locker.unlock();
+    // 统计在锁外记录：/metrics抓取时持有统计的锁再读连接池（gauge），两把锁的顺序不能反过来
+    Metrics::Record(Metrics::HIST_SQL_HOLD, held);
+    cond_.notify_one();
+}
+
+// 后台线程：补足最小连接数，回收空闲连接，ping长时间未用的连接
+void SqlConnPool::Maintain_() {
+    unique_lock<mutex> locker(mtx_);
+    while(!isClosed_) {
+        // 01：补足最小连接数，加上取连接的线程请求的连接，每个连接一个线程并发建立
+        // 有失败时等退避结束再补足最小连接数
+        int need = Clock::now() >= retryAt_ ? max(minConn_ - total_, 0) : 0;
+        if(need > 0 || grow_ > 0) {
+            total_ += need;
+            opening_ += need;
+            need += grow_;
+            grow_ = 0;
+            locker.unlock();
+            Clock::time_point start = Clock::now();
+            atomic<int> failed(0);
+            vector<thread> openers;
+            for(int i = 0; i < need; i++) {
+                openers.emplace_back([this, &failed] { if(!Open_()) { failed++; } });
+            }
+            for(thread& t : openers) { t.join(); }
+            LOG_INFO("SqlConnPool %s:%d: %d/%d connections opened in %lldms", host_.c_str(), port_,
+                     need - failed.load(), need,
+                     (long long)chrono::duration_cast<chrono::milliseconds>(Clock::now() - start).count());
+            locker.lock();
+            if(failed > 0) { Backoff_(); }
+            continue;
+        }
+
+        // 02：从表头（最久未用）开始，关闭超过minConn_的空闲连接
+        Clock::time_point now = Clock::now();
+        vector<pair<MYSQL*, unique_ptr<SqlStmtCache>>> closing;
+        while(total_ > minConn_ && !idle_.empty() &&
+              now - conns_[idle_.front()].lastUsed > chrono::milliseconds(SHRINK_IDLE_MS)) {
+            MYSQL* sql = idle_.front();
+            idle_.pop_front();
+            closing.emplace_back(sql, Detach_(sql));
+        }
+
+        // 03：取出很久没确认过的空闲连接，在锁外ping
+        vector<MYSQL*> checking;
+        for(auto it = idle_.begin(); it != idle_.end(); ) {
+            if(now - conns_[*it].lastCheck > chrono::milliseconds(PING_IDLE_MS)) {
+                checking.push_back(*it);
+                it = idle_.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        if(!closing.empty() || !checking.empty()) {
+            locker.unlock();
+            for(auto& item : closing) {
+                Close_(item.first, move(item.second));
+            }
+            vector<bool> alive;
+            for(MYSQL* sql : checking) {
+                // 开启了自动重连，ping失败说明重连也失败了
+                alive.push_back(mysql_ping(sql) == 0);
+            }
+            locker.lock();
+            closing.clear();
+            int broken = 0;
+            for(size_t i = 0; i < checking.size(); i++) {
+                MYSQL* sql = checking[i];
+                if(alive[i]) {
+                    conns_[sql].lastCheck = Clock::now();
+                    idle_.push_front(sql);
+                    cond_.notify_one();
+                }
+                else {
+                    LOG_WARN("MySql ping error: %s", mysql_error(sql));
+                    broken++;
+                    closing.emplace_back(sql, Detach_(sql));
+                }
+            }
+            if(!closing.empty()) {
+                locker.unlock();
+                Metrics::Add(Metrics::SQL_BROKEN, broken);     // 锁外记录，见FreeConn
+                for(auto& item : closing) {
+                    Close_(item.first, move(item.second));
+                }
+                locker.lock();
+                continue;       // 立即补足
+            }
+        }
+
+        // 04：退避期间按退避时间醒来，否则定期检查
+        Clock::time_point until = Clock::now() + chrono::milliseconds(CHECK_MS);
+        if(total_ < minConn_ && retryAt_ < until) { until = retryAt_; }
+        if(grow_ == 0) { maintainCond_.wait_until(locker, until); }
+    }
 }
 
 // 关闭连接池
 void SqlConnPool::ClosePool() {
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(isClosed_) { return; }
+        isClosed_ = true;
+    }
+    maintainCond_.notify_all();
+    cond_.notify_all();
+    if(maintainer_.joinable()) { maintainer_.join(); }
+
+    // 借出的连接在归还时关闭
     lock_guard<mutex> locker(mtx_);
-    while(!connQue_.empty()) {
-        auto item = connQue_.front();
-        connQue_.pop();
-        mysql_close(item);
+    while(!idle_.empty()) {
+        MYSQL* sql = idle_.front();
+        idle_.pop_front();
+        Close_(sql, Detach_(sql));
     }
-    mysql_library_end();    // 关闭mysql整体资源     
+    // 主库的连接池最后关闭（在副本之后），由它释放mysql整体资源
+    if(this == Instance()) { mysql_library_end(); }
+}
+
+SqlStmtCache* SqlConnPool::Stmts(MYSQL* conn) {
+    assert(conn);
+    lock_guard<mutex> locker(mtx_);
+    auto it = conns_.find(conn);
+    return it == conns_.end() ? nullptr : it->second.stmts.get();
 }
 
 // 空闲连接数量
 int SqlConnPool::GetFreeConnCount() {
     lock_guard<mutex> locker(mtx_);
-    return connQue_.size();
+    return idle_.size();
+}
+
+int SqlConnPool::GetConnCount() {
+    lock_guard<mutex> locker(mtx_);
+    return total_;
+}
+
+int SqlConnPool::GetBusyConnCount() {
+    lock_guard<mutex> locker(mtx_);
+    return busy_;
+}
+
+bool SqlConnPool::Available() {
+    lock_guard<mutex> locker(mtx_);
+    return !isClosed_ && (total_ > opening_ || Clock::now() >= retryAt_);
 }
 
 // 析构函数
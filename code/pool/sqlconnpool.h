@@ -2,43 +2,100 @@
  * @Author       : mark
  * @Date         : 2020-06-16
  * @copyleft Apache 2.0
- */ 
+ */
 #ifndef SQLCONNPOOL_H
 #define SQLCONNPOOL_H
 
 #include <mysql/mysql.h>
 #include <string>
-#include <queue>
+#include <deque>
+#include <vector>
 #include <mutex>
-#include <semaphore.h>
+#include <memory>
+#include <chrono>
+#include <condition_variable>
+#include <unordered_map>
 #include <thread>
+#include <atomic>
 #include "../log/log.h"
+#include "sqlstmt.h"
 
+/* 弹性连接池：保持minSize个连接，忙时按需增加到maxSize个，空闲太久的连接回收到minSize
+   后台线程定期ping空闲连接，断开的连接关闭后重新建立；建立连接失败时按指数退避重试
+   取连接最多等待waitMs，超时返回nullptr，数据库故障时请求失败而不是卡住线程
+   忙时新增的连接也由后台线程建立，取连接的线程只等到waitMs为止，不受连接超时影响
+   Instance()是主库的连接池；只读副本各有一个实例，由SqlReplicas管理 */
 class SqlConnPool {
 public:
     static SqlConnPool *Instance();
 
-    MYSQL *GetConn();
+    SqlConnPool();
+    ~SqlConnPool();
+
+    MYSQL *GetConn();           // 超时或连接池已关闭时返回nullptr
     void FreeConn(MYSQL * conn);
     int GetFreeConnCount();
+    int GetConnCount();         // 已建立的连接数
+    int GetBusyConnCount();     // 借出的连接数
+    // 有已建立的连接，或不在退避期（可以尝试建立）；副本故障时读请求不用等到超时
+    bool Available();
+    // 连接上的预编译语句，只能在借出连接期间使用
+    SqlStmtCache* Stmts(MYSQL* conn);
 
+    // minSize为-1时固定为connSize个连接；只保存配置并启动后台线程，连接在后台并发建立
     void Init(const char* host, int port,
-              const char* user,const char* pwd, 
-              const char* dbName, int connSize);
+              const char* user,const char* pwd,
+              const char* dbName, int connSize,
+              int minSize = -1, int waitMs = 1000);
     void ClosePool();
 
 private:
-    SqlConnPool();
-    ~SqlConnPool();
+    typedef std::chrono::steady_clock Clock;
+
+    struct Conn {
+        std::unique_ptr<SqlStmtCache> stmts;
+        Clock::time_point lastUsed;     // 最后归还的时间，回收空闲连接用
+        Clock::time_point lastCheck;    // 最后确认可用的时间，定期ping用
+        Clock::time_point borrowed;     // 借出的时间
+    };
+
+    static constexpr int CHECK_MS = 5000;           // 后台检查的间隔
+    static constexpr int PING_IDLE_MS = 30000;      // 空闲超过这么久的连接先ping再用
+    static constexpr int SHRINK_IDLE_MS = 60000;    // 空闲超过这么久的连接关闭（保留minSize个）
+    static constexpr int MIN_BACKOFF_MS = 100;      // 建立连接失败后的重试间隔
+    static constexpr int MAX_BACKOFF_MS = 5000;
+    static constexpr unsigned int TIMEOUT_SEC = 3;  // 连接/读/写超时
+
+    MYSQL* Connect_();
+    bool Open_();
+    void Add_(MYSQL* sql);
+    std::unique_ptr<SqlStmtCache> Detach_(MYSQL* sql);
+    static void Close_(MYSQL* sql, std::unique_ptr<SqlStmtCache> stmts);
+    void Backoff_();
+    void Maintain_();
+
+    std::string host_, user_, pwd_, dbName_;
+    int port_;
 
     int MAX_CONN_;      // 最大连接数
-    int useCount_;      // 当前用户数
-    int freeCount_;     // 剩余用户数
+    int minConn_;       // 最小连接数
+    int waitMs_;        // 取连接的等待上限
+    int total_;         // 已建立和正在建立的连接数
+    int busy_;          // 借出的连接数
+    int opening_;       // 正在建立的连接数
+    int waiting_;       // 等待空闲连接的线程数
+    int grow_;          // 取连接的线程请求后台建立的连接数（已计入total_和opening_）
+    bool isClosed_;
+    int backoffMs_;
+    Clock::time_point retryAt_;     // 退避期间不再建立连接
 
-    std::queue<MYSQL *> connQue_; // 连接队列
+    std::deque<MYSQL *> idle_;      // 空闲连接，表尾为最近归还
+    std::unordered_map<MYSQL*, Conn> conns_;    // 所有已建立的连接
     std::mutex mtx_;    // 互斥锁
-    sem_t semId_;       // 信号量
+    std::condition_variable cond_;          // 等待空闲连接
+    std::condition_variable maintainCond_;  // 唤醒后台线程
+    std::thread maintainer_;
 };
 
 
-#endif // SQLCONNPOOL_H
\ No newline at end of file
+#endif // SQLCONNPOOL_H
@@ -0,0 +1,135 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-19
+ * @copyleft Apache 2.0
+ */
+
+#define LOG_MODULE Log::MODULE_POOL
+#include "sqlreplicas.h"
+#include <cstdlib>
+
+using namespace std;
+
+SqlReplicas::SqlReplicas() : next_(0), pinMs_(0) {}
+
+SqlReplicas::~SqlReplicas() {
+    Close();
+}
+
+SqlReplicas* SqlReplicas::Instance() {
+    static SqlReplicas replicas;
+    return &replicas;
+}
+
+vector<pair<string, int>> SqlReplicas::Parse_(const char* hosts) {
+    vector<pair<string, int>> endpoints;
+    string_view rest(hosts ? hosts : "");
+    while(!rest.empty()) {
+        size_t comma = rest.find(',');
+        string_view item = rest.substr(0, comma);
+        rest = comma == string_view::npos ? string_view() : rest.substr(comma + 1);
+        if(item.empty()) { continue; }
+        size_t colon = item.rfind(':');
+        int port = DEFAULT_PORT;
+        if(colon != string_view::npos) {
+            port = atoi(string(item.substr(colon + 1)).c_str());
+            item = item.substr(0, colon);
+        }
+        if(item.empty() || port <= 0) {
+            LOG_ERROR("Bad SQL replica: %.*s", (int)item.size(), item.data());
+            continue;
+        }
+        endpoints.emplace_back(string(item), port);
+    }
+    return endpoints;
+}
+
+int SqlReplicas::Count(const char* hosts) {
+    return Parse_(hosts).size();
+}
+
+void SqlReplicas::Init(const char* hosts, const char* user, const char* pwd,
+                       const char* dbName, int connSize, int minSize, int waitMs, int pinMs) {
+    assert(replicas_.empty());
+    pinMs_ = pinMs > 0 ? pinMs : 0;
+    for(auto& endpoint : Parse_(hosts)) {
+        unique_ptr<Replica> replica(new Replica());
+        replica->host = endpoint.first;
+        replica->port = endpoint.second;
+        replica->outstanding = 0;
+        // 和主库一样在后台建立连接
+        replica->pool.Init(replica->host.c_str(), replica->port, user, pwd, dbName,
+                           connSize, minSize, min(waitMs, (int)WAIT_MS));
+        replicas_.push_back(move(replica));
+    }
+}
+
+void SqlReplicas::Close() {
+    for(auto& replica : replicas_) {
+        replica->pool.ClosePool();
+    }
+}
+
+int SqlReplicas::Size() const {
+    return replicas_.size();
+}
+
+int SqlReplicas::GetConnCount() {
+    int count = 0;
+    for(auto& replica : replicas_) {
+        count += replica->pool.GetConnCount();
+    }
+    return count;
+}
+
+int SqlReplicas::Pick() {
+    int n = replicas_.size();
+    if(n == 0) { return -1; }
+    // 从轮转位置开始找进行中的查询最少的副本，跳过连不上（退避中）的副本
+    int start = next_.fetch_add(1, memory_order_relaxed) % n;
+    int best = -1, bestCount = 0;
+    for(int k = 0; k < n; k++) {
+        int i = (start + k) % n;
+        int count = replicas_[i]->outstanding.load(memory_order_relaxed);
+        if((best < 0 || count < bestCount) && replicas_[i]->pool.Available()) {
+            best = i;
+            bestCount = count;
+        }
+    }
+    if(best >= 0) { replicas_[best]->outstanding++; }
+    return best;
+}
+
+SqlConnPool* SqlReplicas::Pool(int i) {
+    assert(i >= 0 && i < (int)replicas_.size());
+    return &replicas_[i]->pool;
+}
+
+void SqlReplicas::Done(int i) {
+    assert(i >= 0 && i < (int)replicas_.size());
+    replicas_[i]->outstanding--;
+}
+
+void SqlReplicas::Pin(string_view key) {
+    if(replicas_.empty() || pinMs_ == 0) { return; }
+    Clock::time_point now = Clock::now();
+    Clock::time_point until = now + chrono::milliseconds(pinMs_);
+    lock_guard<mutex> locker(pinMtx_);
+    // 01：清理已到期的键；同一个键再次写入时以最新的到期时间为准
+    while(!pinOrder_.empty() && pinOrder_.front().first <= now) {
+        auto it = pinned_.find(pinOrder_.front().second);
+        if(it != pinned_.end() && it->second <= now) { pinned_.erase(it); }
+        pinOrder_.pop_front();
+    }
+    // 02：记录新的到期时间
+    string name(key);
+    pinned_[name] = until;
+    pinOrder_.emplace_back(until, move(name));
+}
+
+bool SqlReplicas::Pinned(string_view key) {
+    if(replicas_.empty() || pinMs_ == 0) { return false; }
+    lock_guard<mutex> locker(pinMtx_);
+    auto it = pinned_.find(string(key));
+    return it != pinned_.end() && Clock::now() < it->second;
+}
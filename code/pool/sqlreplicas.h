@@ -0,0 +1,73 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-19
+ * @copyleft Apache 2.0
+ */
+#ifndef SQLREPLICAS_H
+#define SQLREPLICAS_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include "sqlconnpool.h"
+
+/* 只读副本：每个副本一个SqlConnPool，读请求发给进行中的查询最少的可用副本，写入只走主库
+   副本复制有延迟，写入后的一段时间内同一个键（用户名）的读请求改走主库（read-your-writes）
+   启动时Init一次，之后副本列表只读，各线程可以并发调用 */
+class SqlReplicas {
+public:
+    static SqlReplicas* Instance();
+
+    // hosts："host:port"逗号分隔（省略端口为3306），空串表示没有副本；账号、库名和连接池大小与主库相同
+    static int Count(const char* hosts);
+
+    void Init(const char* hosts, const char* user, const char* pwd,
+              const char* dbName, int connSize, int minSize, int waitMs, int pinMs);
+    void Close();
+
+    int Size() const;
+    int GetConnCount();
+
+    // 选择进行中的查询最少的可用副本，用完调用Done；没有可用副本时返回-1
+    int Pick();
+    SqlConnPool* Pool(int i);
+    void Done(int i);
+
+    // 写入后的pinMs内，这个键的读请求改走主库
+    void Pin(std::string_view key);
+    bool Pinned(std::string_view key);
+
+private:
+    SqlReplicas();
+    ~SqlReplicas();
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Replica {
+        std::string host;
+        int port;
+        SqlConnPool pool;
+        std::atomic<int> outstanding;   // 选中后还没Done的查询数
+    };
+
+    static const int DEFAULT_PORT = 3306;
+    static const int WAIT_MS = 200;     // 副本忙时不久等，改读主库
+
+    static std::vector<std::pair<std::string, int>> Parse_(const char* hosts);
+
+    std::vector<std::unique_ptr<Replica>> replicas_;
+    std::atomic<unsigned int> next_;    // 进行中的查询数相同时轮流选择
+
+    int pinMs_;
+    std::mutex pinMtx_;
+    std::unordered_map<std::string, Clock::time_point> pinned_;    // 键 -> 改回读副本的时间
+    std::deque<std::pair<Clock::time_point, std::string>> pinOrder_;   // 按到期时间排列，清理用
+};
+
+#endif // SQLREPLICAS_H
@@ -0,0 +1,101 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-19
+ * @copyleft Apache 2.0
+ */
+
+#define LOG_MODULE Log::MODULE_POOL
+#include "sqlstmt.h"
+#include "../log/log.h"
+#include <cstring>
+#include <assert.h>
+
+const char* const SqlStmtCache::SQL[STMT_NUM] = {
+    "SELECT password FROM user WHERE username = ? LIMIT 1",
+    "INSERT INTO user(username, password) VALUES(?, ?)",
+};
+
+SqlStmtCache::SqlStmtCache() : threadId_(0) {
+    memset(stmts_, 0, sizeof(stmts_));
+}
+
+SqlStmtCache::~SqlStmtCache() {
+    Clear();
+}
+
+void SqlStmtCache::Clear() {
+    for(int i = 0; i < STMT_NUM; i++) {
+        if(stmts_[i]) {
+            mysql_stmt_close(stmts_[i]);
+            stmts_[i] = nullptr;
+        }
+    }
+}
+
+// 连接断开（2006 CR_SERVER_GONE_ERROR，2013 CR_SERVER_LOST）
+// 或服务器上的语句已不存在（1243 ER_UNKNOWN_STMT_HANDLER，1615 ER_NEED_REPREPARE）
+bool SqlStmtCache::Lost_(unsigned int err) {
+    return err == 2006 || err == 2013 || err == 1243 || err == 1615;
+}
+
+// 取编译好的语句，没有或连接重连过时重新编译
+MYSQL_STMT* SqlStmtCache::Get_(MYSQL* sql, int id) {
+    assert(sql && id >= 0 && id < STMT_NUM);
+    unsigned long threadId = mysql_thread_id(sql);
+    if(threadId != threadId_) {
+        // 01：重连后服务器端的语句都已失效
+        Clear();
+        threadId_ = threadId;
+    }
+    if(!stmts_[id]) {
+        // 02：第一次使用时编译
+        MYSQL_STMT* stmt = mysql_stmt_init(sql);
+        if(!stmt) { return nullptr; }
+        if(mysql_stmt_prepare(stmt, SQL[id], strlen(SQL[id]))) {
+            LOG_ERROR("Prepare [%s] error: %s", SQL[id], mysql_stmt_error(stmt));
+            mysql_stmt_close(stmt);
+            return nullptr;
+        }
+        stmts_[id] = stmt;
+    }
+    return stmts_[id];
+}
+
+// 执行一次，返回值同Execute；出错时不释放语句，由调用者根据错误码决定是否重试
+int SqlStmtCache::Run_(MYSQL_STMT* stmt, MYSQL_BIND* params, MYSQL_BIND* result) {
+    if(mysql_stmt_bind_param(stmt, params) || mysql_stmt_execute(stmt)) {
+        return -1;
+    }
+    if(!result) {
+        return mysql_stmt_affected_rows(stmt) > 0 ? 1 : 0;
+    }
+    if(mysql_stmt_bind_result(stmt, result) || mysql_stmt_store_result(stmt)) {
+        return -1;
+    }
+    int ret = mysql_stmt_fetch(stmt);
+    mysql_stmt_free_result(stmt);
+    if(ret == 0 || ret == MYSQL_DATA_TRUNCATED) { return 1; }
+    return ret == MYSQL_NO_DATA ? 0 : -1;
+}
+
+int SqlStmtCache::Execute(MYSQL* sql, int id, MYSQL_BIND* params, MYSQL_BIND* result, bool retry) {
+    for(int i = 0; i < 2; i++) {
+        MYSQL_STMT* stmt = Get_(sql, id);
+        unsigned int err = 0;
+        if(stmt) {
+            int ret = Run_(stmt, params, result);
+            if(ret >= 0) { return ret; }
+            err = mysql_stmt_errno(stmt);
+            LOG_WARN("Execute [%s] error %u: %s", SQL[id], err, mysql_stmt_error(stmt));
+        }
+        else {
+            err = mysql_errno(sql);
+        }
+        if(i > 0 || !retry || !Lost_(err)) { break; }
+        // 连接断开：ping触发重连，线程id变化后下一轮会重新编译
+        Clear();
+        threadId_ = 0;
+        mysql_ping(sql);
+    }
+    return -1;
+}
@@ -0,0 +1,45 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-19
+ * @copyleft Apache 2.0
+ */
+#ifndef SQLSTMT_H
+#define SQLSTMT_H
+
+#include <mysql/mysql.h>
+
+/* 一个数据库连接上的预编译语句：第一次用到时编译，之后只发参数（二进制协议），
+   服务器不用每次解析SQL，参数也不会被拼进SQL（防注入）
+   连接由借出它的线程独占，所以这里不加锁；连接重连后（线程id变化）旧语句失效，自动重新编译 */
+class SqlStmtCache {
+public:
+    enum STMT {
+        SELECT_USER = 0,        // 参数：用户名；结果：密码
+        INSERT_USER,            // 参数：用户名，密码
+        STMT_NUM,
+    };
+
+    SqlStmtCache();
+    ~SqlStmtCache();
+
+    // 执行语句，result不为空时取第一行
+    // 返回值：-1出错，0没有结果行（INSERT为没有插入），1取到一行（INSERT为插入成功）
+    // 连接断开或语句失效时重连（MYSQL_OPT_RECONNECT）、重新编译后再试一次
+    // 事务中执行时retry为false：重连后事务已经回滚，不能在新连接上接着执行
+    int Execute(MYSQL* sql, int id, MYSQL_BIND* params, MYSQL_BIND* result = nullptr,
+                bool retry = true);
+
+    void Clear();           // 关闭所有语句（关闭连接前调用）
+
+private:
+    MYSQL_STMT* Get_(MYSQL* sql, int id);
+    int Run_(MYSQL_STMT* stmt, MYSQL_BIND* params, MYSQL_BIND* result);
+    static bool Lost_(unsigned int err);
+
+    MYSQL_STMT* stmts_[STMT_NUM];
+    unsigned long threadId_;    // 编译语句时连接的线程id，变化说明重连过
+
+    static const char* const SQL[STMT_NUM];
+};
+
+#endif // SQLSTMT_H
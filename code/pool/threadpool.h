@@ -11,18 +11,22 @@
 #include <condition_variable>
 #include <queue>
 #include <thread>
+#include <memory>
+#include <atomic>
 #include <functional>
+#include <assert.h>
 class ThreadPool {
 public:
     //explicit关键字阻止隐式转换的发生
-    explicit ThreadPool(size_t threadCount = 8): pool_(std::make_shared<Pool>()) 
+    explicit ThreadPool(size_t threadCount = 8): pool_(std::make_shared<Pool>(threadCount)) 
     {
             assert(threadCount > 0);
             //创建ThreadCount个子线程
             for(size_t i = 0; i < threadCount; i++) 
             {
-                std::thread([pool = pool_] 
+                std::thread([pool = pool_, i] 
                 {
+                    Worker& worker = pool->workers[i];
                     std::unique_lock<std::mutex> locker(pool->mtx);
                     while(true)     
                     {
@@ -32,7 +36,11 @@ public:
                             //移除
                             pool->tasks.pop();
                             locker.unlock();
+                            worker.busy.store(true, std::memory_order_relaxed);
                             task();
+                            worker.busy.store(false, std::memory_order_relaxed);
+                            //只有本线程写，不需要原子加
+                            worker.tasks.store(worker.tasks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
                             locker.lock();
                         } 
                         else if(pool->isClosed) break;
@@ -58,6 +66,31 @@ public:
         }
     }
 
+    // 等待执行的任务数
+    size_t QueuedTasks() const
+    {
+        std::lock_guard<std::mutex> locker(pool_->mtx);
+        return pool_->tasks.size();
+    }
+
+    // 各工作线程的状态：是否正在执行任务、已执行的任务数
+    size_t ThreadCount() const
+    {
+        return pool_->threadCount;
+    }
+
+    bool WorkerBusy(size_t i) const
+    {
+        return pool_->workers[i].busy.load(std::memory_order_relaxed);
+    }
+
+    uint64_t WorkerTasks(size_t i) const
+    {
+        return pool_->workers[i].tasks.load(std::memory_order_relaxed);
+    }
+
+    // 队列不设上限，在事件循环里调用也不会阻塞：每个连接同时最多一个任务（EPOLLONESHOT），
+    // 排队的任务数不超过连接数
     template<class F>
     void AddTask(F&& task) 
     {
@@ -69,11 +102,20 @@ public:
     }
 
 private:
+    struct alignas(64) Worker {
+        std::atomic<bool> busy{false};
+        std::atomic<uint64_t> tasks{0};
+    };
+
     struct Pool {
+        explicit Pool(size_t threadCount): isClosed(false), threadCount(threadCount),
+            workers(new Worker[threadCount]) {}
         std::mutex mtx;                     //互斥锁
         std::condition_variable cond;       //条件变量
         bool isClosed;                      //是否关闭
         std::queue<std::function<void()>> tasks;        //任务队列
+        size_t threadCount;
+        std::unique_ptr<Worker[]> workers;              //各工作线程的统计，分开缓存行
     };
     std::shared_ptr<Pool> pool_;            //线程池
 };
@@ -4,6 +4,7 @@
  * @copyleft Apache 2.0
  */
 
+#define LOG_MODULE Log::MODULE_SERVER
 #include "epoller.h"
 
 // 初始化（01：创建epoll实例    02：设置最大的需要监听的文件描述符）
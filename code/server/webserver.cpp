@@ -4,6 +4,7 @@
  * @copyleft Apache 2.0
  */
 
+#define LOG_MODULE Log::MODULE_SERVER
 #include "webserver.h"
 
 using namespace std;
@@ -14,10 +15,20 @@ WebServer::WebServer(
             int port, int trigMode, int timeoutMS, bool OptLinger,
             int sqlPort, const char* sqlUser, const  char* sqlPwd,
             const char* dbName, int connPoolNum, int threadNum,
-            bool openLog, int logLevel, int logQueSize):
+            bool openLog, int logLevel, int logQueSize,
+            const ServerConfig& config):
             port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), isClose_(false),
-            timer_(new HeapTimer()), threadpool_(new ThreadPool(threadNum)), epoller_(new Epoller())
+            timer_(new HeapTimer()), threadpool_(new ThreadPool(threadNum)),
+            dbpool_(new ThreadPool(connPoolNum * (1 + SqlReplicas::Count(config.sqlReplicas)))),
+            epoller_(new Epoller())
     {
+        // 日志最先初始化：套接字、用户表和连接池的后台线程在初始化时就会写日志
+        // 二进制日志用单独的后缀，需要用tools/logdecode解码
+        if(openLog) {
+            Log::Instance()->init(logLevel, "./log", config.logFormat == Log::FORMAT_BINARY ? ".blog" : ".log",
+                                    logQueSize, config.logFormat);
+        }
+
         // 获取当前路径（/ home/sanxian/C++/WebServer-master/resources）
         srcDir_ = getcwd(nullptr, 256); 
         assert(srcDir_);
@@ -27,9 +38,50 @@ WebServer::WebServer(
         // 初始化HTTP连接信息
         HttpConn::userCount = 0;
         HttpConn::srcDir = srcDir_;
+        HttpConn::isChain = config.chainBuffer;
 
-        // 初始化数据库连接池
-        SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);
+        // 访问日志：格式小于0表示关闭
+        HttpConn::accessLog = config.accessLogFormat >= 0;
+        if(HttpConn::accessLog) {
+            AccessLog::Instance()->Init("./log/access.log", config.accessLogFormat, config.accessLogSample);
+        }
+
+        // 运行时统计中的即时值，抓取/metrics时读取
+        Metrics::AddGauge("connections", "Open client connections.",
+                            [] { return (double)HttpConn::userCount; });
+        Metrics::AddGauge("threadpool_queued_tasks", "Tasks waiting in the thread pool.",
+                            [this] { return (double)threadpool_->QueuedTasks(); });
+        Metrics::AddGauge("db_queued_tasks", "Suspended requests waiting for a DB thread.",
+                            [this] { return (double)dbpool_->QueuedTasks(); });
+        Metrics::AddGauge("sql_free_connections", "Idle SQL connections.",
+                            [] { return (double)SqlConnPool::Instance()->GetFreeConnCount(); });
+        Metrics::AddGauge("sql_connections", "Open SQL connections.",
+                            [] { return (double)SqlConnPool::Instance()->GetConnCount(); });
+        Metrics::AddGauge("sql_busy_connections", "SQL connections lent out.",
+                            [] { return (double)SqlConnPool::Instance()->GetBusyConnCount(); });
+        Metrics::AddGauge("sql_replica_connections", "Open SQL connections to read replicas.",
+                            [] { return (double)SqlReplicas::Instance()->GetConnCount(); });
+        Metrics::AddGauge("log_dropped", "Log records dropped on overflow.",
+                            [] { return (double)Log::Instance()->Dropped(); });
+        Metrics::AddGauge("log_delayed", "Log records that waited for ring space.",
+                            [] { return (double)Log::Instance()->Delayed(); });
+        Metrics::AddGauge("access_log_dropped", "Access log records dropped on overflow.",
+                            [] { return (double)AccessLog::Instance()->Dropped(); });
+
+        // 已验证用户的缓存：重复登录不查数据库
+        CredCache::Instance()->Init(config.authCacheSec, (size_t)config.authCacheMB << 20);
+        Metrics::AddGauge("auth_cache_entries", "Entries in the credential cache.",
+                            [] { return (double)CredCache::Instance()->Entries(); });
+        Metrics::AddGauge("auth_cache_bytes", "Approximate memory used by the credential cache.",
+                            [] { return (double)CredCache::Instance()->Bytes(); });
+
+        // 登录会话：带Cookie的请求不再验证，过期会话由定时器清理
+        SessionStore::Instance()->Init(config.sessionSec, MAX_SESSIONS);
+        Metrics::AddGauge("sessions", "Live login sessions.",
+                            [] { return (double)SessionStore::Instance()->Size(); });
+        if(SessionStore::Instance()->IsOpen()) {
+            timer_->add(SWEEP_ID, SessionStore::SWEEP_MS, std::bind(&WebServer::SweepSessions_, this));
+        }
 
         // 初始化事件模式
         InitEventMode_(trigMode);
@@ -40,12 +92,34 @@ WebServer::WebServer(
             isClose_ = true;
         }
 
+        // 登录/注册使用的用户表：MySQL或本地文件
+        if(!isClose_ && !AuthBackend::Init(config.authBackend, config.authFile,
+                                           config.regBatchUs, config.regBatchMax)) {
+            isClose_ = true;
+        }
+
+        // 初始化数据库连接池：监听之后再建立连接，静态资源不用等数据库
+        if(!isClose_ && AuthBackend::Instance()->NeedSqlPool()) {
+            SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum,
+                                          config.sqlMinConn, config.sqlWaitMs);
+            // 只读副本：登录查询读副本，DB线程组按副本数扩大
+            SqlReplicas::Instance()->Init(config.sqlReplicas, sqlUser, sqlPwd, dbName, connPoolNum,
+                                          config.sqlMinConn, config.sqlWaitMs, config.sqlPinMs);
+        }
+
+        // 共享内存统计段：/dev/shm/webserver-<port>，用tools/webserver-top查看
+        if(!isClose_ && config.statsIntervalMs > 0) {
+            stats_.reset(new ShmStats());
+            if(!stats_->Start(shmstats::SegmentName(port_).c_str(), config.statsIntervalMs,
+                    std::bind(&WebServer::CollectThreads_, this, std::placeholders::_1))) {
+                stats_.reset();
+            }
+        }
+
         
     // 日志设置
     if(openLog) 
     {
-
-        Log::Instance()->init(logLevel, "./log", ".log", logQueSize);
         if(isClose_) { LOG_ERROR("========== Server init error!=========="); }
         else {
             //std::cout << "初始化成功！" << endl;
@@ -54,18 +128,36 @@ WebServer::WebServer(
             LOG_INFO("Listen Mode: %s, OpenConn Mode: %s",
                             (listenEvent_ & EPOLLET ? "ET": "LT"),
                             (connEvent_ & EPOLLET ? "ET": "LT"));
-            LOG_INFO("LogSys level: %d", logLevel);
+            LOG_INFO("LogSys level: %d, format: %d", logLevel, config.logFormat);
             LOG_INFO("srcDir: %s", HttpConn::srcDir);
-            LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
+            LOG_INFO("SqlConnPool num: %d (min %d, wait %dms), ThreadPool num: %d, DB threads: %d",
+                            connPoolNum, config.sqlMinConn, config.sqlWaitMs, threadNum,
+                            (int)dbpool_->ThreadCount());
+            LOG_INFO("Read buffer: %s", config.chainBuffer ? "chain" : "contiguous");
+            LOG_INFO("Access log: %d, sample 1/%d", config.accessLogFormat, config.accessLogSample);
+            LOG_INFO("Auth cache: ttl %ds, max %dMB", config.authCacheSec, config.authCacheMB);
+            LOG_INFO("Session: ttl %ds", config.sessionSec);
+            LOG_INFO("Routes: %zu", Router::Instance()->Size());
+            LOG_INFO("Auth backend: %s, register batch: %dus, max %d",
+                            AuthBackend::TypeName(config.authBackend), config.regBatchUs, config.regBatchMax);
+            if(SqlReplicas::Instance()->Size() > 0) {
+                LOG_INFO("SQL replicas: %s, read-your-writes %dms", config.sqlReplicas, config.sqlPinMs);
+            }
+            if(config.statsIntervalMs > 0) {
+                LOG_INFO("Shm stats: %s every %dms%s", shmstats::SegmentName(port_).c_str(),
+                            config.statsIntervalMs, stats_ ? "" : " (failed)");
+            }
         }
     }
 }
 
 // 析构
 WebServer::~WebServer() {
+    stats_.reset();
     close(listenFd_);
     isClose_ = true;
     free(srcDir_);
+    SqlReplicas::Instance()->Close();
     SqlConnPool::Instance()->ClosePool();
 }
 
@@ -115,12 +207,11 @@ void WebServer::Start() {
     
     while(!isClose_) {
         //std::cout << "running!!!" << endl;
-        if (timeoutMS_ > 0)
-        {
-            timeMS = timer_->GetNextTick();
-        }
+        // 没有连接超时时堆中只有会话清理的定时器，堆为空时返回-1
+        timeMS = timer_->GetNextTick();
 
         int eventCnt = epoller_->Wait(timeMS);     //阻塞
+        Metrics::Add(Metrics::EPOLL_WAKEUPS);
         for(int i = 0; i < eventCnt; i++) {
             /* 处理事件 */
             int fd = epoller_->GetEventFd(i);
@@ -169,6 +260,23 @@ void WebServer::SendError_(int fd, const char*info) {
 }
 
 // 关闭连接
+// 定时器回调：清理过期会话，再添加下一次
+void WebServer::SweepSessions_() {
+    size_t removed = SessionStore::Instance()->Expire();
+    if(removed) { LOG_DEBUG("Sessions expired: %zu", removed); }
+    timer_->add(SWEEP_ID, SessionStore::SWEEP_MS, std::bind(&WebServer::SweepSessions_, this));
+}
+
+// 定时器回调：连接超时关闭；正在工作线程/数据库线程中处理时不能关闭fd，顺延一个超时时间
+void WebServer::OnTimeout_(HttpConn* client) {
+    assert(client);
+    if(client->IsBusy()) {
+        timer_->add(client->GetFd(), timeoutMS_, std::bind(&WebServer::OnTimeout_, this, client));
+        return;
+    }
+    CloseConn_(client);
+}
+
 void WebServer::CloseConn_(HttpConn* client) {
     assert(client);
     LOG_INFO("Client[%d] quit!", client->GetFd());
@@ -183,9 +291,10 @@ void WebServer::AddClient_(int fd, sockaddr_in addr) {
     assert(fd > 0);
     // 01：保存客户端信息
     users_[fd].init(fd, addr);      
+    Metrics::Add(Metrics::ACCEPTS);
     if(timeoutMS_ > 0) 
     {
-        timer_->add(fd, timeoutMS_, std::bind(&WebServer::CloseConn_, this, &users_[fd]));
+        timer_->add(fd, timeoutMS_, std::bind(&WebServer::OnTimeout_, this, &users_[fd]));
     }
     // 02：进行监测
     epoller_->AddFd(fd, EPOLLIN | connEvent_);
@@ -218,14 +327,20 @@ void WebServer::DealListen_() {
 void WebServer::DealRead_(HttpConn* client) {
     assert(client);
     ExtentTime_(client);
+    client->SetState(Metrics::CONN_ACTIVE);
+    client->Hold();
     threadpool_->AddTask(std::bind(&WebServer::OnRead_, this, client));
+    Metrics::Add(Metrics::TASKS_QUEUED);
 }
 
 // 处理其他套接字的写操作
 void WebServer::DealWrite_(HttpConn* client) {
     assert(client);
     ExtentTime_(client);
+    client->SetState(Metrics::CONN_ACTIVE);
+    client->Hold();
     threadpool_->AddTask(std::bind(&WebServer::OnWrite_, this, client));
+    Metrics::Add(Metrics::TASKS_QUEUED);
 }
 
 // 时间调整
@@ -244,6 +359,7 @@ void WebServer::OnRead_(HttpConn* client) {
     if(ret <= 0 && readErrno != EAGAIN)     // 出现错误直接关闭
     {
         CloseConn_(client);
+        client->Release();
         return;
     }
 
@@ -256,14 +372,34 @@ void WebServer::OnProcess(HttpConn* client) {
     if(client->process()) 
     {
         // 读完后，将相应的文件描述符改为写状态
+        client->SetState(Metrics::CONN_WRITING);
         epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+        client->Release();
     } 
+    else if(client->IsPending())
+    {
+        // 需要查询数据库：交给数据库线程组，工作线程继续处理别的连接
+        // EPOLLONESHOT没有重新注册，挂起期间不会有其他线程访问这个连接；仍然Hold，超时只顺延
+        client->SetState(Metrics::CONN_DB);
+        dbpool_->AddTask(std::bind(&WebServer::OnVerify_, this, client));
+    }
     else
     {
+        client->SetState(Metrics::CONN_READING);
         epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
+        client->Release();
     }
 }
 
+// 数据库线程组中执行：查询完成后注册写事件，由主线程继续发送响应
+void WebServer::OnVerify_(HttpConn* client) {
+    assert(client);
+    client->Resume();
+    client->SetState(Metrics::CONN_WRITING);
+    epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+    client->Release();
+}
+
 void WebServer::OnWrite_(HttpConn* client) {
     assert(client);
     int ret = -1;
@@ -279,11 +415,34 @@ void WebServer::OnWrite_(HttpConn* client) {
     else if(ret < 0) {
         if(writeErrno == EAGAIN) {
             /* 继续传输 */
+            client->SetState(Metrics::CONN_WRITING);
             epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+            client->Release();
             return;
         }
     }
     CloseConn_(client);
+    client->Release();
+}
+
+// 发布线程中调用：线程池各工作线程的状态和各线程日志缓冲区的积压
+void WebServer::CollectThreads_(std::vector<shmstats::Thread>* threads) {
+    for(size_t i = 0; i < threadpool_->ThreadCount(); i++) {
+        shmstats::Thread t = { shmstats::THREAD_WORKER, threadpool_->WorkerBusy(i), 0,
+                                (uint32_t)i, threadpool_->WorkerTasks(i), 0 };
+        threads->push_back(t);
+    }
+    for(size_t i = 0; i < dbpool_->ThreadCount(); i++) {
+        shmstats::Thread t = { shmstats::THREAD_DB, dbpool_->WorkerBusy(i), 0,
+                                (uint32_t)i, dbpool_->WorkerTasks(i), 0 };
+        threads->push_back(t);
+    }
+    std::vector<size_t> depths;
+    Log::Instance()->RingDepths(&depths);
+    for(size_t i = 0; i < depths.size(); i++) {
+        shmstats::Thread t = { shmstats::THREAD_LOG, 0, 0, (uint32_t)i, 0, depths[i] };
+        threads->push_back(t);
+    }
 }
 
 /* Create listenFd */
@@ -22,7 +22,32 @@
 #include "../pool/sqlconnpool.h"
 #include "../pool/threadpool.h"
 #include "../pool/sqlconnRAII.h"
+#include "../pool/sqlreplicas.h"
+#include "../pool/sessionstore.h"
+#include "../pool/authbackend.h"
 #include "../http/httpconn.h"
+#include "../metrics/metrics.h"
+#include "../metrics/shmstats.h"
+
+// 可选配置：按字段名设置，没设置的取默认值
+struct ServerConfig {
+    bool chainBuffer = false;           // 链式读缓冲区
+    int logFormat = 0;                  // 日志格式：0文本 1写线程格式化 2二进制
+    int accessLogFormat = -1;           // 访问日志格式：-1关闭 0CLF 1Combined 2JSON
+    int accessLogSample = 1;            // 访问日志采样：每n个请求记录一个
+    int statsIntervalMs = 0;            // 共享内存统计发布间隔ms，0关闭
+    int authCacheSec = 0;               // 登录缓存有效期s，0关闭
+    int authCacheMB = 4;                // 登录缓存内存上限MB
+    int sessionSec = 0;                 // 登录会话有效期s，0关闭
+    int sqlMinConn = -1;                // 数据库最小连接数，-1固定为连接池数量
+    int sqlWaitMs = 1000;               // 取连接的等待上限ms
+    int authBackend = AuthBackend::BACKEND_MYSQL;   // 用户表：MySQL或本地文件
+    const char* authFile = "./auth.db"; // 本地用户文件
+    int regBatchUs = 0;                 // 注册组提交窗口us，0为不定时等待
+    int regBatchMax = 1;                // 每批最多注册数
+    const char* sqlReplicas = "";       // 只读副本，host:port逗号分隔，空为不用
+    int sqlPinMs = 5000;                // 注册后读主库的时间ms
+};
 
 class WebServer {
 public:
@@ -30,7 +55,8 @@ public:
         int port, int trigMode, int timeoutMS, bool OptLinger, 
         int sqlPort, const char* sqlUser, const  char* sqlPwd, 
         const char* dbName, int connPoolNum, int threadNum,
-        bool openLog, int logLevel, int logQueSize);
+        bool openLog, int logLevel, int logQueSize,
+        const ServerConfig& config = ServerConfig());
 
     ~WebServer();
     void Start();
@@ -47,12 +73,18 @@ private:
     void SendError_(int fd, const char*info);
     void ExtentTime_(HttpConn* client);
     void CloseConn_(HttpConn* client);
+    void OnTimeout_(HttpConn* client);
 
     void OnRead_(HttpConn* client);
     void OnWrite_(HttpConn* client);
     void OnProcess(HttpConn* client);
+    void OnVerify_(HttpConn* client);
+    void SweepSessions_();
+    void CollectThreads_(std::vector<shmstats::Thread>* threads);
 
     static const int MAX_FD = 65536;        // 最多的文件描述符个数
+    static const int SWEEP_ID = MAX_FD;     // 会话清理定时器的id，不会与连接的fd冲突
+    static const int MAX_SESSIONS = 1 << 20;    // 会话总数上限
 
     static int SetFdNonblock(int fd);       // 设置文件描述符非阻塞
 
@@ -68,8 +100,10 @@ private:
    
     std::unique_ptr<HeapTimer> timer_;          // 定时器
     std::unique_ptr<ThreadPool> threadpool_;    // 线程池
+    std::unique_ptr<ThreadPool> dbpool_;        // 数据库线程组：登录/注册在这里查询，不占用工作线程
     std::unique_ptr<Epoller> epoller_;          // epoll对象
     std::unordered_map<int, HttpConn> users_;   // 客户端信息
+    std::unique_ptr<ShmStats> stats_;           // 共享内存统计段，最先析构
 };
 
 
@@ -3,17 +3,19 @@
  * @Date         : 2020-06-17
  * @copyleft Apache 2.0
  */ 
+#define LOG_MODULE Log::MODULE_TIMER
 #include "heaptimer.h"
+#include "../metrics/metrics.h"
 
 // 向上调整
 void HeapTimer::siftup_(size_t i) {
     assert(i >= 0 && i < heap_.size());
-    size_t j = (i - 1) / 2;             // 父亲节点 
-    while(j >= 0) {
+    // 到达堆顶即停止：i为0时(i - 1) / 2会回绕成很大的下标
+    while(i > 0) {
+        size_t j = (i - 1) / 2;         // 父亲节点 
         if(heap_[j] < heap_[i]) { break; }
         SwapNode_(i, j);
         i = j;
-        j = (i - 1) / 2;
     }
 }
 
@@ -123,8 +125,10 @@ void HeapTimer::tick()
         if(std::chrono::duration_cast<MS>(node.expires - Clock::now()).count() > 0) { 
             break; 
         }
-        node.cb();
+        // 先出堆再回调，回调中可以用同一个id重新添加（周期定时器）
         pop();
+        node.cb();
+        Metrics::Add(Metrics::TIMER_EXPIRED);
     }
 }
 
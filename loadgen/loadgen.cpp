@@ -0,0 +1,794 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-21
+ * @copyleft Apache 2.0
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <memory>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+using namespace std;
+
+/* 基于epoll的HTTP压测工具，代替每个客户端fork一个进程、只支持HTTP/1.0的webbench
+   - 长连接（默认）/短连接，每个连接可流水线发送多个请求
+   - 闭环：每个连接始终保持depth个请求在途；开环（-r）：按固定速率产生请求，
+     延迟从“应当发出的时间”算起，服务器变慢时排队的时间也计入，避免协同遗漏；
+     结束时没发出或没收到响应的请求按到结束时刻计入延迟，并单独输出个数
+   - 请求混合：URL列表文件、resources目录下的全部文件、POST登录/注册
+   - 输出p50/p90/p99/p99.9延迟和JSON结果
+
+   用法：loadgen [选项] http://ip:port/path */
+
+static void Usage() {
+    fprintf(stderr,
+        "usage: loadgen [options] http://host:port/[path]\n"
+        "  -c N        connections (default 10)\n"
+        "  -t SEC      duration in seconds (default 10)\n"
+        "  -T N        threads (default 1)\n"
+        "  -p N        pipeline depth per connection (default 1)\n"
+        "  -r RPS      open-loop total request rate; 0 = closed loop (default 0)\n"
+        "  -K          no keep-alive: one request per connection\n"
+        "  -u FILE     request mix file, lines: [weight] GET|POST path [body]\n"
+        "  -R DIR      add GET for every file under DIR (e.g. resources)\n"
+        "  -l U:P[:W]  add POST /login.html as user U with password P\n"
+        "  -g X:P[:W]  add POST /register.html with unique users X<n>\n"
+        "  -o FILE     write JSON results to FILE\n"
+        "  -j          print JSON results instead of the text summary\n");
+    exit(2);
+}
+
+static int64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* 对数-线性分桶的延迟直方图（微秒），每个2的幂区间分32份，相对误差约3% */
+class Histogram {
+public:
+    static const int SUB_BITS = 5;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+    Histogram() : buckets_(BUCKETS, 0), count_(0), sum_(0), max_(0) {}
+
+    void Record(uint64_t us) {
+        buckets_[BucketOf_(us)]++;
+        count_++;
+        sum_ += us;
+        max_ = max(max_, us);
+    }
+
+    void Merge(const Histogram& other) {
+        for(int i = 0; i < BUCKETS; i++) { buckets_[i] += other.buckets_[i]; }
+        count_ += other.count_;
+        sum_ += other.sum_;
+        max_ = max(max_, other.max_);
+    }
+
+    uint64_t Count() const { return count_; }
+    uint64_t Max() const { return max_; }
+    double Mean() const { return count_ ? (double)sum_ / count_ : 0; }
+
+    uint64_t Percentile(double q) const {
+        if(count_ == 0) { return 0; }
+        uint64_t rank = max((uint64_t)1, (uint64_t)ceil(q * count_));
+        uint64_t seen = 0;
+        for(int i = 0; i < BUCKETS; i++) {
+            seen += buckets_[i];
+            if(seen >= rank) { return min(Upper_(i), max_); }
+        }
+        return max_;
+    }
+
+private:
+    static int BucketOf_(uint64_t v) {
+        if(v < (uint64_t)SUB_COUNT) { return v; }
+        int msb = 63 - __builtin_clzll(v);
+        int shift = msb - SUB_BITS;
+        return (shift + 1) * SUB_COUNT + ((v >> shift) & (SUB_COUNT - 1));
+    }
+
+    static uint64_t Upper_(int b) {
+        if(b < SUB_COUNT) { return b; }
+        int shift = b / SUB_COUNT - 1;
+        uint64_t lower = (uint64_t)(SUB_COUNT + b % SUB_COUNT) << shift;
+        return lower + (((uint64_t)1 << shift) - 1);
+    }
+
+    vector<uint64_t> buckets_;
+    uint64_t count_;
+    uint64_t sum_;
+    uint64_t max_;
+};
+
+/* 一种请求 */
+struct Scenario {
+    enum KIND { FIXED, REGISTER };
+    string name;            // 报告中显示的名字，如 "GET /index.html"
+    string request;         // FIXED：完整的请求报文
+    string path;            // REGISTER：请求路径
+    string prefix;          // REGISTER：用户名前缀
+    string password;
+    double weight;
+    int kind;
+};
+
+struct Config {
+    string host;
+    int port = 80;
+    string path = "/";
+    int conns = 10;
+    int seconds = 10;
+    int threads = 1;
+    int depth = 1;
+    double rate = 0;
+    bool keepAlive = true;
+    string jsonFile;
+    bool json = false;
+    vector<Scenario> scenarios;
+    vector<double> cumWeight;
+    sockaddr_in addr;
+};
+
+static Config cfg;
+
+static string Header(const char* method, const string& path) {
+    string req = string(method) + " " + path + " HTTP/1.1\r\nHost: " + cfg.host + "\r\n" +
+                (cfg.keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
+    return req;
+}
+
+static string MakeGet(const string& path) {
+    return Header("GET", path) + "\r\n";
+}
+
+static string MakePost(const string& path, const string& body) {
+    return Header("POST", path) + "Content-Type: application/x-www-form-urlencoded\r\n"
+            "Content-Length: " + to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+static void AddScenario(const string& method, const string& path, const string& body, double weight) {
+    Scenario s;
+    s.name = method + " " + path;
+    s.request = method == "POST" ? MakePost(path, body) : MakeGet(path);
+    s.weight = weight;
+    s.kind = Scenario::FIXED;
+    cfg.scenarios.push_back(s);
+}
+
+// "a:b[:w]"
+static bool SplitSpec(const char* spec, string* a, string* b, double* weight) {
+    string s(spec);
+    size_t p1 = s.find(':');
+    if(p1 == string::npos) { return false; }
+    size_t p2 = s.find(':', p1 + 1);
+    *a = s.substr(0, p1);
+    *b = s.substr(p1 + 1, p2 == string::npos ? string::npos : p2 - p1 - 1);
+    *weight = p2 == string::npos ? 1 : atof(s.c_str() + p2 + 1);
+    return !a->empty() && *weight > 0;
+}
+
+static void LoadMixFile(const char* file) {
+    ifstream in(file);
+    if(!in) {
+        fprintf(stderr, "loadgen: cannot open %s\n", file);
+        exit(2);
+    }
+    string line;
+    while(getline(in, line)) {
+        if(line.empty() || line[0] == '#') { continue; }
+        istringstream ss(line);
+        double weight = 1;
+        string method, path, body;
+        if(isdigit((unsigned char)line[0])) { ss >> weight; }
+        ss >> method >> path >> body;
+        if((method != "GET" && method != "POST") || path.empty() || weight <= 0) {
+            fprintf(stderr, "loadgen: bad line in %s: %s\n", file, line.c_str());
+            exit(2);
+        }
+        AddScenario(method, path, body, weight);
+    }
+}
+
+static void LoadDir(const string& root, const string& rel) {
+    DIR* dir = opendir((root + rel).c_str());
+    if(!dir) {
+        fprintf(stderr, "loadgen: cannot open %s\n", (root + rel).c_str());
+        exit(2);
+    }
+    vector<string> names;
+    while(struct dirent* ent = readdir(dir)) {
+        if(ent->d_name[0] != '.') { names.push_back(ent->d_name); }
+    }
+    closedir(dir);
+    sort(names.begin(), names.end());
+    for(auto& name : names) {
+        string path = rel + "/" + name;
+        struct stat st;
+        if(stat((root + path).c_str(), &st) < 0) { continue; }
+        if(S_ISDIR(st.st_mode)) { LoadDir(root, path); }
+        else if(S_ISREG(st.st_mode)) { AddScenario("GET", path, "", 1); }
+    }
+}
+
+static bool ParseUrl(const char* url) {
+    const char* p = url;
+    if(strncmp(p, "http://", 7) == 0) { p += 7; }
+    const char* slash = strchr(p, '/');
+    string hostPort = slash ? string(p, slash - p) : string(p);
+    if(slash) { cfg.path = slash; }
+    size_t colon = hostPort.find(':');
+    cfg.host = hostPort.substr(0, colon);
+    if(colon != string::npos) { cfg.port = atoi(hostPort.c_str() + colon + 1); }
+    if(cfg.host.empty() || cfg.port <= 0 || cfg.port > 65535) { return false; }
+
+    addrinfo hints = {}, *res = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(cfg.host.c_str(), nullptr, &hints, &res) != 0 || !res) { return false; }
+    cfg.addr = *(sockaddr_in*)res->ai_addr;
+    cfg.addr.sin_port = htons(cfg.port);
+    freeaddrinfo(res);
+    return true;
+}
+
+/* 每个压测线程：自己的epoll、连接和统计，结束后汇总 */
+class Worker {
+public:
+    Worker(int id, int conns, double rate) : id_(id), rate_(rate), rng_(0x9E3779B97F4A7C15ULL * (id + 1)),
+        conns_(conns), perScenario_(cfg.scenarios.size()), scenarioCnt_(cfg.scenarios.size(), 0) {}
+
+    void Run(int64_t startNs, int64_t endNs);
+
+    Histogram latency;
+    vector<Histogram>& PerScenario() { return perScenario_; }
+    vector<uint64_t>& ScenarioCount() { return scenarioCnt_; }
+    uint64_t status[6] = {0};       // 按百位统计，0为无法解析
+    uint64_t completed = 0;
+    uint64_t bytes = 0;
+    uint64_t connects = 0;
+    uint64_t connectErrors = 0;
+    uint64_t socketErrors = 0;      // 读写出错或请求在途时连接被关闭
+    uint64_t maxBacklog = 0;        // 开环模式下等待空闲连接的最大请求数
+    uint64_t unsent = 0;            // 开环：结束时还在排队、没有发出的请求
+    uint64_t inFlight = 0;          // 开环：结束时已发出、没收到响应的请求
+
+private:
+    struct Pending {
+        int64_t startNs;
+        int scenario;
+    };
+
+    struct Conn {
+        int fd = -1;
+        bool connecting = false;
+        bool wantOut = false;
+        string out;
+        size_t outPos = 0;
+        deque<Pending> inflight;
+        // 响应解析
+        string head;
+        bool inBody = false;
+        size_t bodyLeft = 0;
+        int status = 0;
+        bool closeAfter = false;
+    };
+
+    void Connect_(Conn& c);
+    void Close_(Conn& c, bool error);
+    void Issue_(Conn& c, int64_t startNs);
+    void Flush_(Conn& c);
+    void OnReadable_(Conn& c);
+    bool Feed_(Conn& c, const char* data, size_t len);
+    bool Complete_(Conn& c);
+    void UpdateEvents_(Conn& c);
+    void Dispatch_();
+    int PickScenario_();
+    uint64_t Rand_() {
+        rng_ ^= rng_ << 13; rng_ ^= rng_ >> 7; rng_ ^= rng_ << 17;
+        return rng_;
+    }
+
+    int id_;
+    double rate_;
+    uint64_t rng_;
+    int epfd_ = -1;
+    vector<Conn> conns_;
+    vector<Histogram> perScenario_;
+    vector<uint64_t> scenarioCnt_;
+    uint64_t registerSeq_ = 0;
+    bool measuring_ = true;
+    deque<int64_t> backlog_;        // 开环：已到发送时间、还没有连接可用的请求
+    size_t rr_ = 0;
+};
+
+int Worker::PickScenario_() {
+    if(cfg.scenarios.size() == 1) { return 0; }
+    double r = (Rand_() >> 11) * (1.0 / 9007199254740992.0) * cfg.cumWeight.back();
+    return upper_bound(cfg.cumWeight.begin(), cfg.cumWeight.end(), r) - cfg.cumWeight.begin();
+}
+
+void Worker::Connect_(Conn& c) {
+    c = Conn();
+    c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(c.fd < 0) {
+        connectErrors++;
+        return;
+    }
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int ret = connect(c.fd, (sockaddr*)&cfg.addr, sizeof(cfg.addr));
+    if(ret < 0 && errno != EINPROGRESS) {
+        connectErrors++;
+        close(c.fd);
+        c.fd = -1;
+        return;
+    }
+    connects++;
+    // 立即连上也等第一次EPOLLOUT，统一在事件循环里开始发送
+    c.connecting = true;
+    c.wantOut = true;
+    epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.u32 = &c - conns_.data();
+    epoll_ctl(epfd_, EPOLL_CTL_ADD, c.fd, &ev);
+}
+
+void Worker::Close_(Conn& c, bool error) {
+    if(c.fd < 0) { return; }
+    if(error && measuring_) { socketErrors += max((size_t)1, c.inflight.size()); }
+    epoll_ctl(epfd_, EPOLL_CTL_DEL, c.fd, nullptr);
+    close(c.fd);
+    c.fd = -1;
+    // 开环：在途的请求重新排队，发送时间不变
+    if(rate_ > 0 && !error) {
+        for(auto& p : c.inflight) { backlog_.push_back(p.startNs); }
+    }
+    c.inflight.clear();
+}
+
+void Worker::Issue_(Conn& c, int64_t startNs) {
+    int s = PickScenario_();
+    const Scenario& sc = cfg.scenarios[s];
+    if(sc.kind == Scenario::FIXED) {
+        c.out += sc.request;
+    } else {
+        string body = "username=" + sc.prefix + to_string(id_) + "x" + to_string(registerSeq_++) +
+                        "&password=" + sc.password;
+        c.out += MakePost(sc.path, body);
+    }
+    c.inflight.push_back({ startNs, s });
+}
+
+void Worker::Flush_(Conn& c) {
+    while(c.outPos < c.out.size()) {
+        ssize_t n = send(c.fd, c.out.data() + c.outPos, c.out.size() - c.outPos, MSG_NOSIGNAL);
+        if(n < 0) {
+            if(errno == EAGAIN) { break; }
+            Close_(c, true);
+            return;
+        }
+        c.outPos += n;
+    }
+    if(c.outPos == c.out.size()) {
+        c.out.clear();
+        c.outPos = 0;
+    }
+    UpdateEvents_(c);
+}
+
+void Worker::UpdateEvents_(Conn& c) {
+    bool want = c.connecting || !c.out.empty();
+    if(want == c.wantOut) { return; }
+    c.wantOut = want;
+    epoll_event ev = {};
+    ev.events = EPOLLIN | (want ? EPOLLOUT : 0);
+    ev.data.u32 = &c - conns_.data();
+    epoll_ctl(epfd_, EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+// 解析响应：状态行、Content-Length、Connection；响应体只计数不保存
+bool Worker::Feed_(Conn& c, const char* data, size_t len) {
+    while(len > 0) {
+        if(!c.inBody) {
+            size_t old = c.head.size();
+            c.head.append(data, len);
+            size_t end = c.head.find("\r\n\r\n", old >= 3 ? old - 3 : 0);
+            if(end == string::npos) {
+                if(c.head.size() > 65536) { return false; }
+                return true;
+            }
+            size_t used = end + 4 - old;
+            data += used;
+            len -= used;
+            c.head.resize(end + 2);
+            if(c.head.compare(0, 5, "HTTP/") != 0) { return false; }
+            size_t sp = c.head.find(' ');
+            c.status = sp == string::npos ? 0 : atoi(c.head.c_str() + sp + 1);
+            c.bodyLeft = 0;
+            c.closeAfter = !cfg.keepAlive;
+            // 逐行查找需要的首部，忽略大小写
+            size_t pos = c.head.find("\r\n") + 2;
+            while(pos < c.head.size()) {
+                size_t eol = c.head.find("\r\n", pos);
+                const char* line = c.head.c_str() + pos;
+                if(strncasecmp(line, "Content-Length:", 15) == 0) {
+                    c.bodyLeft = strtoull(line + 15, nullptr, 10);
+                } else if(strncasecmp(line, "Connection:", 11) == 0) {
+                    const char* v = line + 11;
+                    while(*v == ' ') { v++; }
+                    if(strncasecmp(v, "close", 5) == 0) { c.closeAfter = true; }
+                }
+                pos = eol + 2;
+            }
+            c.head.clear();
+            c.inBody = true;
+        }
+        size_t take = min(len, c.bodyLeft);
+        c.bodyLeft -= take;
+        data += take;
+        len -= take;
+        if(c.bodyLeft == 0) {
+            c.inBody = false;
+            if(!Complete_(c)) { return true; }  // 连接已关闭重连，剩余数据丢弃
+        }
+    }
+    return true;
+}
+
+// 返回false表示连接已关闭（并已重新发起连接）
+bool Worker::Complete_(Conn& c) {
+    if(c.inflight.empty()) {
+        Close_(c, true);
+        Connect_(c);
+        return false;
+    }
+    Pending p = c.inflight.front();
+    c.inflight.pop_front();
+    if(measuring_) {
+        uint64_t us = (NowNs() - p.startNs) / 1000;
+        latency.Record(us);
+        perScenario_[p.scenario].Record(us);
+        scenarioCnt_[p.scenario]++;
+        status[c.status >= 100 && c.status < 600 ? c.status / 100 : 0]++;
+        completed++;
+    }
+    if(c.closeAfter) {
+        bool pending = !c.inflight.empty();
+        Close_(c, pending);
+        Connect_(c);
+        return false;
+    }
+    if(rate_ <= 0) {
+        Issue_(c, NowNs());
+        Flush_(c);
+    }
+    return c.fd >= 0;
+}
+
+void Worker::OnReadable_(Conn& c) {
+    char buf[65536];
+    while(c.fd >= 0) {
+        ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+        if(n > 0) {
+            if(measuring_) { bytes += n; }
+            if(!Feed_(c, buf, n)) {
+                Close_(c, true);
+                Connect_(c);
+                return;
+            }
+            continue;
+        }
+        if(n < 0 && errno == EAGAIN) { return; }
+        // 对端关闭或出错，在途请求算失败
+        Close_(c, !c.inflight.empty() || n < 0);
+        Connect_(c);
+        return;
+    }
+}
+
+// 开环：把积压的请求分给在途请求不满depth的连接
+void Worker::Dispatch_() {
+    size_t n = conns_.size();
+    for(size_t tried = 0; !backlog_.empty() && tried < n; tried++) {
+        Conn& c = conns_[rr_];
+        rr_ = (rr_ + 1) % n;
+        if(c.fd < 0 || c.connecting) { continue; }
+        bool issued = false;
+        while(!backlog_.empty() && (int)c.inflight.size() < cfg.depth) {
+            Issue_(c, backlog_.front());
+            backlog_.pop_front();
+            issued = true;
+        }
+        if(issued) {
+            Flush_(c);
+            tried = 0;
+        }
+    }
+}
+
+void Worker::Run(int64_t startNs, int64_t endNs) {
+    epfd_ = epoll_create1(0);
+    for(auto& c : conns_) { Connect_(c); }
+
+    double intervalNs = rate_ > 0 ? 1e9 / rate_ : 0;
+    double nextNs = startNs;
+    vector<epoll_event> events(conns_.size() + 1);
+    while(true) {
+        int64_t now = NowNs();
+        if(now >= endNs) { break; }
+        int timeoutMs = (endNs - now) / 1000000 + 1;
+        if(rate_ > 0) {
+            while(nextNs <= now) {
+                backlog_.push_back((int64_t)nextNs);
+                nextNs += intervalNs;
+            }
+            maxBacklog = max(maxBacklog, (uint64_t)backlog_.size());
+            Dispatch_();
+            timeoutMs = min<int64_t>(timeoutMs, max<int64_t>(0, ((int64_t)nextNs - now) / 1000000));
+        }
+        int cnt = epoll_wait(epfd_, events.data(), events.size(), timeoutMs);
+        for(int i = 0; i < cnt; i++) {
+            Conn& c = conns_[events[i].data.u32];
+            if(c.fd < 0) { continue; }
+            uint32_t ev = events[i].events;
+            if(c.connecting && (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if(err) {
+                    connectErrors++;
+                    Close_(c, false);
+                    usleep(1000);       // 服务器不可用时不要空转
+                    Connect_(c);
+                    continue;
+                }
+                // 闭环：连上后立即填满流水线
+                c.connecting = false;
+                if(rate_ <= 0) {
+                    for(int k = 0; k < cfg.depth; k++) { Issue_(c, NowNs()); }
+                }
+                Flush_(c);
+                if(c.fd < 0) { continue; }
+            }
+            if(ev & (EPOLLIN | EPOLLHUP | EPOLLERR)) { OnReadable_(c); }
+            if(c.fd >= 0 && (ev & EPOLLOUT) && !c.connecting) { Flush_(c); }
+        }
+    }
+    measuring_ = false;
+    // 开环：结束时没完成的请求不能丢掉，否则服务器跟不上时延迟反而偏低；延迟按到结束时刻记录
+    if(rate_ > 0) {
+        for(int64_t s : backlog_) { latency.Record(max<int64_t>(0, endNs - s) / 1000); }
+        unsent = backlog_.size();
+        for(auto& c : conns_) {
+            for(auto& p : c.inflight) {
+                uint64_t us = max<int64_t>(0, endNs - p.startNs) / 1000;
+                latency.Record(us);
+                perScenario_[p.scenario].Record(us);
+            }
+            inFlight += c.inflight.size();
+        }
+    }
+    for(auto& c : conns_) { Close_(c, false); }
+    close(epfd_);
+}
+
+static void Percentiles(const Histogram& h, string* out) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "{\"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, "
+            "\"p999\": %llu, \"max\": %llu}", h.Mean(),
+            (unsigned long long)h.Percentile(0.5), (unsigned long long)h.Percentile(0.9),
+            (unsigned long long)h.Percentile(0.99), (unsigned long long)h.Percentile(0.999),
+            (unsigned long long)h.Max());
+    out->append(buf);
+}
+
+static string JsonEscape(const string& s) {
+    string out;
+    for(char ch : s) {
+        if(ch == '"' || ch == '\\') { out.push_back('\\'); out.push_back(ch); }
+        else if((unsigned char)ch < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", ch);
+            out.append(buf);
+        }
+        else { out.push_back(ch); }
+    }
+    return out;
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    string a, b;
+    double weight;
+    vector<pair<char, string>> mix;         // 按命令行顺序加入请求
+    while((opt = getopt(argc, argv, "c:t:T:p:r:Ku:R:l:g:o:jh")) != -1) {
+        switch(opt) {
+        case 'c': cfg.conns = atoi(optarg); break;
+        case 't': cfg.seconds = atoi(optarg); break;
+        case 'T': cfg.threads = atoi(optarg); break;
+        case 'p': cfg.depth = atoi(optarg); break;
+        case 'r': cfg.rate = atof(optarg); break;
+        case 'K': cfg.keepAlive = false; break;
+        case 'u': case 'R': case 'l': case 'g': mix.emplace_back(opt, optarg); break;
+        case 'o': cfg.jsonFile = optarg; break;
+        case 'j': cfg.json = true; break;
+        default: Usage();
+        }
+    }
+    if(optind != argc - 1 || !ParseUrl(argv[optind])) { Usage(); }
+    if(cfg.conns <= 0 || cfg.seconds <= 0 || cfg.threads <= 0 || cfg.depth <= 0 || cfg.rate < 0) { Usage(); }
+    if(!cfg.keepAlive) { cfg.depth = 1; }
+    cfg.threads = min(cfg.threads, cfg.conns);
+
+    // 请求必须在Host确定之后生成
+    for(auto& m : mix) {
+        switch(m.first) {
+        case 'u': LoadMixFile(m.second.c_str()); break;
+        case 'R': {
+            string root = m.second;
+            while(root.size() > 1 && root.back() == '/') { root.pop_back(); }
+            LoadDir(root, "");
+            break;
+        }
+        case 'l':
+            if(!SplitSpec(m.second.c_str(), &a, &b, &weight)) { Usage(); }
+            AddScenario("POST", "/login.html", "username=" + a + "&password=" + b, weight);
+            cfg.scenarios.back().name = "POST /login.html (login)";
+            break;
+        case 'g': {
+            if(!SplitSpec(m.second.c_str(), &a, &b, &weight)) { Usage(); }
+            Scenario s;
+            s.name = "POST /register.html (register)";
+            s.path = "/register.html";
+            s.prefix = a;
+            s.password = b;
+            s.weight = weight;
+            s.kind = Scenario::REGISTER;
+            cfg.scenarios.push_back(s);
+            break;
+        }
+        }
+    }
+    if(cfg.scenarios.empty()) { AddScenario("GET", cfg.path, "", 1); }
+    double total = 0;
+    for(auto& s : cfg.scenarios) {
+        total += s.weight;
+        cfg.cumWeight.push_back(total);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // 连接和速率平均分给各线程
+    vector<unique_ptr<Worker>> workers;
+    for(int i = 0; i < cfg.threads; i++) {
+        int conns = cfg.conns / cfg.threads + (i < cfg.conns % cfg.threads ? 1 : 0);
+        workers.emplace_back(new Worker(i, conns, cfg.rate / cfg.threads));
+    }
+    int64_t startNs = NowNs();
+    int64_t endNs = startNs + (int64_t)cfg.seconds * 1000000000;
+    vector<thread> threads;
+    for(auto& w : workers) {
+        threads.emplace_back(&Worker::Run, w.get(), startNs, endNs);
+    }
+    for(auto& t : threads) { t.join(); }
+    double elapsed = (NowNs() - startNs) / 1e9;
+
+    // 汇总
+    Histogram latency;
+    vector<Histogram> perScenario(cfg.scenarios.size());
+    vector<uint64_t> scenarioCnt(cfg.scenarios.size(), 0);
+    uint64_t status[6] = {0}, completed = 0, bytes = 0, connects = 0, connectErrors = 0;
+    uint64_t socketErrors = 0, maxBacklog = 0, unsent = 0, inFlight = 0;
+    for(auto& w : workers) {
+        latency.Merge(w->latency);
+        for(size_t i = 0; i < cfg.scenarios.size(); i++) {
+            perScenario[i].Merge(w->PerScenario()[i]);
+            scenarioCnt[i] += w->ScenarioCount()[i];
+        }
+        for(int i = 0; i < 6; i++) { status[i] += w->status[i]; }
+        completed += w->completed;
+        bytes += w->bytes;
+        connects += w->connects;
+        connectErrors += w->connectErrors;
+        socketErrors += w->socketErrors;
+        maxBacklog += w->maxBacklog;
+        unsent += w->unsent;
+        inFlight += w->inFlight;
+    }
+
+    char buf[512];
+    string json = "{\n";
+    snprintf(buf, sizeof(buf), "  \"target\": \"http://%s:%d\",\n  \"connections\": %d,\n  \"threads\": %d,\n"
+            "  \"duration_s\": %.3f,\n  \"keepalive\": %s,\n  \"pipeline\": %d,\n  \"rate\": %.1f,\n",
+            JsonEscape(cfg.host).c_str(), cfg.port, cfg.conns, cfg.threads, elapsed,
+            cfg.keepAlive ? "true" : "false", cfg.depth, cfg.rate);
+    json += buf;
+    snprintf(buf, sizeof(buf), "  \"requests\": %llu,\n  \"rps\": %.1f,\n  \"bytes\": %llu,\n"
+            "  \"connects\": %llu,\n  \"max_backlog\": %llu,\n",
+            (unsigned long long)completed, completed / elapsed, (unsigned long long)bytes,
+            (unsigned long long)connects, (unsigned long long)maxBacklog);
+    json += buf;
+    snprintf(buf, sizeof(buf), "  \"status\": {\"1xx\": %llu, \"2xx\": %llu, \"3xx\": %llu, \"4xx\": %llu, "
+            "\"5xx\": %llu, \"other\": %llu},\n  \"errors\": {\"connect\": %llu, \"socket\": %llu},\n"
+            "  \"unfinished\": {\"unsent\": %llu, \"in_flight\": %llu},\n",
+            (unsigned long long)status[1], (unsigned long long)status[2], (unsigned long long)status[3],
+            (unsigned long long)status[4], (unsigned long long)status[5], (unsigned long long)status[0],
+            (unsigned long long)connectErrors, (unsigned long long)socketErrors,
+            (unsigned long long)unsent, (unsigned long long)inFlight);
+    json += buf;
+    json += "  \"latency_us\": ";
+    Percentiles(latency, &json);
+    json += ",\n  \"scenarios\": [";
+    for(size_t i = 0; i < cfg.scenarios.size(); i++) {
+        json += i ? ",\n    " : "\n    ";
+        json += "{\"name\": \"" + JsonEscape(cfg.scenarios[i].name) + "\", \"requests\": " +
+                to_string(scenarioCnt[i]) + ", \"latency_us\": ";
+        Percentiles(perScenario[i], &json);
+        json += "}";
+    }
+    json += "\n  ]\n}\n";
+
+    if(!cfg.jsonFile.empty()) {
+        FILE* fp = fopen(cfg.jsonFile.c_str(), "w");
+        if(!fp || fwrite(json.data(), 1, json.size(), fp) != json.size()) {
+            fprintf(stderr, "loadgen: cannot write %s\n", cfg.jsonFile.c_str());
+        }
+        if(fp) { fclose(fp); }
+    }
+    if(cfg.json) {
+        fputs(json.c_str(), stdout);
+    } else {
+        printf("%s:%d  %d connections, %d threads, %.1fs, %s, pipeline %d, %s\n",
+                cfg.host.c_str(), cfg.port, cfg.conns, cfg.threads, elapsed,
+                cfg.keepAlive ? "keep-alive" : "close", cfg.depth,
+                cfg.rate > 0 ? ("open loop " + to_string((long long)cfg.rate) + " req/s").c_str() : "closed loop");
+        printf("requests %llu  %.1f req/s  %.2f MB/s\n", (unsigned long long)completed,
+                completed / elapsed, bytes / elapsed / 1048576);
+        printf("status 2xx %llu  3xx %llu  4xx %llu  5xx %llu  other %llu\n",
+                (unsigned long long)status[2], (unsigned long long)status[3],
+                (unsigned long long)status[4], (unsigned long long)status[5],
+                (unsigned long long)(status[0] + status[1]));
+        printf("errors connect %llu  socket %llu  connects %llu\n", (unsigned long long)connectErrors,
+                (unsigned long long)socketErrors, (unsigned long long)connects);
+        if(unsent + inFlight > 0) {
+            printf("unfinished unsent %llu  in flight %llu  (included in latency up to the end of the run)\n",
+                    (unsigned long long)unsent, (unsigned long long)inFlight);
+        }
+        printf("latency(us) mean %.0f  p50 %llu  p90 %llu  p99 %llu  p99.9 %llu  max %llu\n",
+                latency.Mean(), (unsigned long long)latency.Percentile(0.5),
+                (unsigned long long)latency.Percentile(0.9), (unsigned long long)latency.Percentile(0.99),
+                (unsigned long long)latency.Percentile(0.999), (unsigned long long)latency.Max());
+        if(cfg.scenarios.size() > 1) {
+            for(size_t i = 0; i < cfg.scenarios.size(); i++) {
+                printf("  %-40s %8llu  p50 %llu  p99 %llu\n", cfg.scenarios[i].name.c_str(),
+                        (unsigned long long)scenarioCnt[i],
+                        (unsigned long long)perScenario[i].Percentile(0.5),
+                        (unsigned long long)perScenario[i].Percentile(0.99));
+            }
+        }
+    }
+    return completed > 0 ? 0 : 1;
+}
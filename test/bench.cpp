@@ -0,0 +1,451 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-21
+ * @copyleft Apache 2.0
+ */
+#include "../code/buffer/buffer.h"
+#include "../code/buffer/chainbuffer.h"
+#include "../code/buffer/arena.h"
+#include "../code/http/httprequest.h"
+#include "../code/timer/heaptimer.h"
+#include "../code/log/blockqueue.h"
+#include "../code/pool/threadpool.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <algorithm>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+
+/* 热路径微基准：自带的计时框架，不依赖第三方库
+   用法：./bench [-f 名字子串] [-t 每次测量最短秒数] [-o result.json] [-c baseline.json]
+   每个基准先自动确定迭代次数，再测量REPEAT次取中位数；-c 与之前的JSON结果对比 */
+
+#ifndef BENCH_COMMIT
+#define BENCH_COMMIT "unknown"
+#endif
+
+static int64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// 防止被优化掉
+template<class T>
+static void DoNotOptimize(T&& v) {
+    asm volatile("" : : "g"(&v) : "memory");
+}
+
+struct Result {
+    std::string name;
+    uint64_t ops;           // 最后一次测量的操作数
+    double nsPerOp;         // 中位数
+    double minNsPerOp;
+    double bytesPerOp;      // 0 表示不统计吞吐
+};
+
+/* 基准函数：执行ops次操作，返回计时部分耗时（纳秒），准备工作可以不计时 */
+typedef std::function<int64_t(uint64_t ops)> BenchFn;
+
+static const int REPEAT = 5;
+static double minSeconds = 0.2;
+static std::string filter;
+static std::vector<Result> results;
+
+static void Run(const std::string& name, BenchFn fn, double bytesPerOp = 0) {
+    if(!filter.empty() && name.find(filter) == std::string::npos) { return; }
+    // 01：确定迭代次数，使单次测量不短于minSeconds
+    uint64_t ops = 1;
+    int64_t ns = fn(ops);
+    while(ns < minSeconds * 1e9 && ops < (1ULL << 40)) {
+        double scale = ns > 0 ? minSeconds * 1e9 / ns * 1.2 : 100;
+        ops = std::max(ops + 1, (uint64_t)(ops * std::min(scale, 100.0)));
+        ns = fn(ops);
+    }
+    // 02：重复测量取中位数
+    std::vector<double> samples;
+    for(int i = 0; i < REPEAT; i++) {
+        samples.push_back((double)fn(ops) / ops);
+    }
+    std::sort(samples.begin(), samples.end());
+    Result r = { name, ops, samples[REPEAT / 2], samples[0], bytesPerOp };
+    results.push_back(r);
+    printf("%-40s %12.1f ns/op %12.1f min", name.c_str(), r.nsPerOp, r.minNsPerOp);
+    if(bytesPerOp > 0) { printf(" %10.1f MB/s", bytesPerOp / r.nsPerOp * 1e9 / 1048576); }
+    printf("\n");
+    fflush(stdout);
+}
+
+/* ---------------- Buffer ---------------- */
+
+static void BenchBuffer() {
+    for(size_t len : { 64, 1024, 16384 }) {
+        Run("Buffer/Append/" + std::to_string(len), [len](uint64_t ops) {
+            std::string data(len, 'x');
+            Buffer buff;
+            int64_t start = NowNs();
+            for(uint64_t i = 0; i < ops; i++) {
+                buff.Append(data.data(), len);
+                if(buff.ReadableBytes() >= (1 << 20)) { buff.RetrieveAll(); }
+            }
+            return NowNs() - start;
+        }, len);
+    }
+
+    // 对端先写入一块数据，再由ReadFd读出；写入同样计时，两种缓冲区一致
+    for(size_t len : { 4096, 65536 }) {
+        Run("Buffer/ReadFd/" + std::to_string(len), [len](uint64_t ops) {
+            int fds[2];
+            socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+            int size = 1 << 20;
+            setsockopt(fds[0], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+            setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+            std::string data(len, 'x');
+            Buffer buff;
+            int err = 0;
+            int64_t start = NowNs();
+            for(uint64_t i = 0; i < ops; i++) {
+                ssize_t n = write(fds[1], data.data(), len);
+                size_t got = 0;
+                while(got < (size_t)n) {
+                    ssize_t m = buff.ReadFd(fds[0], &err);
+                    if(m <= 0) { break; }
+                    got += m;
+                }
+                buff.RetrieveAll();
+            }
+            int64_t ns = NowNs() - start;
+            close(fds[0]);
+            close(fds[1]);
+            return ns;
+        }, len);
+
+        Run("ChainBuffer/ReadFd/" + std::to_string(len), [len](uint64_t ops) {
+            int fds[2];
+            socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+            int size = 1 << 20;
+            setsockopt(fds[0], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+            setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+            std::string data(len, 'x');
+            ChainBuffer buff;
+            int err = 0;
+            int64_t start = NowNs();
+            for(uint64_t i = 0; i < ops; i++) {
+                ssize_t n = write(fds[1], data.data(), len);
+                size_t got = 0;
+                while(got < (size_t)n) {
+                    ssize_t m = buff.ReadFd(fds[0], &err);
+                    if(m <= 0) { break; }
+                    got += m;
+                }
+                buff.RetrieveAll();
+            }
+            int64_t ns = NowNs() - start;
+            close(fds[0]);
+            close(fds[1]);
+            return ns;
+        }, len);
+    }
+}
+
+/* ---------------- HttpRequest::parse ---------------- */
+
+// 浏览器实际发出的请求（Chrome / Firefox / curl），POST不用登录路径以免访问数据库
+static const char* CHROME_GET =
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: 192.168.248.133:5050\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) "
+    "Chrome/83.0.4103.97 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/webp,image/apng,*/*;q=0.8,"
+    "application/signed-exchange;v=b3;q=0.9\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Cookie: _ga=GA1.1.1234567890.1592200000; _gid=GA1.1.987654321.1592300000\r\n"
+    "\r\n";
+
+static const char* FIREFOX_IMAGE =
+    "GET /images/profile-image.jpg HTTP/1.1\r\n"
+    "Host: 192.168.248.133:5050\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Ubuntu; Linux x86_64; rv:77.0) Gecko/20100101 Firefox/77.0\r\n"
+    "Accept: image/webp,*/*\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\n"
+    "Referer: http://192.168.248.133:5050/picture.html\r\n"
+    "\r\n";
+
+static const char* CURL_GET =
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost:5050\r\n"
+    "User-Agent: curl/7.68.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n";
+
+static const char* CHROME_POST =
+    "POST /picture.html HTTP/1.1\r\n"
+    "Host: 192.168.248.133:5050\r\n"
+    "Connection: keep-alive\r\n"
+    "Content-Length: 35\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "Origin: http://192.168.248.133:5050\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) "
+    "Chrome/83.0.4103.97 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/webp,*/*;q=0.8\r\n"
+    "Referer: http://192.168.248.133:5050/login.html\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9\r\n"
+    "\r\n"
+    "username=mark%40test&password=12%2B3";
+
+static void BenchParse() {
+    struct { const char* name; const char* req; } cases[] = {
+        { "chrome_get", CHROME_GET }, { "firefox_image", FIREFOX_IMAGE },
+        { "curl_get", CURL_GET }, { "chrome_post", CHROME_POST },
+    };
+    for(auto& c : cases) {
+        const char* req = c.req;
+        size_t len = strlen(req);
+        // 与HttpConn相同：每个请求Init，结束后整体释放arena
+        Run(std::string("HttpRequest/parse/") + c.name, [req, len](uint64_t ops) {
+            Arena arena;
+            HttpRequest request(arena.Resource());
+            Buffer buff;
+            int64_t start = NowNs();
+            for(uint64_t i = 0; i < ops; i++) {
+                buff.Append(req, len);
+                request.Init();
+                bool ok = request.parse(buff);
+                DoNotOptimize(ok);
+                buff.RetrieveAll();
+                request.Init();
+                arena.Reset();
+            }
+            return NowNs() - start;
+        }, len);
+
+        Run(std::string("HttpRequest/parse_chain/") + c.name, [req, len](uint64_t ops) {
+            Arena arena;
+            HttpRequest request(arena.Resource());
+            ChainBuffer buff;
+            int64_t start = NowNs();
+            for(uint64_t i = 0; i < ops; i++) {
+                buff.Append(req, len);
+                request.Init();
+                bool ok = request.parse(buff);
+                DoNotOptimize(ok);
+                buff.RetrieveAll();
+                request.Init();
+                arena.Reset();
+            }
+            return NowNs() - start;
+        }, len);
+    }
+}
+
+/* ---------------- HeapTimer ---------------- */
+
+static uint64_t Rand(uint64_t& s) {
+    s ^= s << 13; s ^= s >> 7; s ^= s << 17;
+    return s;
+}
+
+static void BenchHeapTimer() {
+    for(int n : { 10000, 100000 }) {
+        std::string suffix = "/" + std::to_string(n);
+        // 每轮新建定时器并加入n个节点
+        Run("HeapTimer/add" + suffix, [n](uint64_t ops) {
+            int64_t ns = 0;
+            uint64_t seed = 88172645463325252ULL;
+            for(uint64_t done = 0; done < ops; done += n) {
+                HeapTimer timer;
+                int64_t start = NowNs();
+                for(int id = 0; id < n; id++) {
+                    timer.add(id, 60000 + Rand(seed) % 60000, [] {});
+                }
+                ns += NowNs() - start;
+            }
+            return ns * (int64_t)ops / (int64_t)(((ops + n - 1) / n) * n);
+        });
+
+        // n个节点中随机延长一个（每次读写事件都会调用，与服务器一样总是延长到now+timeout）
+        Run("HeapTimer/adjust" + suffix, [n](uint64_t ops) {
+            uint64_t seed = 88172645463325252ULL;
+            HeapTimer timer;
+            for(int id = 0; id < n; id++) {
+                timer.add(id, Rand(seed) % 60000, [] {});
+            }
+            int64_t start = NowNs();
+            for(uint64_t i = 0; i < ops; i++) {
+                timer.adjust(Rand(seed) % n, 60000);
+            }
+            return NowNs() - start;
+        });
+
+        // n个节点全部到期，tick依次弹出
+        Run("HeapTimer/tick" + suffix, [n](uint64_t ops) {
+            int64_t ns = 0;
+            uint64_t seed = 88172645463325252ULL;
+            for(uint64_t done = 0; done < ops; done += n) {
+                HeapTimer timer;
+                for(int id = 0; id < n; id++) {
+                    timer.add(id, -(int)(Rand(seed) % 1000), [] {});
+                }
+                int64_t start = NowNs();
+                timer.tick();
+                ns += NowNs() - start;
+            }
+            return ns * (int64_t)ops / (int64_t)(((ops + n - 1) / n) * n);
+        });
+    }
+}
+
+/* ---------------- 队列 ---------------- */
+
+// producers个线程各放入ops/producers个元素，consumers个线程取完为止
+template<class Push, class Pop, class Close>
+static int64_t QueueRun(uint64_t ops, int producers, int consumers, Push push, Pop pop, Close closeFn) {
+    uint64_t per = std::max<uint64_t>(1, ops / producers);
+    uint64_t total = per * producers;
+    std::atomic<uint64_t> popped(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for(int c = 0; c < consumers; c++) {
+        threads.emplace_back([&] {
+            while(!go) {}
+            int v;
+            while(popped.load(std::memory_order_relaxed) < total && pop(v)) {
+                popped.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    for(int p = 0; p < producers; p++) {
+        threads.emplace_back([&, p] {
+            while(!go) {}
+            for(uint64_t i = 0; i < per; i++) { push((int)(p * per + i)); }
+        });
+    }
+    int64_t start = NowNs();
+    go = true;
+    while(popped.load() < total) { std::this_thread::yield(); }
+    int64_t ns = NowNs() - start;
+    closeFn();
+    for(auto& t : threads) { t.join(); }
+    return ns;
+}
+
+static void BenchQueues() {
+    const std::pair<int, int> shapes[] = { {1, 1}, {4, 1}, {4, 4} };
+    for(auto& shape : shapes) {
+        int p = shape.first, c = shape.second;
+        std::string suffix = "/" + std::to_string(p) + "x" + std::to_string(c);
+        Run("BlockDeque/push_pop" + suffix, [p, c](uint64_t ops) {
+            BlockDeque<int> q(1024);
+            return QueueRun(ops, p, c, [&](int v) { q.push_back(v); },
+                            [&](int& v) { return q.pop(v); }, [&] { q.Close(); });
+        });
+    }
+}
+
+/* ---------------- ThreadPool ---------------- */
+
+static void BenchThreadPool() {
+    for(int threads : { 1, 4, 8 }) {
+        // 单个生产者（与主线程相同）提交空任务，直到全部执行完
+        Run("ThreadPool/AddTask/" + std::to_string(threads), [threads](uint64_t ops) {
+            std::atomic<uint64_t> done(0);
+            int64_t ns;
+            {
+                ThreadPool pool(threads);
+                int64_t start = NowNs();
+                for(uint64_t i = 0; i < ops; i++) {
+                    pool.AddTask([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+                }
+                while(done.load() < ops) { std::this_thread::yield(); }
+                ns = NowNs() - start;
+            }
+            return ns;
+        });
+    }
+}
+
+/* ---------------- 输出与对比 ---------------- */
+
+static void WriteJson(const char* file) {
+    FILE* fp = fopen(file, "w");
+    if(!fp) {
+        fprintf(stderr, "bench: cannot write %s\n", file);
+        return;
+    }
+    // 每个基准一行，便于diff和-c读取
+    fprintf(fp, "{\n  \"commit\": \"%s\",\n  \"cpus\": %u,\n  \"benchmarks\": [\n",
+            BENCH_COMMIT, std::thread::hardware_concurrency());
+    for(size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        fprintf(fp, "    {\"name\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.2f, \"min_ns_per_op\": %.2f, "
+                "\"bytes_per_op\": %.0f}%s\n", r.name.c_str(), (unsigned long long)r.ops, r.nsPerOp,
+                r.minNsPerOp, r.bytesPerOp, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+    fclose(fp);
+}
+
+static void Compare(const char* file) {
+    std::ifstream in(file);
+    if(!in) {
+        fprintf(stderr, "bench: cannot open %s\n", file);
+        return;
+    }
+    std::string line;
+    printf("\n%-40s %12s %12s %8s\n", "compare", "base ns/op", "now ns/op", "change");
+    while(std::getline(in, line)) {
+        size_t n = line.find("\"name\": \"");
+        size_t v = line.find("\"ns_per_op\": ");
+        if(n == std::string::npos || v == std::string::npos) { continue; }
+        n += 9;
+        std::string name = line.substr(n, line.find('"', n) - n);
+        double base = atof(line.c_str() + v + 13);
+        for(auto& r : results) {
+            if(r.name == name && base > 0) {
+                printf("%-40s %12.1f %12.1f %+7.1f%%\n", name.c_str(), base, r.nsPerOp,
+                        (r.nsPerOp - base) / base * 100);
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const char* out = nullptr;
+    const char* base = nullptr;
+    int opt;
+    while((opt = getopt(argc, argv, "f:t:o:c:")) != -1) {
+        switch(opt) {
+        case 'f': filter = optarg; break;
+        case 't': minSeconds = atof(optarg); break;
+        case 'o': out = optarg; break;
+        case 'c': base = optarg; break;
+        default:
+            fprintf(stderr, "usage: bench [-f filter] [-t seconds] [-o out.json] [-c baseline.json]\n");
+            return 2;
+        }
+    }
+    printf("commit %s, %u cpus\n", BENCH_COMMIT, std::thread::hardware_concurrency());
+    BenchBuffer();
+    BenchParse();
+    BenchHeapTimer();
+    BenchQueues();
+    BenchThreadPool();
+    if(out) { WriteJson(out); }
+    if(base) { Compare(base); }
+    return 0;
+}
@@ -0,0 +1,327 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-20
+ * @copyleft Apache 2.0
+ */
+#include "../code/server/epoller.h"
+#include "../code/timer/heaptimer.h"
+#include "../code/http/httpconn.h"
+#include "regress_shim.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <sys/socket.h>
+
+using namespace std;
+
+/* 请求路径的系统调用/内存分配回归检查：make regress
+   按WebServer的调用顺序（AddClient_/DealRead_/OnRead_/OnProcess/OnWrite_/CloseConn_）驱动真实的
+   Epoller、HeapTimer和HttpConn，单线程执行（线程池的任务直接内联），客户端用socketpair的另一端
+   只统计服务端一侧：客户端收发前后暂停计数。每个场景先预热，再取多次请求的平均值，
+   超过regress_budget.txt中的预算时退出码为1；-u 打印本次测得的值，可直接替换预算文件 */
+
+static const int WARMUP = 3;
+static const int ROUNDS = 20;
+static const int PIPELINE = 4;
+static const int TIMEOUT_MS = 60000;
+
+// 一个场景的测量结果（每个请求的平均值）
+struct Result {
+    string name;
+    double syscalls;
+    double allocs;
+    unsigned long counts[SHIM_NUM];
+    int requests;
+};
+
+// 单线程的服务端：与WebServer的连接处理流程一致
+class Server {
+public:
+    Server() : connEvent_(EPOLLONESHOT | EPOLLRDHUP | EPOLLET) {}
+
+    void AddClient(int fd) {
+        sockaddr_in addr = {};
+        users_[fd].init(fd, addr);
+        Metrics::Add(Metrics::ACCEPTS);
+        timer_.add(fd, TIMEOUT_MS, std::bind(&Server::CloseConn_, this, &users_[fd]));
+        epoller_.AddFd(fd, EPOLLIN | connEvent_);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFD, 0) | O_NONBLOCK);
+    }
+
+    // 处理完所有就绪事件后返回（对应Start()中循环的若干轮，最后一次epoll_wait返回0）
+    void RunUntilIdle() {
+        while(true) {
+            timer_.GetNextTick();
+            int n = epoller_.Wait(0);
+            if(n <= 0) { break; }
+            for(int i = 0; i < n; i++) {
+                int fd = epoller_.GetEventFd(i);
+                uint32_t events = epoller_.GetEvents(i);
+                HttpConn* client = &users_[fd];
+                if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    CloseConn_(client);
+                }
+                else if(events & EPOLLIN) {
+                    timer_.adjust(fd, TIMEOUT_MS);
+                    client->SetState(Metrics::CONN_ACTIVE);
+                    OnRead_(client);
+                }
+                else if(events & EPOLLOUT) {
+                    timer_.adjust(fd, TIMEOUT_MS);
+                    client->SetState(Metrics::CONN_ACTIVE);
+                    OnWrite_(client);
+                }
+            }
+        }
+    }
+
+private:
+    void CloseConn_(HttpConn* client) {
+        epoller_.DelFd(client->GetFd());
+        client->Close();
+    }
+
+    void OnRead_(HttpConn* client) {
+        int readErrno = 0;
+        ssize_t ret = client->read(&readErrno);
+        if(ret <= 0 && readErrno != EAGAIN) {
+            CloseConn_(client);
+            return;
+        }
+        OnProcess_(client);
+    }
+
+    void OnProcess_(HttpConn* client) {
+        if(client->process()) {
+            client->SetState(Metrics::CONN_WRITING);
+            epoller_.ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+        }
+        else {
+            client->SetState(Metrics::CONN_READING);
+            epoller_.ModFd(client->GetFd(), connEvent_ | EPOLLIN);
+        }
+    }
+
+    void OnWrite_(HttpConn* client) {
+        int writeErrno = 0;
+        ssize_t ret = client->write(&writeErrno);
+        if(client->ToWriteBytes() == 0) {
+            if(client->IsKeepAlive()) {
+                OnProcess_(client);
+                return;
+            }
+        }
+        else if(ret < 0 && writeErrno == EAGAIN) {
+            client->SetState(Metrics::CONN_WRITING);
+            epoller_.ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+            return;
+        }
+        CloseConn_(client);
+    }
+
+    uint32_t connEvent_;
+    Epoller epoller_;
+    HeapTimer timer_;
+    map<int, HttpConn> users_;
+};
+
+// 客户端：收完n个完整响应为止，期间不断让服务端继续发送（大文件时触发部分写）
+class Client {
+public:
+    explicit Client(int fd) : fd_(fd) {}
+
+    void Send(const string& req) {
+        shim_pause();
+        size_t sent = 0;
+        while(sent < req.size()) {
+            ssize_t len = ::write(fd_, req.data() + sent, req.size() - sent);
+            assert(len > 0);
+            sent += len;
+        }
+        shim_resume();
+    }
+
+    // 返回是否收齐n个响应；对端关闭时也返回
+    bool Receive(Server* server, int n) {
+        int done = 0;
+        while(done < n) {
+            server->RunUntilIdle();
+            shim_pause();
+            char buf[65536];
+            ssize_t len;
+            bool closed = false;
+            while((len = ::recv(fd_, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+                data_.append(buf, len);
+            }
+            if(len == 0) { closed = true; }
+            while(done < n && TakeResponse_()) { done++; }
+            shim_resume();
+            if(closed && done < n) { return false; }
+        }
+        return true;
+    }
+
+private:
+    // 缓冲区中有完整响应时取出
+    bool TakeResponse_() {
+        size_t end = data_.find("\r\n\r\n");
+        if(end == string::npos) { return false; }
+        assert(data_.compare(0, 12, "HTTP/1.1 200") == 0);
+        size_t pos = data_.find("Content-length: ");
+        assert(pos != string::npos && pos < end);
+        size_t total = end + 4 + strtoul(data_.c_str() + pos + 16, nullptr, 10);
+        if(data_.size() < total) { return false; }
+        data_.erase(0, total);
+        return true;
+    }
+
+    int fd_;
+    string data_;
+};
+
+static string Get(const string& path, bool keepAlive) {
+    return "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\nUser-Agent: regress\r\n"
+            "Accept: */*\r\nConnection: " + (keepAlive ? "keep-alive" : "close") + "\r\n\r\n";
+}
+
+static void Finish(Result* res, int requests) {
+    unsigned long allocs;
+    shim_stop(res->counts, &allocs);
+    unsigned long total = 0;
+    for(int i = 0; i < SHIM_NUM; i++) { total += res->counts[i]; }
+    res->requests = requests;
+    res->syscalls = (double)total / requests;
+    res->allocs = (double)allocs / requests;
+}
+
+// 同一个keep-alive连接上依次发送，pipeline个请求一起写入；sndBuf>0时缩小服务端发送缓冲区
+static Result KeepAlive(const char* name, const string& path, int pipeline, int sndBuf) {
+    int fds[2];
+    int ret = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    assert(ret == 0);
+    if(sndBuf > 0) {
+        ret = setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndBuf, sizeof(sndBuf));
+        assert(ret == 0);
+    }
+    Server server;
+    Client client(fds[1]);
+    server.AddClient(fds[0]);
+    string req;
+    for(int i = 0; i < pipeline; i++) { req += Get(path, true); }
+
+    for(int i = 0; i < WARMUP; i++) {
+        client.Send(req);
+        bool ok = client.Receive(&server, pipeline);
+        assert(ok);
+    }
+    Result res;
+    res.name = name;
+    shim_start();
+    for(int i = 0; i < ROUNDS; i++) {
+        client.Send(req);
+        bool ok = client.Receive(&server, pipeline);
+        assert(ok);
+        (void)ok;
+    }
+    Finish(&res, ROUNDS * pipeline);
+    close(fds[1]);
+    server.RunUntilIdle();
+    (void)ret;
+    return res;
+}
+
+// 每个请求一个短连接：包括建立连接（AddClient_）和服务端关闭连接
+static Result ShortGet(const char* name, const string& path) {
+    Server server;
+    Result res;
+    res.name = name;
+    for(int i = 0; i < WARMUP + ROUNDS; i++) {
+        if(i == WARMUP) { shim_start(); }
+        shim_pause();
+        int fds[2];
+        int ret = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        assert(ret == 0);
+        (void)ret;
+        shim_resume();
+        Client client(fds[1]);
+        server.AddClient(fds[0]);
+        client.Send(Get(path, false));
+        bool ok = client.Receive(&server, 1);
+        assert(ok);
+        (void)ok;
+        shim_pause();
+        close(fds[1]);
+        shim_resume();
+    }
+    Finish(&res, ROUNDS);
+    return res;
+}
+
+// 预算文件：每行 "场景 每请求系统调用数 每请求分配次数"，#开头为注释
+static map<string, pair<double, double>> LoadBudget(const char* path) {
+    map<string, pair<double, double>> budget;
+    ifstream in(path);
+    string line;
+    while(getline(in, line)) {
+        if(line.empty() || line[0] == '#') { continue; }
+        istringstream fields(line);
+        string name;
+        double syscalls, allocs;
+        if(fields >> name >> syscalls >> allocs) {
+            budget[name] = { syscalls, allocs };
+        }
+    }
+    return budget;
+}
+
+int main(int argc, char* argv[]) {
+    bool update = false;
+    const char* budgetPath = "regress_budget.txt";
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-u") == 0) { update = true; }
+        else { budgetPath = argv[i]; }
+    }
+
+    // 与服务器的默认配置一致：ET模式，日志和访问日志关闭，保证结果可重复
+    HttpConn::srcDir = "../resources/";
+    HttpConn::isET = true;
+    HttpConn::accessLog = false;
+
+    vector<Result> results;
+    results.push_back(KeepAlive("keepalive_get", "/index.html", 1, 0));
+    results.push_back(KeepAlive("pipelined_get", "/index.html", PIPELINE, 0));
+    results.push_back(KeepAlive("large_file", "/images/instagram-image4.jpg", 1, 16384));
+    results.push_back(ShortGet("short_get", "/index.html"));
+
+    if(update) {
+        printf("# 场景 每请求系统调用数 每请求分配次数（make regress 对比，超出即失败）\n");
+        for(const Result& r : results) {
+            printf("%s %.2f %.2f\n", r.name.c_str(), r.syscalls, r.allocs);
+        }
+        return 0;
+    }
+
+    map<string, pair<double, double>> budget = LoadBudget(budgetPath);
+    bool failed = false;
+    for(const Result& r : results) {
+        auto it = budget.find(r.name);
+        bool over = it != budget.end() &&
+                (r.syscalls > it->second.first + 1e-9 || r.allocs > it->second.second + 1e-9);
+        failed |= over;
+        printf("%-16s syscalls/req %7.2f", r.name.c_str(), r.syscalls);
+        if(it != budget.end()) { printf(" (budget %.2f)", it->second.first); }
+        printf("  allocs/req %7.2f", r.allocs);
+        if(it != budget.end()) { printf(" (budget %.2f)", it->second.second); }
+        printf("  %s\n   ", it == budget.end() ? "NO BUDGET" : (over ? "OVER BUDGET" : "ok"));
+        for(int i = 0; i < SHIM_NUM; i++) {
+            if(r.counts[i]) { printf(" %s=%.2f", SHIM_NAME[i], (double)r.counts[i] / r.requests); }
+        }
+        printf("\n");
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,268 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-20
+ * @copyleft Apache 2.0
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include "regress_shim.h"
+
+/* 系统调用与内存分配计数：链接进regress后覆盖libc中的同名函数，
+   计数后转给dlsym(RTLD_NEXT)找到的真实实现
+   只统计调用了shim_start的线程，且只看得到经过这些函数入口的调用，libc内部直接发起的系统调用不计 */
+
+static __thread int counting;
+static __thread unsigned long counts[SHIM_NUM];
+static __thread unsigned long allocs;
+
+const char* const SHIM_NAME[SHIM_NUM] = {
+    "read", "write", "readv", "writev", "send", "recv", "open", "close",
+    "stat", "fstat", "mmap", "munmap", "epoll_ctl", "epoll_wait", "fcntl",
+    "accept", "futex", "other",
+};
+
+#define COUNT(id) do { if(counting) { counts[id]++; } } while(0)
+#define REAL(ret, name, ...) \
+    static ret (*real)(__VA_ARGS__); \
+    if(!real) { real = (ret (*)(__VA_ARGS__))dlsym(RTLD_NEXT, name); }
+
+void shim_start(void) {
+    memset(counts, 0, sizeof(counts));
+    allocs = 0;
+    counting = 1;
+}
+
+void shim_pause(void) { counting = 0; }
+void shim_resume(void) { counting = 1; }
+
+void shim_stop(unsigned long* out, unsigned long* outAllocs) {
+    counting = 0;
+    memcpy(out, counts, sizeof(counts));
+    *outAllocs = allocs;
+}
+
+/* ---------- 系统调用 ---------- */
+
+ssize_t read(int fd, void* buf, size_t n) {
+    REAL(ssize_t, "read", int, void*, size_t);
+    COUNT(SHIM_READ);
+    return real(fd, buf, n);
+}
+
+ssize_t __read_chk(int fd, void* buf, size_t n, size_t buflen) {
+    (void)buflen;
+    return read(fd, buf, n);
+}
+
+ssize_t write(int fd, const void* buf, size_t n) {
+    REAL(ssize_t, "write", int, const void*, size_t);
+    COUNT(SHIM_WRITE);
+    return real(fd, buf, n);
+}
+
+ssize_t readv(int fd, const struct iovec* iov, int cnt) {
+    REAL(ssize_t, "readv", int, const struct iovec*, int);
+    COUNT(SHIM_READV);
+    return real(fd, iov, cnt);
+}
+
+ssize_t writev(int fd, const struct iovec* iov, int cnt) {
+    REAL(ssize_t, "writev", int, const struct iovec*, int);
+    COUNT(SHIM_WRITEV);
+    return real(fd, iov, cnt);
+}
+
+ssize_t send(int fd, const void* buf, size_t n, int flags) {
+    REAL(ssize_t, "send", int, const void*, size_t, int);
+    COUNT(SHIM_SEND);
+    return real(fd, buf, n, flags);
+}
+
+ssize_t recv(int fd, void* buf, size_t n, int flags) {
+    REAL(ssize_t, "recv", int, void*, size_t, int);
+    COUNT(SHIM_RECV);
+    return real(fd, buf, n, flags);
+}
+
+int open(const char* path, int flags, ...) {
+    REAL(int, "open", const char*, int, ...);
+    mode_t mode = 0;
+    if(flags & (O_CREAT | O_TMPFILE)) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    COUNT(SHIM_OPEN);
+    return real(path, flags, mode);
+}
+
+int open64(const char* path, int flags, ...) {
+    REAL(int, "open64", const char*, int, ...);
+    mode_t mode = 0;
+    if(flags & (O_CREAT | O_TMPFILE)) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    COUNT(SHIM_OPEN);
+    return real(path, flags, mode);
+}
+
+int __open_2(const char* path, int flags) {
+    return open(path, flags);
+}
+
+int __open64_2(const char* path, int flags) {
+    return open64(path, flags);
+}
+
+int openat(int dirfd, const char* path, int flags, ...) {
+    REAL(int, "openat", int, const char*, int, ...);
+    mode_t mode = 0;
+    if(flags & (O_CREAT | O_TMPFILE)) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    COUNT(SHIM_OPEN);
+    return real(dirfd, path, flags, mode);
+}
+
+int close(int fd) {
+    REAL(int, "close", int);
+    COUNT(SHIM_CLOSE);
+    return real(fd);
+}
+
+int stat(const char* path, struct stat* st) {
+    REAL(int, "stat", const char*, struct stat*);
+    COUNT(SHIM_STAT);
+    return real(path, st);
+}
+
+int lstat(const char* path, struct stat* st) {
+    REAL(int, "lstat", const char*, struct stat*);
+    COUNT(SHIM_STAT);
+    return real(path, st);
+}
+
+int fstat(int fd, struct stat* st) {
+    REAL(int, "fstat", int, struct stat*);
+    COUNT(SHIM_FSTAT);
+    return real(fd, st);
+}
+
+void* mmap(void* addr, size_t len, int prot, int flags, int fd, off_t off) {
+    REAL(void*, "mmap", void*, size_t, int, int, int, off_t);
+    COUNT(SHIM_MMAP);
+    return real(addr, len, prot, flags, fd, off);
+}
+
+int munmap(void* addr, size_t len) {
+    REAL(int, "munmap", void*, size_t);
+    COUNT(SHIM_MUNMAP);
+    return real(addr, len);
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event* ev) {
+    REAL(int, "epoll_ctl", int, int, int, struct epoll_event*);
+    COUNT(SHIM_EPOLL_CTL);
+    return real(epfd, op, fd, ev);
+}
+
+int epoll_wait(int epfd, struct epoll_event* evs, int max, int timeout) {
+    REAL(int, "epoll_wait", int, struct epoll_event*, int, int);
+    COUNT(SHIM_EPOLL_WAIT);
+    return real(epfd, evs, max, timeout);
+}
+
+int fcntl(int fd, int cmd, ...) {
+    REAL(int, "fcntl", int, int, ...);
+    va_list ap;
+    va_start(ap, cmd);
+    void* arg = va_arg(ap, void*);      // fcntl的第三个参数是int或指针，按指针宽度转发
+    va_end(ap);
+    COUNT(SHIM_FCNTL);
+    return real(fd, cmd, arg);
+}
+
+int accept(int fd, struct sockaddr* addr, socklen_t* len) {
+    REAL(int, "accept", int, struct sockaddr*, socklen_t*);
+    COUNT(SHIM_ACCEPT);
+    return real(fd, addr, len);
+}
+
+int accept4(int fd, struct sockaddr* addr, socklen_t* len, int flags) {
+    REAL(int, "accept4", int, struct sockaddr*, socklen_t*, int);
+    COUNT(SHIM_ACCEPT);
+    return real(fd, addr, len, flags);
+}
+
+long syscall(long nr, ...) {
+    REAL(long, "syscall", long, ...);
+    va_list ap;
+    va_start(ap, nr);
+    long a = va_arg(ap, long), b = va_arg(ap, long), c = va_arg(ap, long);
+    long d = va_arg(ap, long), e = va_arg(ap, long), f = va_arg(ap, long);
+    va_end(ap);
+    COUNT(nr == SYS_futex ? SHIM_FUTEX : SHIM_OTHER);
+    return real(nr, a, b, c, d, e, f);
+}
+
+/* ---------- 内存分配：直接转给glibc的__libc_*，避免dlsym自身分配内存引起递归 ---------- */
+
+extern void* __libc_malloc(size_t);
+extern void* __libc_calloc(size_t, size_t);
+extern void* __libc_realloc(void*, size_t);
+extern void* __libc_memalign(size_t, size_t);
+extern void __libc_free(void*);
+
+void* malloc(size_t n) {
+    if(counting) { allocs++; }
+    return __libc_malloc(n);
+}
+
+void* calloc(size_t cnt, size_t n) {
+    if(counting) { allocs++; }
+    return __libc_calloc(cnt, n);
+}
+
+void* realloc(void* p, size_t n) {
+    if(counting) { allocs++; }
+    return __libc_realloc(p, n);
+}
+
+void free(void* p) {
+    __libc_free(p);
+}
+
+int posix_memalign(void** out, size_t align, size_t n) {
+    if(counting) { allocs++; }
+    void* p = __libc_memalign(align, n);
+    if(!p) { return 12; }       // ENOMEM
+    *out = p;
+    return 0;
+}
+
+void* aligned_alloc(size_t align, size_t n) {
+    if(counting) { allocs++; }
+    return __libc_memalign(align, n);
+}
+
+void* memalign(size_t align, size_t n) {
+    if(counting) { allocs++; }
+    return __libc_memalign(align, n);
+}
@@ -0,0 +1,33 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-20
+ * @copyleft Apache 2.0
+ */
+#ifndef REGRESS_SHIM_H
+#define REGRESS_SHIM_H
+
+/* regress_shim.c的接口：计数只对调用线程生效 */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    SHIM_READ, SHIM_WRITE, SHIM_READV, SHIM_WRITEV, SHIM_SEND, SHIM_RECV, SHIM_OPEN, SHIM_CLOSE,
+    SHIM_STAT, SHIM_FSTAT, SHIM_MMAP, SHIM_MUNMAP, SHIM_EPOLL_CTL, SHIM_EPOLL_WAIT, SHIM_FCNTL,
+    SHIM_ACCEPT, SHIM_FUTEX, SHIM_OTHER,
+    SHIM_NUM
+};
+
+extern const char* const SHIM_NAME[SHIM_NUM];
+
+void shim_start(void);                  // 清零并开始计数
+void shim_pause(void);                  // 暂停（客户端一侧的操作不算）
+void shim_resume(void);
+void shim_stop(unsigned long* counts, unsigned long* allocs);   // counts至少SHIM_NUM个
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // REGRESS_SHIM_H
@@ -5,6 +5,21 @@
  */ 
 #include "../code/log/log.h"
 #include "../code/pool/threadpool.h"
+#include "../code/pool/futexevent.h"
+#include "../code/buffer/buffer.h"
+#include "../code/buffer/chainbuffer.h"
+#include "../code/http/httprequest.h"
+#include "../code/pool/localauth.h"
+#include "../code/pool/sqlreplicas.h"
+#include "../code/buffer/arena.h"
+#include "../code/http/httpconn.h"
+#include "../code/metrics/shmstats.h"
+#include <fstream>
+#include <sstream>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include <features.h>
 
 #if __GLIBC__ == 2 && __GLIBC_MINOR__ < 30
@@ -12,6 +27,450 @@
 #define gettid() syscall(SYS_gettid)
 #endif
 
+void TestBuffer() {
+    Buffer buff(16);
+    std::string data(5000, 'a');
+    buff.Append(data);
+    assert(buff.ReadableBytes() == 5000);
+    assert(buff.Capacity() == BufferPool::ChunkSize(5001));
+    buff.Retrieve(4000);
+    buff.Append("tail");
+    assert(buff.RetrieveAllToStr() == std::string(1000, 'a') + "tail");
+
+    // 空闲时归还内存块，再次写入时按需申请
+    buff.Release();
+    assert(buff.Capacity() == 0);
+    assert(BufferPool::CachedBytes() > 0);
+    buff.Append("again");
+    assert(buff.RetrieveAllToStr() == "again");
+}
+
+void TestChainBuffer() {
+    int fds[2];
+    int ret = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    assert(ret == 0);
+
+    // 让请求行落在第一个块末尾，"\r\n"跨块
+    std::string pad(1024 - 2 - 16, 'x');
+    std::string req = "GET /" + pad + " HTTP/1.1\r\n"
+                      "Connection: keep-alive\r\n\r\n";
+    ssize_t n = write(fds[0], req.data(), req.size());
+    assert(n == (ssize_t)req.size());
+
+    ChainBuffer chain(1024);
+    int err = 0;
+    n = chain.ReadFd(fds[1], &err);
+    assert(n == (ssize_t)req.size());
+    assert(chain.BlockCount() == 2);
+    assert(chain.FindCRLF() == req.find("\r\n"));
+
+    HttpRequest request;
+    bool parsed = request.parse(chain);
+    assert(parsed);
+    assert(std::string_view(request.path()) == "/" + pad);
+    assert(request.IsKeepAlive());
+
+    // 追加的数据分散在多块中，按块依次取出
+    ChainBuffer out(1024);
+    std::string data(5000, 'b');
+    out.Append(data);
+    assert(out.BlockCount() == 5);
+    std::string_view slices[8];
+    size_t cnt = out.Slices(slices, 8), total = 0;
+    for(size_t i = 0; i < cnt; i++) { total += slices[i].size(); }
+    assert(cnt == 5 && total == 5000);
+    std::string all = out.RetrieveAllToStr();
+    assert(all == data && out.ReadableBytes() == 0);
+
+    // 尾块装得下时不申请新块
+    ChainBuffer small(1024);
+    n = write(fds[0], "GET / HTTP/1.1\r\n", 16);
+    assert(n == 16);
+    n = small.ReadFd(fds[1], &err);
+    assert(n == 16);
+    assert(small.BlockCount() == 1);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void TestArena() {
+    Arena arena;
+    HttpRequest request(arena.Resource());
+    for(int i = 0; i < 3; i++) {
+        Buffer buff;
+        buff.Append("GET /picture HTTP/1.1\r\nConnection: close\r\n"
+                    "User-Agent: a-rather-long-user-agent-string-to-leave-sso\r\n\r\n");
+        assert(request.parse(buff));
+        assert(request.path() == "/picture.html");
+        assert(request.method() == "GET");
+        assert(!request.IsKeepAlive());
+        // 请求结束：先丢弃对象再整体释放
+        request.Init();
+        arena.Reset();
+    }
+
+    // 流水线：一次读到两个请求，第一个请求解析完后剩下的留给下一次；
+    // 路径超过短字符串长度，检查上一个请求的内存不会被复用
+    Buffer buff;
+    for(int i = 0; i < 2; i++) {
+        buff.Append("GET /images/instagram-image" + std::to_string(i) + ".jpg HTTP/1.1\r\n"
+                    "Connection: keep-alive\r\n\r\n");
+    }
+    for(int i = 0; i < 2; i++) {
+        assert(request.parse(buff));
+        std::string path = "/images/instagram-image" + std::to_string(i) + ".jpg";
+        assert(request.path() == path.c_str());
+        assert(request.IsKeepAlive());
+        request.Init();
+        arena.Reset();
+    }
+    assert(buff.ReadableBytes() == 0);
+
+    // 流水线上的下一个请求只读到一半：留在缓冲区，收到剩下的数据后继续解析
+    buff.Append("GET /index.html HTTP/1.1\r\n\r\nGET /pict");
+    assert(request.parse(buff) && request.IsFinished());
+    request.Init();
+    arena.Reset();
+    assert(request.parse(buff) && !request.IsFinished());
+    buff.Append("ure HTTP/1.1\r\nConnection: keep-alive\r\n\r\n");
+    assert(request.parse(buff) && request.IsFinished());
+    assert(request.path() == "/picture.html" && request.IsKeepAlive());
+    request.Init();
+    arena.Reset();
+
+    // 请求体没收全时等待，不把下一个请求当作请求体
+    buff.Append("POST /x HTTP/1.1\r\nContent-Length: 6\r\n\r\nab");
+    assert(request.parse(buff) && !request.IsFinished());
+    buff.Append("cdefGET / HTTP/1.1\r\n\r\n");
+    assert(request.parse(buff) && request.IsFinished());
+    request.Init();
+    arena.Reset();
+    assert(request.parse(buff) && request.path() == "/index.html");
+    assert(buff.ReadableBytes() == 0);
+
+    // 一行一直没有\r\n、首部行不断：超过长度限制时返回400，不再等待
+    request.Init();
+    arena.Reset();
+    Buffer longLine;
+    longLine.Append("GET /" + std::string(HttpRequest::MAX_LINE, 'a'));
+    bool parsed = request.parse(longLine);
+    assert(!parsed && request.ErrorCode() == 400);
+    request.Init();
+    arena.Reset();
+    Buffer headers;
+    headers.Append("GET / HTTP/1.1\r\n");
+    parsed = true;
+    for(int i = 0; parsed && i < 1000; i++) {
+        headers.Append("X-Pad-" + std::to_string(i) + ": " + std::string(100, 'p') + "\r\n");
+        parsed = request.parse(headers);
+        assert(!parsed || !request.IsFinished());
+    }
+    assert(!parsed && request.ErrorCode() == 400);
+
+    // 请求体过大时在缓冲请求体之前返回413；Content-Length不是数字时返回400
+    request.Init();
+    arena.Reset();
+    Buffer body;
+    body.Append("POST /x HTTP/1.1\r\nContent-Length: 2000000000\r\n\r\n");
+    parsed = request.parse(body);
+    assert(!parsed && request.ErrorCode() == 413);
+    for(const char* len : { "12abc", "-1", "99999999999999999999999" }) {
+        request.Init();
+        arena.Reset();
+        Buffer bad;
+        bad.Append(std::string("POST /x HTTP/1.1\r\nContent-Length: ") + len + "\r\n\r\n");
+        parsed = request.parse(bad);
+        assert(!parsed && request.ErrorCode() == 400);
+    }
+    request.Init();
+    arena.Reset();
+    Buffer ok;
+    ok.Append("POST /x HTTP/1.1\r\nContent-Length: 2 \r\n\r\nab");
+    parsed = request.parse(ok);
+    assert(parsed && request.IsFinished() && ok.ReadableBytes() == 0);
+}
+
+void TestRouter() {
+    Router router;
+    auto handler = [](const HttpRequest&, Router::Reply*) {};
+    router.File("/", "/index.html");
+    router.Static("/static", "/assets");
+    router.HandlePrefix("", "/api/", handler);
+    router.Handle("GET", "/api/users", handler);
+    router.Handle("POST", "/api/users", handler);
+    router.Form("/login.html", Router::ACTION_LOGIN);
+    router.File("/apple", "/apple.html");        // 和/api共用边/ap，插入时拆开
+
+    assert(router.Match("GET", "/")->target == "/index.html");
+    assert(router.Match("GET", "/apple")->target == "/apple.html");
+    // 前缀只在路径段的边界上匹配
+    assert(router.Match("GET", "/static/css/a.css")->target == "/assets");
+    assert(router.Match("GET", "/static")->target == "/assets");
+    assert(!router.Match("GET", "/statics/a.css"));
+    assert(!router.Match("GET", "/ap"));
+    // 精确路由按方法区分，没有对应方法时用前缀路由；查询串不参与匹配
+    assert(router.Match("GET", "/api/users?id=1")->method == "GET");
+    assert(router.Match("POST", "/api/users")->method == "POST");
+    assert(router.Match("PUT", "/api/users")->prefixLen == 5);
+    assert(router.Match("GET", "/api/other")->action == Router::ACTION_HANDLER);
+    // 表单只接受POST，GET按路径查找文件
+    assert(router.Match("POST", "/login.html")->action == Router::ACTION_LOGIN);
+    assert(!router.Match("GET", "/login.html"));
+    // 再次注册替换原来的路由
+    size_t routes = router.Size();
+    router.File("/", "/home.html");
+    assert(router.Size() == routes && router.Match("GET", "/")->target == "/home.html");
+
+    // 静态目录挂载：请求路径的前缀换成资源目录下的目录
+    Router::Instance()->Static("/gallery/", "/images/");
+    HttpRequest request;
+    Buffer buff;
+    buff.Append("GET /gallery/profile-image.jpg HTTP/1.1\r\n\r\n");
+    assert(request.parse(buff));
+    assert(request.path() == "/images/profile-image.jpg");
+}
+
+void TestPostLogin() {
+    // 登录请求解析时不访问数据库，只标记为待查询
+    HttpRequest request;
+    Buffer buff;
+    std::string body = "username=mark&password=123";
+    buff.Append("POST /login HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+                "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body);
+    assert(request.parse(buff));
+    assert(request.NeedVerify());
+    assert(request.path() == "/login.html");
+    assert(request.GetPost("username") == "mark");
+    request.Init();
+    assert(!request.NeedVerify());
+}
+
+void TestCredCache() {
+    CredCache* cache = CredCache::Instance();
+    cache->Init(60, 1 << 20);
+    std::string_view pwd = "secret";
+    assert(cache->Check("mark", pwd, true) == -1);
+    cache->Put("mark", &pwd);
+    assert(cache->Check("mark", "secret", true) == 1);
+    assert(cache->Check("mark", "wrong", true) == 0);
+    assert(cache->Check("mark", "x", false) == 0);        // 用户已存在，注册失败
+    cache->Put("nobody", nullptr);
+    assert(cache->Check("nobody", "x", true) == 0);
+    assert(cache->Check("nobody", "x", false) == -1);     // 不存在的用户注册仍要写数据库
+    cache->Invalidate("mark");
+    assert(cache->Check("mark", "secret", true) == -1);
+
+    // 超过内存上限时淘汰最久未使用的条目
+    uint64_t evicted = Metrics::Counter(Metrics::AUTH_CACHE_EVICTIONS);
+    cache->Init(60, 16 * 1024);
+    for(int i = 0; i < 1000; i++) {
+        cache->Put("user" + std::to_string(i), &pwd);
+    }
+    assert(cache->Bytes() <= 16 * 1024 && cache->Entries() < 1000);
+    assert(Metrics::Counter(Metrics::AUTH_CACHE_EVICTIONS) > evicted);
+    assert(cache->Check("user999", "secret", true) == 1);
+    cache->Init(0, 0);
+}
+
+void TestSession() {
+    SessionStore* store = SessionStore::Instance();
+    store->Init(1, 1024);
+    char id[SessionStore::ID_LEN], other[SessionStore::ID_LEN];
+    assert(store->Create("mark", id) && store->Create("mark", other));
+    assert(std::string_view(id, sizeof(id)) != std::string_view(other, sizeof(other)));
+    std::string user;
+    assert(store->Find(std::string_view(id, sizeof(id)), &user) && user == "mark");
+    assert(!store->Find("0123456789abcdef0123456789abcdef", &user));
+    std::string cookie = "a=1; sid=" + std::string(id, sizeof(id)) + "; b=2";
+    assert(SessionStore::ParseCookie(cookie) == std::string_view(id, sizeof(id)));
+    assert(SessionStore::ParseCookie("xsid=1; a=2").empty());
+
+    // 带Cookie访问需要登录的页面，解析首部时得到用户名；没有会话时转到登录页
+    HttpRequest request;
+    Buffer buff;
+    buff.Append("GET /welcome.html HTTP/1.1\r\nCookie: " + cookie + "\r\n\r\n"
+                "GET /welcome.html HTTP/1.1\r\n\r\n");
+    assert(request.parse(buff));
+    assert(strcmp(request.user().c_str(), "mark") == 0);
+    assert(strcmp(request.path().c_str(), "/welcome.html") == 0);
+    request.Init();
+    assert(request.parse(buff));
+    assert(request.user().empty());
+    assert(strcmp(request.path().c_str(), "/login.html") == 0);
+
+    // 路径规范化之后再判断：换一种写法不能绕过登录，..不能超出资源目录
+    const char* paths[][2] = {
+        { "//welcome.html", "/login.html" }, { "/./welcome.html", "/login.html" },
+        { "/%77elcome.html", "/login.html" }, { "/images/../welcome.html", "/login.html" },
+        { "/../../etc/passwd", "/etc/passwd" }, { "/images//a.jpg?x=/../", "/images/a.jpg?x=/../" },
+        { "/images/", "/images/" },
+    };
+    for(auto& p : paths) {
+        request.Init();
+        buff.Append(std::string("GET ") + p[0] + " HTTP/1.1\r\n\r\n");
+        assert(request.parse(buff));
+        assert(strcmp(request.path().c_str(), p[1]) == 0);
+    }
+    request.Init();
+    buff.Append("GET /a%00.html HTTP/1.1\r\n\r\n");
+    assert(!request.parse(buff));
+    buff.RetrieveAll();
+
+    // 过期的会话查不到，Expire()清理
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    assert(!store->Find(std::string_view(id, sizeof(id)), &user));
+    assert(store->Expire() == 2 && store->Size() == 0);
+    // 未到期的会话留在到期队列里，不被清理
+    assert(store->Create("mark", id));
+    assert(store->Expire() == 0 && store->Size() == 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    assert(store->Expire() == 1 && store->Size() == 0);
+    store->Init(0, 0);
+}
+
+void TestRegisterWriter() {
+    // 同时到达的注册合并成一批，每个请求拿到自己那一行的结果
+    std::vector<size_t> batches;
+    std::atomic<bool> slow(false);
+    RegisterWriter writer([&batches, &slow](std::vector<RegisterWriter::Row*>& rows) {
+        if(slow) { std::this_thread::sleep_for(std::chrono::milliseconds(100)); }
+        batches.push_back(rows.size());
+        for(RegisterWriter::Row* row : rows) {
+            row->result = (row->name == "used") ? 0 : 1;
+        }
+    });
+    int ret = writer.Submit("a", "1");
+    assert(ret == 1 && batches.size() == 1);     // 默认不等待
+    writer.SetBatch(200000, 8);
+    std::vector<std::thread> threads;
+    std::atomic<int> ok(0), used(0);
+    for(int i = 0; i < 8; i++) {
+        threads.emplace_back([&, i] {
+            int ret = writer.Submit(i == 3 ? "used" : "user" + std::to_string(i), "pwd");
+            (ret == 1 ? ok : used)++;
+        });
+    }
+    for(auto& t : threads) { t.join(); }
+    assert(ok == 7 && used == 1);
+    assert(batches.size() == 2 && batches[1] == 8);     // 凑满8个提前提交
+
+    // 不定时等待：单独的注册立即写入，上一批写入期间到达的注册合并成一批
+    writer.SetBatch(0, 8);
+    slow = true;
+    threads.clear();
+    threads.emplace_back([&] { (writer.Submit("first", "pwd") == 1 ? ok : used)++; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    slow = false;
+    for(int i = 0; i < 4; i++) {
+        threads.emplace_back([&, i] { (writer.Submit("late" + std::to_string(i), "pwd") == 1 ? ok : used)++; });
+    }
+    for(auto& t : threads) { t.join(); }
+    assert(ok == 7 + 5 && used == 1);
+    assert(batches.size() == 4 && batches[2] == 1 && batches[3] == 4);
+}
+
+void TestSqlReplicas() {
+    assert(SqlReplicas::Count("") == 0);
+    assert(SqlReplicas::Count("db1:3307,,db2") == 2);     // 省略端口为3306
+    assert(SqlReplicas::Count("db1:x") == 0);
+
+    // 最小连接数为0，不会在后台建立连接
+    SqlReplicas* replicas = SqlReplicas::Instance();
+    replicas->Init("127.0.0.1:1,127.0.0.1:2", "root", "", "webserver", 1, 0, 100, 100);
+    assert(replicas->Size() == 2);
+    // 进行中的查询最少的副本优先
+    int first = replicas->Pick();
+    int second = replicas->Pick();
+    assert(first >= 0 && second >= 0 && first != second);
+    replicas->Done(first);
+    assert(replicas->Pick() == first);
+    replicas->Done(first);
+    replicas->Done(second);
+
+    // 写入后一段时间内读主库
+    replicas->Pin("mark");
+    assert(replicas->Pinned("mark") && !replicas->Pinned("other"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    assert(!replicas->Pinned("mark"));
+    replicas->Close();
+}
+
+void TestLocalAuth() {
+    const char* path = "./testauth.db";
+    unlink(path);
+    LocalAuth auth;
+    assert(auth.Open(path));
+    std::string pwd;
+    assert(auth.Lookup("mark", &pwd) == 0);
+    assert(auth.Insert("mark", "123") == 1);
+    assert(auth.Insert("mark", "456") == 0);
+    assert(auth.Lookup("mark", &pwd) == 1 && pwd == "123");
+    assert(auth.Insert(std::string(LocalAuth::MAX_NAME + 1, 'x'), "1") == -1);
+
+    // 超过装载率时扩容，内容不变
+    for(int i = 0; i < 2000; i++) {
+        assert(auth.Insert("user" + std::to_string(i), std::to_string(i)) == 1);
+    }
+    assert(auth.Size() == 2001 && auth.Capacity() >= 4096);
+    LocalAuth other;
+    assert(!other.Open(path));      // 同一文件只能有一个进程打开
+    auth.Close();
+
+    // 重新打开后数据还在
+    assert(auth.Open(path));
+    assert(auth.Size() == 2001);
+    assert(auth.Lookup("user1999", &pwd) == 1 && pwd == "1999");
+
+    // 同时到达的注册合并成一批：同步完成后都能查到，同一批里重名的只有一个成功
+    auth.SetBatch(200000, 10);
+    std::vector<std::thread> threads;
+    std::atomic<int> ok(0), used(0);
+    for(int i = 0; i < 10; i++) {
+        threads.emplace_back([&, i] {
+            int ret = auth.Insert(i < 2 ? "dup" : "batch" + std::to_string(i), "pwd");
+            (ret == 1 ? ok : used)++;
+        });
+    }
+    for(auto& th : threads) { th.join(); }
+    assert(ok == 9 && used == 1 && auth.Size() == 2010);
+    assert(auth.Lookup("dup", &pwd) == 1 && auth.Lookup("batch9", &pwd) == 1 && pwd == "pwd");
+    auth.SetBatch(0, 1);
+
+    // 登录/注册走本地用户表
+    auth.Close();
+    assert(AuthBackend::Init(AuthBackend::BACKEND_LOCAL, path));
+    HttpRequest request;
+    Buffer buff;
+    std::string body = "username=local&password=pw";
+    buff.Append("POST /register HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+                "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body);
+    assert(request.parse(buff) && request.NeedVerify());
+    request.Verify();
+    assert(strcmp(request.path().c_str(), "/welcome.html") == 0);
+    assert(AuthBackend::Instance()->Lookup("local", &pwd) == 1 && pwd == "pw");
+    assert(AuthBackend::Init(AuthBackend::BACKEND_MYSQL, nullptr));
+    unlink(path);
+
+    // 建文件时在写文件头之前崩溃：全0的文件重新初始化，有数据但没有文件头的仍然拒绝
+    const off_t initSize = 128 + 1024 * 128;
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    assert(fd >= 0);
+    int ret = ftruncate(fd, initSize);
+    assert(ret == 0);
+    assert(auth.Open(path) && auth.Size() == 0 && auth.Capacity() == 1024);
+    assert(auth.Insert("mark", "123") == 1);
+    auth.Close();
+    ret = ftruncate(fd, 0);
+    assert(ret == 0);
+    ret = ftruncate(fd, initSize);
+    assert(ret == 0);
+    ssize_t n = pwrite(fd, "x", 1, 128 + 5 * 128);
+    assert(n == 1);
+    close(fd);
+    assert(!auth.Open(path));
+    unlink(path);
+}
+
 void TestLog() {
     int cnt = 0, level = 0;
     Log::Instance()->init(level, "./testlog1", ".log", 0);
@@ -35,6 +494,322 @@ void TestLog() {
     }
 }
 
+void TestLogManyThreads() {
+    // 线程数超过一次writev能容纳的缓冲区数（MAX_IOV/2）：分批写出，flush不会一直等待
+    if(DIR* old = opendir("./testlog3")) {
+        while(struct dirent* ent = readdir(old)) {
+            unlink((std::string("./testlog3/") + ent->d_name).c_str());
+        }
+        closedir(old);
+    }
+    Log::Instance()->init(1, "./testlog3", ".log", 256);
+    // 线程都不退出，缓冲区同时存在
+    const int threads = 600;
+    std::atomic<int> logged(0);
+    std::atomic<bool> done(false);
+    std::vector<std::thread> workers;
+    for(int i = 0; i < threads; i++) {
+        workers.emplace_back([i, &logged, &done] {
+            LOG_INFO("many-threads %d", i);
+            logged++;
+            while(!done) { std::this_thread::sleep_for(std::chrono::milliseconds(1)); }
+        });
+    }
+    while(logged < threads) { std::this_thread::yield(); }
+    Log::Instance()->flush();
+    done = true;
+    for(auto& t : workers) { t.join(); }
+    DIR* dir = opendir("./testlog3");
+    assert(dir);
+    int lines = 0;
+    while(struct dirent* ent = readdir(dir)) {
+        std::ifstream in(std::string("./testlog3/") + ent->d_name);
+        std::string line;
+        while(std::getline(in, line)) {
+            if(line.find("many-threads") != std::string::npos) { lines++; }
+        }
+    }
+    closedir(dir);
+    assert(lines == threads);
+}
+
+void TestLogOverflow() {
+    // 日志文件换成没人读的管道，写线程卡在writev里，本线程的环形缓冲区很快写满
+    mkdir("./testlog4", 0777);
+    time_t now = time(nullptr);
+    struct tm t;
+    localtime_r(&now, &t);
+    char path[64];
+    snprintf(path, sizeof(path), "./testlog4/%04d_%02d_%02d.log", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);
+    unlink(path);
+    int ret = mkfifo(path, 0644);
+    assert(ret == 0);
+    int reader = open(path, O_RDONLY | O_NONBLOCK);
+    assert(reader >= 0);
+    Log* log = Log::Instance();
+    log->init(0, "./testlog4", ".log", 1);
+    log->SetOverflowPolicy(Log::OVERFLOW_DROP);
+    // 等长的日志：一条放不下时之后的也放不下
+    for(int round = 0; round < 2; round++) {
+        uint64_t dropped = log->Dropped();
+        for(int i = 0; i < 100000 && log->Dropped() == dropped; i++) {
+            LOG_BASE(1, "overflow %0800d", i);
+        }
+        assert(log->Dropped() > dropped);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));  // 写线程把能写的都写进管道
+    }
+
+    // 全部丢弃：不等待
+    uint64_t dropped = log->Dropped(), delayed = log->Delayed();
+    for(int i = 0; i < 10; i++) {
+        LOG_BASE(1, "overflow %0800d", i);
+        LOG_BASE(3, "overflow %0800d", i);
+    }
+    assert(log->Dropped() == dropped + 20 && log->Delayed() == delayed);
+
+    // 低于warn的丢弃，warn及以上等待，超时后仍丢弃
+    log->SetOverflowPolicy(Log::OVERFLOW_DROP_BELOW, 2, 1);
+    for(int i = 0; i < 10; i++) {
+        LOG_BASE(1, "overflow %0800d", i);
+        LOG_BASE(2, "overflow %0800d", i);
+    }
+    assert(log->Dropped() == dropped + 40 && log->Delayed() == delayed + 10);
+
+    // 全部等待：写线程腾出空间后写入，不丢弃
+    log->SetOverflowPolicy(Log::OVERFLOW_BLOCK, 2, 5000);
+    std::atomic<bool> stop(false);
+    std::thread drain([reader, &stop] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        char buf[65536];
+        while(!stop) {
+            if(read(reader, buf, sizeof(buf)) <= 0) { std::this_thread::sleep_for(std::chrono::milliseconds(1)); }
+        }
+    });
+    LOG_BASE(1, "overflow %0800d", 0);
+    assert(log->Dropped() == dropped + 40 && log->Delayed() == delayed + 11);
+
+    // 换回普通文件，恢复默认策略
+    unlink(path);
+    log->init(1, "./testlog4", ".log", 256);
+    stop = true;
+    drain.join();
+    close(reader);
+    log->SetOverflowPolicy(Log::OVERFLOW_DROP_BELOW);
+}
+
+void TestLogLevel() {
+    Log* log = Log::Instance();
+    log->SetLevel(2);
+    log->SetModuleLevel(Log::MODULE_HTTP, 0);
+    assert(log->GetLevel(Log::MODULE_HTTP) == 0);
+    assert(log->GetLevel(Log::MODULE_POOL) == 2);
+    log->SetModuleLevel(Log::MODULE_HTTP, -1);     // 恢复跟随全局级别
+    assert(log->GetLevel(Log::MODULE_HTTP) == 2);
+}
+
+void TestLogCodec() {
+    // 编码后再格式化，应与printf的结果一致
+    const char* format = "%s:%d %-5.3s|%.*s %5.2f %llu %c %x%%";
+    logcodec::LogFormat fmt(format);
+    char rec[256];
+    logcodec::Encoder enc(rec, sizeof(rec), &fmt);
+    enc.Begin(2, 7, 1592280000123456);
+    enc.Add("GET"); enc.Add(200); enc.Add("abcdef"); enc.Add(2); enc.Add("xyz");
+    enc.Add(3.14159); enc.Add(12345678901ULL); enc.Add('A'); enc.Add(255u);
+    size_t len = enc.Finish();
+
+    std::string out;
+    logcodec::FormatRecord(fmt, rec, len, &out);
+    char expect[256];
+    snprintf(expect, sizeof(expect), format, "GET", 200, "abcdef", 2, "xyz",
+            3.14159, 12345678901ULL, 'A', 255u);
+    assert(out.size() > 27 && out.compare(27, 9, "[warn] : ") == 0);
+    assert(out.substr(36) == std::string(expect) + "\n");
+}
+
+void TestFutexEvent() {
+    // 先Prepare再检查条件：通知发生在两者之间也不会丢失唤醒
+    FutexEvent ev;
+    std::atomic<bool> ready(false);
+    std::thread waiter([&ev, &ready] {
+        while(true) {
+            uint32_t seq = ev.Prepare();
+            if(ready.load()) { ev.Cancel(); break; }
+            ev.Wait(seq, -1);
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ready = true;
+    ev.Notify();
+    waiter.join();
+
+    // 没有通知时按超时返回
+    auto start = std::chrono::steady_clock::now();
+    uint32_t seq = ev.Prepare();
+    ev.Wait(seq, 20);
+    assert(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(15));
+}
+
+void TestAccessLog() {
+    AccessLog::Instance()->Init("./testAccess/access.log", AccessLog::FORMAT_JSON, 1);
+    HttpConn::accessLog = true;
+    HttpConn::srcDir = "../resources/";
+
+    int fds[2];
+    int ret = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    assert(ret == 0);
+    sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    HttpConn conn;
+    conn.init(fds[0], addr);
+
+    const char req[] = "GET /nothere HTTP/1.1\r\nConnection: keep-alive\r\nUser-Agent: test\r\n\r\n";
+    ssize_t n = write(fds[1], req, sizeof(req) - 1);
+    assert(n == sizeof(req) - 1);
+    int err = 0;
+    conn.read(&err);
+    bool processed = conn.process();
+    assert(processed);
+    conn.write(&err);
+    assert(conn.ToWriteBytes() == 0);
+    AccessLog::Instance()->Flush();
+
+    // 文件按日期命名：./testAccess/access_年_月_日.log
+    std::string first = AccessLog::Instance()->FileName();
+    assert(first.compare(0, 20, "./testAccess/access_") == 0);
+    assert(first.size() == 34 && first.compare(30, 4, ".log") == 0);
+    std::ifstream in(first);
+    std::string line, last;
+    while(std::getline(in, line)) { last = line; }
+    assert(last.find("\"ip\":\"127.0.0.1\",\"method\":\"GET\",\"path\":\"/nothere\"") != std::string::npos);
+    assert(last.find("\"status\":404") != std::string::npos);
+    assert(last.find("\"reuse\":0") != std::string::npos);
+    assert(last.find("\"user_agent\":\"test\"") != std::string::npos);
+
+    // 超过大小上限时切分到新文件，和普通日志共用切分逻辑
+    AccessLog::Instance()->SetRotation(1);
+    AccessLog::Instance()->SetRetention(0, false);
+    n = write(fds[1], req, sizeof(req) - 1);
+    assert(n == sizeof(req) - 1);
+    conn.read(&err);
+    processed = conn.process();
+    assert(processed);
+    conn.write(&err);
+    AccessLog::Instance()->Flush();
+    std::string second = AccessLog::Instance()->FileName();
+    assert(second.compare(0, 30, first, 0, 30) == 0 && second[30] == '-');     // access_年_月_日-n.log
+    std::ifstream rotated(second);
+    std::getline(rotated, line);
+    assert(line.find("\"reuse\":1") != std::string::npos);
+    AccessLog::Instance()->SetRotation(64 << 20);
+    AccessLog::Instance()->SetRetention(1UL << 30);
+    conn.Close();
+    close(fds[1]);
+}
+
+void TestMetrics() {
+    for(uint64_t v : {0ULL, 7ULL, 8ULL, 9ULL, 1000ULL, 123456789ULL, ~0ULL}) {
+        int b = Metrics::BucketOf(v);
+        assert(b >= 0 && b < Metrics::BUCKETS);
+        assert(v <= Metrics::BucketUpper(b) && (b == 0 || v > Metrics::BucketUpper(b - 1)));
+    }
+
+    uint64_t before = Metrics::Counter(Metrics::SQL_WAITS);
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; t++) {
+        threads.emplace_back([] {
+            for(int i = 0; i < 10000; i++) { Metrics::Add(Metrics::SQL_WAITS); }
+        });
+    }
+    for(auto& th : threads) { th.join(); }
+    assert(Metrics::Counter(Metrics::SQL_WAITS) == before + 40000);
+
+    for(int i = 1; i <= 1000; i++) { Metrics::Record(Metrics::HIST_PARSE, 1000000 + i); }
+    double p50 = Metrics::Quantile(Metrics::HIST_PARSE, 0.5);
+    assert(p50 >= 1000000 && p50 <= 1000000 * 1.125);
+
+    // 回调在锁外调用，回调里再读指标不会死锁
+    Metrics::AddGauge("test_nested", "Gauge reading another metric.", [] {
+        return (double)Metrics::Counter(Metrics::SQL_WAITS);
+    });
+    Metrics::Samples counters, gauges;
+    Metrics::Snapshot(&counters, &gauges);
+    assert(!gauges.empty() && gauges.back().first == "test_nested");
+    assert(gauges.back().second == (double)(before + 40000));
+
+    // 保留路径/metrics
+    int fds[2];
+    int ret = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    assert(ret == 0);
+    sockaddr_in addr = { 0 };
+    HttpConn conn;
+    conn.init(fds[0], addr);
+    const char req[] = "GET /metrics HTTP/1.1\r\n\r\n";
+    ssize_t len = write(fds[1], req, sizeof(req) - 1);
+    assert(len == sizeof(req) - 1);
+    int err = 0;
+    conn.read(&err);
+    bool processed = conn.process();
+    assert(processed);
+    conn.write(&err);
+    char resp[16384];
+    ssize_t n = read(fds[1], resp, sizeof(resp) - 1);
+    assert(n > 0);
+    resp[n] = '\0';
+    assert(strstr(resp, "HTTP/1.1 200 OK") == resp);
+    assert(strstr(resp, "webserver_sql_waits_total"));
+    assert(strstr(resp, "webserver_parse_seconds{quantile=\"0.5\"}"));
+    conn.Close();
+    close(fds[1]);
+}
+
+void TestShmStats() {
+    const char* name = "/webserver-test";
+    ShmStats stats;
+    assert(stats.Start(name, 10, [](std::vector<shmstats::Thread>* threads) {
+        shmstats::Thread t = { shmstats::THREAD_WORKER, 1, 0, 7, 42, 3 };
+        threads->push_back(t);
+    }));
+    Metrics::Add(Metrics::TIMER_EXPIRED, 5);
+    Metrics::Adjust(Metrics::CONN_WRITING, 2);
+    stats.Publish();
+
+    std::unique_ptr<shmstats::Snapshot> snap(new shmstats::Snapshot);
+    int pid = 0;
+    assert(ShmStats::Read(name, snap.get(), &pid));
+    assert(pid == getpid());
+    bool found = false;
+    for(uint32_t i = 0; i < snap->counterCnt; i++) {
+        if(strcmp(snap->counters[i].name, "timer_expired") == 0) {
+            assert(snap->counters[i].value == Metrics::Counter(Metrics::TIMER_EXPIRED));
+            found = true;
+        }
+    }
+    assert(found);
+    found = false;
+    for(uint32_t i = 0; i < snap->gaugeCnt; i++) {
+        if(strcmp(snap->gauges[i].name, "connections_writing") == 0) {
+            assert(snap->gauges[i].value == Metrics::Level(Metrics::CONN_WRITING));
+            found = true;
+        }
+    }
+    assert(found);
+    assert(snap->threadCnt == 1 && snap->threads[0].index == 7 && snap->threads[0].tasks == 42);
+    Metrics::Adjust(Metrics::CONN_WRITING, -2);
+
+    // 发布线程在运行：读到的快照总是一致的
+    int64_t last = snap->updateUs;
+    for(int i = 0; i < 20; i++) {
+        assert(ShmStats::Read(name, snap.get()));
+        assert(snap->updateUs >= last && snap->threadCnt == 1);
+        last = snap->updateUs;
+        usleep(2000);
+    }
+    stats.Stop();
+    assert(!ShmStats::Read(name, snap.get()));
+}
+
 void ThreadLogTask(int i, int cnt) {
     for(int j = 0; j < 10000; j++ ){
         LOG_BASE(i,"PID:[%04d]======= %05d ========= ", gettid(), cnt++);
@@ -51,6 +826,24 @@ void TestThreadPool() {
 }
 
 int main() {
+    TestBuffer();
+    TestChainBuffer();
+    TestArena();
+    TestPostLogin();
+    TestCredCache();
+    TestSession();
+    TestRegisterWriter();
+    TestLocalAuth();
+    TestRouter();
+    TestSqlReplicas();
     TestLog();
+    TestLogManyThreads();
+    TestLogOverflow();
+    TestLogLevel();
+    TestLogCodec();
+    TestFutexEvent();
+    TestAccessLog();
+    TestMetrics();
+    TestShmStats();
     TestThreadPool();
 }
\ No newline at end of file
@@ -0,0 +1,96 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#include <cstdio>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include "../code/log/logcodec.h"
+
+using namespace std;
+
+/* 把二进制日志(.blog)还原成文本日志
+   用法：logdecode file.blog [...] > file.log，不带参数时读标准输入 */
+
+static bool ReadAll(FILE* fp, string* data) {
+    char buf[65536];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        data->append(buf, n);
+    }
+    return !ferror(fp);
+}
+
+static int Decode(const char* name, FILE* fp) {
+    string data;
+    if(!ReadAll(fp, &data)) {
+        fprintf(stderr, "logdecode: read %s failed\n", name);
+        return 1;
+    }
+    size_t off = 0;
+    if(data.compare(0, logcodec::MAGIC_LEN, logcodec::MAGIC) == 0) {
+        off = logcodec::MAGIC_LEN;
+    }
+
+    unordered_map<uint32_t, unique_ptr<logcodec::LogFormat>> formats;
+    string out;
+    while(off < data.size()) {
+        const char* p = data.data() + off;
+        size_t left = data.size() - off;
+        if(*p != logcodec::REC_LOG && *p != logcodec::REC_FORMAT) {
+            // 切换格式时留下的文本行，原样输出
+            size_t nl = data.find('\n', off);
+            size_t len = (nl == string::npos ? data.size() : nl + 1) - off;
+            out.append(p, len);
+            off += len;
+            continue;
+        }
+        if(left < logcodec::HEAD_LEN) { break; }
+        logcodec::RecordHead head;
+        logcodec::ReadHead(p, &head);
+        if(head.len < logcodec::HEAD_LEN || head.len > left) {
+            fprintf(stderr, "logdecode: %s: bad record at offset %zu\n", name, off);
+            return 1;
+        }
+        if(head.type == logcodec::REC_FORMAT) {
+            string fmt(p + logcodec::HEAD_LEN, head.len - logcodec::HEAD_LEN);
+            formats[head.fmtId].reset(new logcodec::LogFormat(fmt.c_str()));
+        } else {
+            auto it = formats.find(head.fmtId);
+            if(it != formats.end()) {
+                logcodec::FormatRecord(*it->second, p, head.len, &out);
+            } else {
+                logcodec::AppendTimestamp(head.usec, &out);
+                out.append(logcodec::LevelTitle(head.level), logcodec::LEVEL_TITLE_LEN);
+                out.append("<unknown format ").append(to_string(head.fmtId)).append(">\n");
+            }
+        }
+        off += head.len;
+        if(out.size() >= 65536) {
+            fwrite(out.data(), 1, out.size(), stdout);
+            out.clear();
+        }
+    }
+    fwrite(out.data(), 1, out.size(), stdout);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if(argc < 2) {
+        return Decode("<stdin>", stdin);
+    }
+    int ret = 0;
+    for(int i = 1; i < argc; i++) {
+        FILE* fp = fopen(argv[i], "rb");
+        if(!fp) {
+            fprintf(stderr, "logdecode: cannot open %s\n", argv[i]);
+            ret = 1;
+            continue;
+        }
+        ret |= Decode(argv[i], fp);
+        fclose(fp);
+    }
+    return ret;
+}
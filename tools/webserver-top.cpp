@@ -0,0 +1,107 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-20
+ * @copyleft Apache 2.0
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <memory>
+#include <cerrno>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "../code/metrics/shmstats.h"
+
+using namespace std;
+
+/* 读取服务器的共享内存统计段并显示，不向服务器发任何请求
+   用法：webserver-top [-p 端口 | -n 段名] [-d 刷新秒数] [-b]
+   -b 只输出一次（便于脚本处理），否则每隔-d秒刷新屏幕，计数器显示为每秒速率 */
+
+static int64_t NowUs() {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+static void Usage() {
+    fprintf(stderr, "usage: webserver-top [-p port | -n name] [-d seconds] [-b]\n");
+    exit(2);
+}
+
+static void Print(const shmstats::Snapshot& cur, const shmstats::Snapshot* prev, int pid) {
+    int64_t now = NowUs();
+    int64_t up = (cur.updateUs - cur.startUs) / 1000000;
+    double age = (now - cur.updateUs) / 1e6;
+    bool alive = kill(pid, 0) == 0 || errno == EPERM;
+    printf("webserver pid %d%s  up %lld:%02lld:%02lld  updated %.1fs ago%s\n\n", pid,
+            alive ? "" : " (exited)", (long long)up / 3600, (long long)up / 60 % 60,
+            (long long)up % 60, age, age * 1000 > 3.0 * cur.intervalMs ? " (stale)" : "");
+
+    // 计数器：与上一次快照相减得到速率
+    double elapsed = prev ? (cur.updateUs - prev->updateUs) / 1e6 : 0;
+    printf("%-32s %16s %12s\n", "COUNTER", "TOTAL", "/s");
+    for(uint32_t i = 0; i < cur.counterCnt; i++) {
+        const shmstats::Value& v = cur.counters[i];
+        printf("%-32s %16.0f", v.name, v.value);
+        if(prev && elapsed > 0 && i < prev->counterCnt && strcmp(prev->counters[i].name, v.name) == 0) {
+            printf(" %12.1f", (v.value - prev->counters[i].value) / elapsed);
+        }
+        printf("\n");
+    }
+
+    printf("\n%-32s %16s\n", "GAUGE", "VALUE");
+    for(uint32_t i = 0; i < cur.gaugeCnt; i++) {
+        printf("%-32s %16.6g\n", cur.gauges[i].name, cur.gauges[i].value);
+    }
+
+    printf("\n%-8s %-6s %6s %14s %12s\n", "THREAD", "KIND", "BUSY", "TASKS", "DEPTH");
+    for(uint32_t i = 0; i < cur.threadCnt; i++) {
+        const shmstats::Thread& t = cur.threads[i];
+        bool worker = t.kind == shmstats::THREAD_WORKER || t.kind == shmstats::THREAD_DB;
+        const char* kind = t.kind == shmstats::THREAD_WORKER ? "pool" : (worker ? "db" : "log");
+        printf("%-8u %-6s %6s %14llu %12llu\n", t.index, kind,
+                worker ? (t.busy ? "yes" : "-") : "", (unsigned long long)t.tasks,
+                (unsigned long long)t.depth);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[]) {
+    string name = shmstats::SegmentName(5050);
+    double delay = 1.0;
+    bool batch = false;
+    int opt;
+    while((opt = getopt(argc, argv, "p:n:d:bh")) != -1) {
+        switch(opt) {
+        case 'p': name = shmstats::SegmentName(atoi(optarg)); break;
+        case 'n': name = optarg[0] == '/' ? optarg : string("/") + optarg; break;
+        case 'd': delay = atof(optarg); break;
+        case 'b': batch = true; break;
+        default: Usage();
+        }
+    }
+    if(delay <= 0) { Usage(); }
+
+    // 两份快照交替使用，Snapshot较大，放在堆上
+    unique_ptr<shmstats::Snapshot[]> snaps(new shmstats::Snapshot[2]);
+    int cur = 0;
+    bool hasPrev = false;
+    while(true) {
+        int pid = 0;
+        if(!ShmStats::Read(name.c_str(), &snaps[cur], &pid)) {
+            fprintf(stderr, "webserver-top: cannot read %s (server not running or stats disabled)\n",
+                    name.c_str());
+            return 1;
+        }
+        if(!batch) { printf("\033[H\033[2J"); }
+        Print(snaps[cur], hasPrev ? &snaps[cur ^ 1] : nullptr, pid);
+        if(batch) { break; }
+        hasPrev = true;
+        cur ^= 1;
+        usleep((useconds_t)(delay * 1000000));
+    }
+    return 0;
+}